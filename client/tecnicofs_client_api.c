@@ -1,19 +1,20 @@
 #include "tecnicofs_client_api.h"
+#include "common/shm_ring.h"
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
-/* check if the len of the buffer is not bigger than the maximum size of an
- * atomic write to the pipe. */
-#define ensure_packet_len_limit(len)                                           \
-    if (len > PIPE_BUFFER_MAX_LEN) {                                           \
-        return -1;                                                             \
-    }
-
 /*
  * Copies the content to the packet.
  * Input:
@@ -28,240 +29,2172 @@ void packetcpy(void *packet, size_t *packet_offset, void const *data,
     *packet_offset += size;
 }
 
-static int pipe_in;
-static int pipe_out;
-static int session_id;
+/* the request pipe of a session is named after its response pipe */
+#define REQUEST_PIPE_SUFFIX ".req"
 
-static char pipename[PIPE_STRING_LENGTH + 1] = {0};
+/* a request sent to the server whose result wasn't collected yet */
+typedef struct {
+    bool in_use;
+    // whether the reply was received (while waiting for another one)
+    bool done;
+    char op_code;
+    // where the content of a read goes
+    void *buffer;
+    size_t len;
+    ssize_t result;
+    // run by the completion thread instead of collecting the result
+    tfs_callback_t callback;
+    void *arg;
+} pending_request_t;
 
-int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
-    strncpy(pipename, client_pipe_path, PIPE_STRING_LENGTH);
-    unlink(pipename);
+/* writes to a handle that were buffered instead of being sent */
+typedef struct {
+    bool in_use;
+    int fhandle;
+    char *data;
+    size_t len;
+    // the writes are sent once they would go over this size
+    size_t size;
+} write_buffer_t;
 
-    if (mkfifo(pipename, 0777) < 0) {
+/* contents of a file cached under a read lease from the server */
+typedef struct {
+    bool in_use;
+    int fhandle;
+    // whether the contents can be used (the lease was neither recalled nor
+    // has expired)
+    bool valid;
+    int lease_id;
+    struct timespec expires;
+    char *data;
+    size_t size;
+    // the offset of the handle is kept here while reading from the cache,
+    // and given back to the server (if it changed) before anything else is
+    // done with the handle
+    size_t offset;
+    bool offset_changed;
+    // the lease request in flight, if any
+    int lease_request_id;
+    struct timespec requested_at;
+    // whether a recall arrived while the lease was being requested
+    bool recalled;
+} read_cache_t;
+
+struct tfs_session {
+    int session_id;
+    int pipe_in;
+    int pipe_out;
+
+    char pipename[PIPE_STRING_LENGTH + 1];
+    char request_pipename[PIPE_STRING_LENGTH + 1];
+
+    /* shared memory region of the session, NULL unless it was mounted with
+     * tfs_session_mount_shared_memory */
+    shm_channel_t *channel;
+
+    /* indexed by request id */
+    pending_request_t pending_requests[MAX_PENDING_REQUESTS];
+    /* protects pending_requests and who is receiving replies */
+    pthread_mutex_t requests_lock;
+    /* signaled whenever a reply is received, or someone stops receiving */
+    pthread_cond_t requests_done;
+    /* held while a request is sent */
+    pthread_mutex_t send_lock;
+    /* priority class of every request, or TFS_PRIORITY_DEFAULT to choose it
+     * by the kind of request (see tfs_set_priority) */
+    atomic_int priority;
+
+    /* the handles whose writes are buffered (see tfs_set_write_buffer) */
+    write_buffer_t write_buffers[MAX_WRITE_BUFFERS];
+    /* protects write_buffers, and is held while they are flushed */
+    pthread_mutex_t buffers_lock;
+
+    /* the handles whose reads are cached (see tfs_set_read_cache) */
+    read_cache_t read_caches[MAX_READ_CACHES];
+    /* protects read_caches, never held while waiting for a reply, as the
+     * completion thread takes it to handle recalls */
+    pthread_mutex_t caches_lock;
+
+    /* whether a thread (the completion thread, or one waiting in
+     * tfs_session_collect) is receiving replies, as only one may do it */
+    bool receiving;
+    /* receives every reply once an asynchronous request was sent, until the
+     * session is unmounted */
+    pthread_t completion_thread;
+    bool completion_thread_started;
+};
+
+/* the session of the functions that don't take one */
+static tfs_session_t *default_session = NULL;
+
+/* distinguishes the shared memory objects of the sessions of a process */
+static _Atomic int shm_count = 0;
+
+/*
+ * Creates a session that isn't mounted yet.
+ * Returns the session, or NULL in case of error.
+ */
+static tfs_session_t *new_session() {
+    tfs_session_t *session = (tfs_session_t *)calloc(1, sizeof(tfs_session_t));
+    if (session == NULL) {
+        return NULL;
+    }
+    session->session_id = -1;
+    session->channel = NULL;
+    atomic_init(&session->priority, TFS_PRIORITY_DEFAULT);
+    if (pthread_mutex_init(&session->requests_lock, NULL) != 0) {
+        free(session);
+        return NULL;
+    }
+    if (pthread_cond_init(&session->requests_done, NULL) != 0) {
+        pthread_mutex_destroy(&session->requests_lock);
+        free(session);
+        return NULL;
+    }
+    if (pthread_mutex_init(&session->send_lock, NULL) != 0) {
+        pthread_cond_destroy(&session->requests_done);
+        pthread_mutex_destroy(&session->requests_lock);
+        free(session);
+        return NULL;
+    }
+    if (pthread_mutex_init(&session->buffers_lock, NULL) != 0) {
+        pthread_mutex_destroy(&session->send_lock);
+        pthread_cond_destroy(&session->requests_done);
+        pthread_mutex_destroy(&session->requests_lock);
+        free(session);
+        return NULL;
+    }
+    if (pthread_mutex_init(&session->caches_lock, NULL) != 0) {
+        pthread_mutex_destroy(&session->buffers_lock);
+        pthread_mutex_destroy(&session->send_lock);
+        pthread_cond_destroy(&session->requests_done);
+        pthread_mutex_destroy(&session->requests_lock);
+        free(session);
+        return NULL;
+    }
+    return session;
+}
+
+/*
+ * Frees a session created by new_session, whose pipes are already closed.
+ */
+static void free_session(tfs_session_t *session) {
+    for (int i = 0; i < MAX_READ_CACHES; i++) {
+        free(session->read_caches[i].data);
+    }
+    pthread_mutex_destroy(&session->caches_lock);
+    pthread_mutex_destroy(&session->buffers_lock);
+    pthread_mutex_destroy(&session->send_lock);
+    pthread_cond_destroy(&session->requests_done);
+    pthread_mutex_destroy(&session->requests_lock);
+    free(session);
+}
+
+/*
+ * Chooses the priority class of a request.
+ * Input:
+ * - session: session of the request
+ * - op_code: kind of request
+ * Returns the priority class.
+ */
+static char request_priority(tfs_session_t *session, char op_code) {
+    int priority = atomic_load(&session->priority);
+    if (priority != TFS_PRIORITY_DEFAULT) {
+        return (char)priority;
+    }
+
+    switch (op_code) {
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_FALLOCATE:
+    case TFS_OP_CODE_LEASE:
+    case TFS_OP_CODE_PUT:
+    case TFS_OP_CODE_GET:
+    case TFS_OP_CODE_COPY:
+        return TFS_PRIORITY_BULK;
+    default:
+        return TFS_PRIORITY_INTERACTIVE;
+    }
+}
+
+/*
+ * Sends a request to the server, through the request pipe or, with shared
+ * memory, through the request ring, preceded by its priority class.
+ * Input:
+ * - session: session of the request
+ * - packet: the request
+ * - packet_len: size of the request
+ * - payload: content to be streamed right after the packet (may be NULL)
+ * - payload_len: size of the payload
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int send_request(tfs_session_t *session, void const *packet,
+                        size_t packet_len, void const *payload,
+                        size_t payload_len) {
+    char priority = request_priority(session, *(char const *)packet);
+    shm_channel_t *channel = session->channel;
+    if (channel == NULL) {
+        /* the payload is sent straight from the caller's buffer, in the
+         * same call as the packet */
+        struct iovec iov[3] = {{&priority, sizeof(char)},
+                               {(void *)packet, packet_len},
+                               {(void *)payload, payload_len}};
+        int iovcnt = payload_len > 0 ? 3 : 2;
+        if (try_writev_all(session->pipe_out, iov, iovcnt) !=
+            (ssize_t)(sizeof(char) + packet_len + payload_len)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    /* the ring is empty while the server is idle, so the whole request can
+     * be put in it before waking the server up, as long as it fits. If it
+     * doesn't, the server must be woken up first, to make room for the rest
+     * of the payload */
+    bool fits = sizeof(char) + packet_len + payload_len <= SHM_RING_SIZE;
+    if (shm_ring_put(&channel->requests, &priority, sizeof(char)) != 0 ||
+        shm_ring_put(&channel->requests, packet, packet_len) != 0) {
+        return -1;
+    }
+    if (payload != NULL && fits &&
+        shm_ring_put(&channel->requests, payload, payload_len) != 0) {
         return -1;
     }
+    shm_ring_flush(&channel->requests);
 
-    pipe_out = open(server_pipe_path, O_WRONLY);
-    if (pipe_out < 0) {
-        unlink(pipename);
+    /* wake the server up, unless it is still serving the session */
+    if (atomic_exchange(&channel->server_idle, 0) == 1) {
+        char doorbell = 0;
+        write_pipe(session->pipe_out, &doorbell, sizeof(char));
+    }
+
+    if (payload != NULL && !fits) {
+        if (shm_ring_put(&channel->requests, payload, payload_len) != 0) {
+            return -1;
+        }
+        shm_ring_flush(&channel->requests);
+    }
+    return 0;
+}
+
+/*
+ * Receives (part of) a response from the server, through the response pipe
+ * or, with shared memory, through the response ring.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int receive_response(tfs_session_t *session, void *buffer,
+                            size_t len) {
+    if (session->channel == NULL) {
+        read_pipe(session->pipe_in, buffer, len);
+        return 0;
+    }
+
+    if (shm_ring_read(&session->channel->responses, buffer, len) != len) {
         return -1;
     }
+    return 0;
+}
 
-    /* len = opcode (char) + pipename (char * PIPE_STRING_LENGTH) */
+/* check if the whole response was received from the server. */
+#define read_response(session, buffer, size)                                   \
+    if (receive_response(session, buffer, size) != 0) {                        \
+        return -1;                                                             \
+    }
 
-    size_t packet_len = sizeof(char) + sizeof(char) * PIPE_STRING_LENGTH;
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
-        close(pipe_out);
-        unlink(pipename);
+/*
+ * Reserves an id for a new request.
+ * Input:
+ * - session: session of the request (may be NULL, if it isn't mounted)
+ * - op_code: operation code of the request
+ * - buffer: where to store the content of the reply (only for reads)
+ * - len: size of the buffer
+ * - callback: function to run once the reply is received (may be NULL)
+ * - arg: argument of the callback
+ * Returns the id of the request, or -1 if MAX_PENDING_REQUESTS requests are
+ * waiting for their results to be collected.
+ */
+static int new_request(tfs_session_t *session, char op_code, void *buffer,
+                       size_t len, tfs_callback_t callback, void *arg) {
+    if (session == NULL) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_MOUNT;
+    int request_id = -1;
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, pipename,
-              sizeof(char) * PIPE_STRING_LENGTH);
+    pthread_mutex_lock(&session->requests_lock);
+    for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+        pending_request_t *request = &session->pending_requests[i];
+        if (!request->in_use) {
+            request->in_use = true;
+            request->done = false;
+            request->op_code = op_code;
+            request->buffer = buffer;
+            request->len = len;
+            request->callback = callback;
+            request->arg = arg;
+            request_id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session->requests_lock);
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+    return request_id;
+}
 
-    pipe_in = open(client_pipe_path, O_RDONLY);
-    if (pipe_in < 0) {
-        close(pipe_out);
-        unlink(pipename);
+/*
+ * Sends a request whose id was reserved, freeing the id if it can't be sent.
+ * Input:
+ * - session: session of the request
+ * - request_id: id of the request (may be -1, if it couldn't be reserved)
+ * - packet, packet_len, payload, payload_len: same as send_request
+ * Returns request_id if successful, -1 otherwise.
+ */
+static int submit_request(tfs_session_t *session, int request_id,
+                          void const *packet, size_t packet_len,
+                          void const *payload, size_t payload_len) {
+    if (request_id == -1) {
         return -1;
     }
 
-    read_pipe(pipe_in, &session_id, sizeof(int));
+    pthread_mutex_lock(&session->send_lock);
+    int result =
+        send_request(session, packet, packet_len, payload, payload_len);
+    pthread_mutex_unlock(&session->send_lock);
 
-    if (session_id == -1) {
-        close(pipe_out);
-        close(pipe_in);
-        unlink(pipename);
+    if (result != 0) {
+        pthread_mutex_lock(&session->requests_lock);
+        session->pending_requests[request_id].in_use = false;
+        pthread_mutex_unlock(&session->requests_lock);
         return -1;
     }
+    return request_id;
+}
+
+/*
+ * Receives the content of the reply to a read, which comes in frames, each
+ * preceded by its size, until len bytes are read or a frame of size 0 (end
+ * of file) or -1 (error) arrives.
+ * Input:
+ * - session: session of the read
+ * - buffer, len: where to store the content, and its size
+ * - result: where to store the result of the read
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int receive_read_reply(tfs_session_t *session, void *buffer,
+                              size_t len, ssize_t *result) {
+    char *bytes = (char *)buffer;
+    size_t bytes_read = 0;
+    ssize_t frame_len;
+    do {
+        read_response(session, &frame_len, sizeof(ssize_t));
+        if (frame_len <= 0) {
+            break;
+        }
+        if ((size_t)frame_len > len - bytes_read) {
+            return -1;
+        }
+        read_response(session, bytes + bytes_read,
+                      sizeof(char) * (size_t)frame_len);
+        bytes_read += (size_t)frame_len;
+    } while (bytes_read < len);
 
+    /* like read, only fail if nothing was read */
+    if (bytes_read == 0) {
+        *result = frame_len;
+    } else {
+        *result = (ssize_t)bytes_read;
+    }
     return 0;
 }
 
-int tfs_unmount() {
-    /* len = opcode (char) + session_id (int) */
+/*
+ * Finds the read cache of a handle. The caller must hold caches_lock.
+ * Returns the cache, or NULL if the reads of the handle aren't cached.
+ */
+static read_cache_t *find_read_cache(tfs_session_t *session, int fhandle) {
+    for (int i = 0; i < MAX_READ_CACHES; i++) {
+        read_cache_t *read_cache = &session->read_caches[i];
+        if (read_cache->in_use && read_cache->fhandle == fhandle) {
+            return read_cache;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Empties a read cache, which can't be used anymore. The caller must hold
+ * caches_lock.
+ */
+static void invalidate_read_cache(read_cache_t *read_cache) {
+    read_cache->valid = false;
+    free(read_cache->data);
+    read_cache->data = NULL;
+    read_cache->size = 0;
+}
+
+/* callback of the requests whose replies aren't needed */
+static void ignore_reply(int request_id, ssize_t result, void *arg) {
+    (void)request_id;
+    (void)result;
+    (void)arg;
+}
+
+/*
+ * Gives a lease back to the server, without waiting for the reply (so that
+ * it can be done by the thread receiving replies).
+ * Input:
+ * - session: session holding the lease
+ * - lease_id: id of the lease
+ */
+static void release_lease(tfs_session_t *session, int lease_id) {
+    /* len = opcode (char) + request_id (int) + lease_id (int) */
 
-    size_t packet_len = sizeof(char) + sizeof(int);
-    ensure_packet_len_limit(packet_len);
+    char packet[sizeof(char) + 2 * sizeof(int)];
     size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
-        return -1;
+    char op_code = TFS_OP_CODE_RELEASE_LEASE;
+    int request_id =
+        new_request(session, op_code, NULL, 0, ignore_reply, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &lease_id, sizeof(int));
+
+    /* if it can't be sent, the server waits for the lease to expire */
+    submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+}
+
+/*
+ * Receives the rest of a recall from the server, which comes in place of a
+ * reply, and stops using the lease (or the lease being requested for the
+ * same handle, which the recall may have overtaken).
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int receive_recall(tfs_session_t *session) {
+    int fhandle;
+    int lease_id;
+    read_response(session, &fhandle, sizeof(int));
+    read_response(session, &lease_id, sizeof(int));
+
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache_t *read_cache = find_read_cache(session, fhandle);
+    if (read_cache != NULL) {
+        if (read_cache->lease_request_id != -1) {
+            read_cache->recalled = true;
+        } else if (read_cache->valid && read_cache->lease_id == lease_id) {
+            invalidate_read_cache(read_cache);
+        }
     }
+    pthread_mutex_unlock(&session->caches_lock);
 
-    char op_code = TFS_OP_CODE_UNMOUNT;
+    /* the server is waiting for it */
+    release_lease(session, lease_id);
+    return 0;
+}
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
+/*
+ * Receives the reply to a lease request: the id of the lease (or -1, if it
+ * wasn't granted) and the offset of the handle, followed by the contents of
+ * the file, which are cached unless the lease was recalled meanwhile.
+ * Input:
+ * - session: session of the request
+ * - request_id: id of the request
+ * - read_cache: cache the lease was requested for
+ * - result: where to store 0 if the contents were cached, -1 otherwise
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int receive_lease_reply(tfs_session_t *session, int request_id,
+                               read_cache_t *read_cache, ssize_t *result) {
+    int lease_id;
+    off_t offset;
+    read_response(session, &lease_id, sizeof(int));
+    read_response(session, &offset, sizeof(off_t));
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+    char *data = NULL;
+    size_t size = 0;
+    if (lease_id != -1) {
+        ssize_t frame_len;
+        while (true) {
+            read_response(session, &frame_len, sizeof(ssize_t));
+            if (frame_len <= 0) {
+                break;
+            }
+            char *new_data = (char *)realloc(data, size + (size_t)frame_len);
+            if (new_data == NULL) {
+                free(data);
+                return -1;
+            }
+            data = new_data;
+            if (receive_response(session, data + size, (size_t)frame_len) !=
+                0) {
+                free(data);
+                return -1;
+            }
+            size += (size_t)frame_len;
+        }
+        if (frame_len < 0) {
+            release_lease(session, lease_id);
+            lease_id = -1;
+        }
+    }
 
-    int return_value;
-    read_pipe(pipe_in, &return_value, sizeof(int));
+    *result = -1;
+    pthread_mutex_lock(&session->caches_lock);
+    if (read_cache->in_use && read_cache->lease_request_id == request_id) {
+        if (lease_id != -1 && !read_cache->recalled) {
+            invalidate_read_cache(read_cache);
+            read_cache->valid = true;
+            read_cache->lease_id = lease_id;
+            read_cache->data = data;
+            read_cache->size = size;
+            read_cache->offset = (size_t)offset;
+            read_cache->offset_changed = false;
+            /* counted from before the request was sent, so that it expires
+             * here before it does in the server */
+            read_cache->expires = read_cache->requested_at;
+            read_cache->expires.tv_sec += LEASE_DURATION_MS / 1000;
+            read_cache->expires.tv_nsec +=
+                (LEASE_DURATION_MS % 1000) * 1000000;
+            if (read_cache->expires.tv_nsec >= 1000000000) {
+                read_cache->expires.tv_sec++;
+                read_cache->expires.tv_nsec -= 1000000000;
+            }
+            data = NULL;
+            *result = 0;
+        }
+        read_cache->lease_request_id = -1;
+    }
+    pthread_mutex_unlock(&session->caches_lock);
+    free(data);
 
-    if (close(pipe_out) < 0)
-        return -1;
-    if (close(pipe_in) < 0)
+    return 0;
+}
+
+/*
+ * Receives the next reply from the server, whichever request it belongs to,
+ * and stores its result in the request. If the request has a callback, it is
+ * freed instead, as the callback collects the result. Only one thread may be
+ * receiving replies at a time.
+ * Input:
+ * - session: session to receive the reply from
+ * - completed: where to copy the request to, once its reply is received (as
+ *   the request may be collected, and its id reused, right after that)
+ * Returns the id of the request, or -1 in case of error.
+ */
+static int receive_reply(tfs_session_t *session,
+                         pending_request_t *completed) {
+    int request_id;
+    read_response(session, &request_id, sizeof(int));
+    /* recalls come in between replies */
+    while (request_id == LEASE_RECALL_REQUEST_ID) {
+        if (receive_recall(session) != 0) {
+            return -1;
+        }
+        read_response(session, &request_id, sizeof(int));
+    }
+    if (request_id < 0 || request_id >= MAX_PENDING_REQUESTS) {
         return -1;
+    }
 
-    if (unlink(pipename) < 0)
+    /* the request can't be freed until it is done */
+    pthread_mutex_lock(&session->requests_lock);
+    pending_request_t *request = &session->pending_requests[request_id];
+    bool expected = request->in_use && !request->done;
+    char op_code = request->op_code;
+    void *buffer = request->buffer;
+    size_t len = request->len;
+    pthread_mutex_unlock(&session->requests_lock);
+    if (!expected) {
         return -1;
+    }
+
+    ssize_t result;
+    switch (op_code) {
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_GET:
+        if (receive_read_reply(session, buffer, len, &result) != 0) {
+            return -1;
+        }
+        break;
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_PUT:
+        read_response(session, &result, sizeof(ssize_t));
+        break;
+    case TFS_OP_CODE_LEASE:
+        if (receive_lease_reply(session, request_id, (read_cache_t *)buffer,
+                                &result) != 0) {
+            return -1;
+        }
+        break;
+    case TFS_OP_CODE_LSEEK: {
+        off_t offset;
+        read_response(session, &offset, sizeof(off_t));
+        result = (ssize_t)offset;
+        break;
+    }
+    default: {
+        int int_result;
+        read_response(session, &int_result, sizeof(int));
+        result = int_result;
+        break;
+    }
+    }
 
-    session_id = -1;
+    pthread_mutex_lock(&session->requests_lock);
+    request->result = result;
+    request->done = true;
+    *completed = *request;
+    if (request->callback != NULL) {
+        request->in_use = false;
+    }
+    pthread_cond_broadcast(&session->requests_done);
+    pthread_mutex_unlock(&session->requests_lock);
 
-    return return_value;
+    return request_id;
 }
 
-int tfs_open(char const *name, int flags) {
-    /* len = opcode (char) + session_id (int) + name (char[40]) + flags (int) */
+/*
+ * The completion thread main function, it receives replies (running the
+ * callbacks of the requests that have one) until the session is unmounted.
+ * Input:
+ * - args: the session
+ */
+static void *completion_worker(void *args) {
+    tfs_session_t *session = (tfs_session_t *)args;
+    while (true) {
+        pending_request_t completed;
+        int request_id = receive_reply(session, &completed);
+        if (request_id == -1) {
+            break;
+        }
 
-    size_t packet_len =
-        sizeof(char) + 2 * sizeof(int) + sizeof(char) * PIPE_STRING_LENGTH;
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
+        if (completed.callback != NULL) {
+            completed.callback(request_id, completed.result, completed.arg);
+        }
+        if (completed.op_code == TFS_OP_CODE_UNMOUNT) {
+            break;
+        }
+    }
+
+    /* whoever is waiting for a reply has to receive it now */
+    pthread_mutex_lock(&session->requests_lock);
+    session->receiving = false;
+    pthread_cond_broadcast(&session->requests_done);
+    pthread_mutex_unlock(&session->requests_lock);
+
+    return NULL;
+}
+
+/*
+ * Starts the completion thread of a session, unless it is already running.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int start_completion_thread(tfs_session_t *session) {
+    if (session == NULL) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_OPEN;
-    char file_name[PIPE_STRING_LENGTH + 1] = {0};
-    strncpy(file_name, name, PIPE_STRING_LENGTH);
+    pthread_mutex_lock(&session->requests_lock);
+    int result = 0;
+    if (!session->completion_thread_started) {
+        /* take over from the thread that is receiving replies, if any */
+        while (session->receiving) {
+            pthread_cond_wait(&session->requests_done,
+                              &session->requests_lock);
+        }
+        session->receiving = true;
+        if (pthread_create(&session->completion_thread, NULL,
+                           completion_worker, session) != 0) {
+            session->receiving = false;
+            pthread_cond_broadcast(&session->requests_done);
+            result = -1;
+        } else {
+            session->completion_thread_started = true;
+        }
+    }
+    pthread_mutex_unlock(&session->requests_lock);
+    return result;
+}
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
-    packetcpy(packet, &packet_offset, file_name,
-              sizeof(char) * PIPE_STRING_LENGTH);
-    packetcpy(packet, &packet_offset, &flags, sizeof(int));
+ssize_t tfs_session_collect(tfs_session_t *session, int request_id) {
+    if (session == NULL || request_id < 0 ||
+        request_id >= MAX_PENDING_REQUESTS) {
+        return -1;
+    }
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+    pthread_mutex_lock(&session->requests_lock);
+    pending_request_t *request = &session->pending_requests[request_id];
+    if (!request->in_use || request->callback != NULL) {
+        pthread_mutex_unlock(&session->requests_lock);
+        return -1;
+    }
 
-    int return_value;
-    read_pipe(pipe_in, &return_value, sizeof(int));
+    /* replies to other requests may come first, and other threads may be
+     * receiving them (including ours) */
+    while (!request->done) {
+        if (session->receiving) {
+            pthread_cond_wait(&session->requests_done,
+                              &session->requests_lock);
+            continue;
+        }
 
-    return return_value;
-}
+        session->receiving = true;
+        pthread_mutex_unlock(&session->requests_lock);
+        pending_request_t completed;
+        int received = receive_reply(session, &completed);
+        pthread_mutex_lock(&session->requests_lock);
+        session->receiving = false;
+        pthread_cond_broadcast(&session->requests_done);
 
-int tfs_close(int fhandle) {
-    /* len = opcode (char) + session_id (int) + fhandle (int) */
+        if (received == -1) {
+            request->in_use = false;
+            pthread_mutex_unlock(&session->requests_lock);
+            return -1;
+        }
+    }
 
-    size_t packet_len = sizeof(char) + 2 * sizeof(int);
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
+    ssize_t result = request->result;
+    request->in_use = false;
+    pthread_mutex_unlock(&session->requests_lock);
+
+    return result;
+}
+
+int tfs_session_poll(tfs_session_t *session, int request_id) {
+    if (session == NULL || request_id < 0 ||
+        request_id >= MAX_PENDING_REQUESTS) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_CLOSE;
+    pthread_mutex_lock(&session->requests_lock);
+    pending_request_t *request = &session->pending_requests[request_id];
+    int result = -1;
+    if (request->in_use && request->callback == NULL) {
+        result = request->done ? 1 : 0;
+    }
+    pthread_mutex_unlock(&session->requests_lock);
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
-    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    return result;
+}
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+/*
+ * Finds the write buffer of a handle. The caller must hold buffers_lock.
+ * Returns the buffer, or NULL if the writes to the handle aren't buffered.
+ */
+static write_buffer_t *find_write_buffer(tfs_session_t *session,
+                                         int fhandle) {
+    for (int i = 0; i < MAX_WRITE_BUFFERS; i++) {
+        write_buffer_t *write_buffer = &session->write_buffers[i];
+        if (write_buffer->in_use && write_buffer->fhandle == fhandle) {
+            return write_buffer;
+        }
+    }
+    return NULL;
+}
 
-    int return_value;
-    read_pipe(pipe_in, &return_value, sizeof(int));
+/*
+ * Sends the buffered writes of a handle to the server, as a single write,
+ * emptying the buffer. The caller must hold buffers_lock.
+ * Returns 0 if every buffered byte was written, -1 otherwise.
+ */
+static int flush_write_buffer(tfs_session_t *session,
+                              write_buffer_t *write_buffer) {
+    if (write_buffer->len == 0) {
+        return 0;
+    }
 
-    return return_value;
+    size_t len = write_buffer->len;
+    /* the writes were already reported as done, so they are dropped even if
+     * they fail, rather than being sent again later */
+    write_buffer->len = 0;
+    ssize_t written = tfs_session_collect(
+        session, tfs_session_submit_write(session, write_buffer->fhandle,
+                                          write_buffer->data, len));
+    return written == (ssize_t)len ? 0 : -1;
 }
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
-    /* len = opcode (char) + session_id (int) + fhandle (int) + len (size_t) +
-     * content (char[len]) */
+/*
+ * Flushes the buffer of a handle and stops buffering its writes. The caller
+ * must hold buffers_lock.
+ * Returns the result of flush_write_buffer.
+ */
+static int release_write_buffer(tfs_session_t *session,
+                                write_buffer_t *write_buffer) {
+    int result = flush_write_buffer(session, write_buffer);
+    free(write_buffer->data);
+    write_buffer->data = NULL;
+    write_buffer->in_use = false;
+    return result;
+}
 
-    size_t packet_len =
-        sizeof(char) + 2 * sizeof(int) + sizeof(size_t) + sizeof(char) * len;
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
+/*
+ * Flushes the buffer of a handle, if its writes are buffered.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int flush_handle(tfs_session_t *session, int fhandle) {
+    if (session == NULL) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_WRITE;
+    int result = 0;
+    pthread_mutex_lock(&session->buffers_lock);
+    write_buffer_t *write_buffer = find_write_buffer(session, fhandle);
+    if (write_buffer != NULL) {
+        result = flush_write_buffer(session, write_buffer);
+    }
+    pthread_mutex_unlock(&session->buffers_lock);
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
-    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
-    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
-    packetcpy(packet, &packet_offset, buffer, sizeof(char) * len);
+    return result;
+}
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+int tfs_session_set_write_buffer(tfs_session_t *session, int fhandle,
+                                 size_t size) {
+    if (session == NULL || fhandle < 0) {
+        return -1;
+    }
 
-    int return_value;
+    pthread_mutex_lock(&session->buffers_lock);
+    write_buffer_t *write_buffer = find_write_buffer(session, fhandle);
+    int result = 0;
+    if (write_buffer != NULL) {
+        /* what was buffered is sent with the old size */
+        if (size == 0) {
+            result = release_write_buffer(session, write_buffer);
+        } else {
+            result = flush_write_buffer(session, write_buffer);
+            char *data = (char *)realloc(write_buffer->data, size);
+            if (data == NULL) {
+                result = -1;
+            } else {
+                write_buffer->data = data;
+                write_buffer->size = size;
+            }
+        }
+    } else if (size > 0) {
+        result = -1;
+        for (int i = 0; i < MAX_WRITE_BUFFERS; i++) {
+            write_buffer = &session->write_buffers[i];
+            if (!write_buffer->in_use) {
+                write_buffer->data = (char *)malloc(size);
+                if (write_buffer->data != NULL) {
+                    write_buffer->in_use = true;
+                    write_buffer->fhandle = fhandle;
+                    write_buffer->len = 0;
+                    write_buffer->size = size;
+                    result = 0;
+                }
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&session->buffers_lock);
 
-    read_pipe(pipe_in, &return_value, sizeof(int));
+    return result;
+}
 
-    return return_value;
+int tfs_session_flush(tfs_session_t *session, int fhandle) {
+    return flush_handle(session, fhandle);
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    /* len = opcode (char) + session_id (int) + fhandle (int) + len (size_t) */
+/*
+ * Checks if the contents of a read cache can be used, emptying it if its
+ * lease expired. The caller must hold caches_lock.
+ * Returns true if they can.
+ */
+static bool read_cache_usable(read_cache_t *read_cache) {
+    if (!read_cache->valid) {
+        return false;
+    }
 
-    size_t packet_len = sizeof(char) + 2 * sizeof(int) + sizeof(size_t);
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > read_cache->expires.tv_sec ||
+        (now.tv_sec == read_cache->expires.tv_sec &&
+         now.tv_nsec >= read_cache->expires.tv_nsec)) {
+        /* the server drops it on its own */
+        invalidate_read_cache(read_cache);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Reads from the cache of a handle, if it can be used. The caller must hold
+ * caches_lock.
+ * Returns true if the read was done, storing its result.
+ */
+static bool read_cached(read_cache_t *read_cache, void *buffer, size_t len,
+                        ssize_t *result) {
+    if (!read_cache_usable(read_cache)) {
+        return false;
+    }
+
+    size_t to_read = 0;
+    if (read_cache->offset < read_cache->size) {
+        to_read = read_cache->size - read_cache->offset;
+    }
+    if (to_read > len) {
+        to_read = len;
+    }
+    memcpy(buffer, read_cache->data + read_cache->offset, to_read);
+    read_cache->offset += to_read;
+    read_cache->offset_changed = true;
+    *result = (ssize_t)to_read;
+    return true;
+}
+
+/*
+ * Stops using the cache of a handle (until its next read), giving the lease
+ * and the offset of the handle back to the server, so that something else
+ * can be done with the handle.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int leave_read_cache(tfs_session_t *session, int fhandle) {
+    if (session == NULL) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_READ;
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache_t *read_cache = find_read_cache(session, fhandle);
+    if (read_cache == NULL) {
+        pthread_mutex_unlock(&session->caches_lock);
+        return 0;
+    }
+    int lease_id = -1;
+    if (read_cache->valid) {
+        lease_id = read_cache->lease_id;
+        invalidate_read_cache(read_cache);
+    }
+    bool offset_changed = read_cache->offset_changed;
+    off_t offset = (off_t)read_cache->offset;
+    read_cache->offset_changed = false;
+    pthread_mutex_unlock(&session->caches_lock);
+
+    if (lease_id != -1) {
+        release_lease(session, lease_id);
+    }
+    if (offset_changed &&
+        tfs_session_collect(session,
+                            tfs_session_submit_lseek(session, fhandle, offset,
+                                                     SEEK_SET)) != offset) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads from the cache of a handle, leasing the file (and caching all of
+ * it) first if needed.
+ * Input:
+ * - session, fhandle, buffer, len: same as tfs_session_read
+ * - result: where to store the result of the read
+ * Returns true if the read was done, false if it has to be sent to the
+ * server (because the reads of the handle aren't cached, or the lease wasn't
+ * granted).
+ */
+static bool read_from_cache(tfs_session_t *session, int fhandle, void *buffer,
+                            size_t len, ssize_t *result) {
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache_t *read_cache = find_read_cache(session, fhandle);
+    bool done = read_cache == NULL ||
+                read_cached(read_cache, buffer, len, result);
+    pthread_mutex_unlock(&session->caches_lock);
+    if (done) {
+        return read_cache != NULL;
+    }
+
+    /* the file is leased with the offset the server has */
+    if (leave_read_cache(session, fhandle) != 0) {
+        *result = -1;
+        return true;
+    }
+
+    /* len = opcode (char) + request_id (int) + fhandle (int) */
+
+    char packet[sizeof(char) + 2 * sizeof(int)];
+    size_t packet_offset = 0;
+    char op_code = TFS_OP_CODE_LEASE;
+
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache = find_read_cache(session, fhandle);
+    if (read_cache == NULL) {
+        pthread_mutex_unlock(&session->caches_lock);
+        return false;
+    }
+    int request_id = new_request(session, op_code, read_cache, 0, NULL, NULL);
+    read_cache->lease_request_id = request_id;
+    read_cache->recalled = false;
+    clock_gettime(CLOCK_MONOTONIC, &read_cache->requested_at);
+    pthread_mutex_unlock(&session->caches_lock);
 
     packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
     packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
-    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+    tfs_session_collect(session, request_id);
 
-    int bytes_read;
-    read_pipe(pipe_in, &bytes_read, sizeof(int));
-    if (bytes_read > 0) {
-        read_pipe(pipe_in, buffer, sizeof(char) * (size_t)bytes_read);
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache = find_read_cache(session, fhandle);
+    done = false;
+    if (read_cache != NULL) {
+        /* in case the request couldn't be sent */
+        read_cache->lease_request_id = -1;
+        done = read_cached(read_cache, buffer, len, result);
     }
+    pthread_mutex_unlock(&session->caches_lock);
 
-    return (ssize_t)bytes_read;
+    return done;
 }
 
-int tfs_shutdown_after_all_closed() {
-    /* len = opcode (char) + session_id (int) */
+/*
+ * Seeks within the cache of a handle, if it can be used and the new offset
+ * is within the cached contents.
+ * Input:
+ * - session, fhandle, offset, whence: same as tfs_session_lseek
+ * - result: where to store the new offset
+ * Returns true if the seek was done.
+ */
+static bool seek_in_cache(tfs_session_t *session, int fhandle, off_t offset,
+                          int whence, off_t *result) {
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache_t *read_cache = find_read_cache(session, fhandle);
+    bool done = false;
+    if (read_cache != NULL && read_cache_usable(read_cache)) {
+        off_t base = -1;
+        switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = (off_t)read_cache->offset;
+            break;
+        case SEEK_END:
+            base = (off_t)read_cache->size;
+            break;
+        default:
+            break;
+        }
+        /* anything else is left for the server to check */
+        if (base != -1 && offset >= -base &&
+            base + offset <= (off_t)read_cache->size) {
+            read_cache->offset = (size_t)(base + offset);
+            read_cache->offset_changed = true;
+            *result = base + offset;
+            done = true;
+        }
+    }
+    pthread_mutex_unlock(&session->caches_lock);
 
-    size_t packet_len = sizeof(char) + sizeof(int);
-    ensure_packet_len_limit(packet_len);
-    size_t packet_offset = 0;
-    int8_t *packet = (int8_t *)malloc(packet_len);
-    if (packet == NULL) {
+    return done;
+}
+
+int tfs_session_set_read_cache(tfs_session_t *session, int fhandle,
+                               int enabled) {
+    if (session == NULL || fhandle < 0) {
         return -1;
     }
 
-    char op_code = TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED;
+    if (!enabled) {
+        int result = leave_read_cache(session, fhandle);
+        pthread_mutex_lock(&session->caches_lock);
+        read_cache_t *read_cache = find_read_cache(session, fhandle);
+        if (read_cache != NULL) {
+            read_cache->in_use = false;
+        }
+        pthread_mutex_unlock(&session->caches_lock);
+        return result;
+    }
 
-    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
-    packetcpy(packet, &packet_offset, &session_id, sizeof(int));
+    /* recalls must be handled as soon as they arrive */
+    if (start_completion_thread(session) != 0) {
+        return -1;
+    }
 
-    write_pipe(pipe_out, packet, packet_len);
-    free(packet);
+    int result = -1;
+    pthread_mutex_lock(&session->caches_lock);
+    if (find_read_cache(session, fhandle) != NULL) {
+        result = 0;
+    }
+    for (int i = 0; i < MAX_READ_CACHES && result == -1; i++) {
+        read_cache_t *read_cache = &session->read_caches[i];
+        if (!read_cache->in_use) {
+            memset(read_cache, 0, sizeof(read_cache_t));
+            read_cache->in_use = true;
+            read_cache->fhandle = fhandle;
+            read_cache->lease_request_id = -1;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&session->caches_lock);
 
-    int return_value;
-    read_pipe(pipe_in, &return_value, sizeof(int));
+    return result;
+}
 
-    return return_value;
+/*
+ * Establishes a session with a server listening on a Unix domain socket,
+ * through which all the requests and replies of the session then go.
+ * Input:
+ * - session: session to be mounted
+ * - server_socket_path: pathname of the server's socket
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int socket_mount(tfs_session_t *session,
+                        char const *server_socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(server_socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, server_socket_path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        return -1;
+    }
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(connection);
+        return -1;
+    }
+
+    /* the server creates the session as soon as it accepts the connection */
+    if (try_read_all(connection, &session->session_id, sizeof(int)) !=
+            sizeof(int) ||
+        session->session_id == -1) {
+        close(connection);
+        return -1;
+    }
+
+    session->pipe_in = connection;
+    session->pipe_out = connection;
+    /* there are no named pipes to delete when unmounting */
+    session->pipename[0] = '\0';
+
+    return 0;
+}
+
+/*
+ * Establishes a session with a server listening on a named pipe.
+ * Input:
+ * - session: session to be mounted
+ * - client_pipe_path, server_pipe_path: same as tfs_mount
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int pipe_mount(tfs_session_t *session, char const *client_pipe_path,
+                      char const *server_pipe_path) {
+    char *pipename = session->pipename;
+    char *request_pipename = session->request_pipename;
+
+    strncpy(pipename, client_pipe_path, PIPE_STRING_LENGTH);
+    if (strlen(pipename) + strlen(REQUEST_PIPE_SUFFIX) > PIPE_STRING_LENGTH) {
+        return -1;
+    }
+    strcpy(request_pipename, pipename);
+    strcat(request_pipename, REQUEST_PIPE_SUFFIX);
+    unlink(pipename);
+    unlink(request_pipename);
+
+    if (mkfifo(pipename, 0777) < 0) {
+        return -1;
+    }
+    if (mkfifo(request_pipename, 0777) < 0) {
+        unlink(pipename);
+        return -1;
+    }
+
+    int server_pipe = open(server_pipe_path, O_WRONLY);
+    if (server_pipe < 0) {
+        unlink(pipename);
+        unlink(request_pipename);
+        return -1;
+    }
+
+    /* len = opcode (char) + pipename (char * PIPE_STRING_LENGTH) +
+     * request_pipename (char * PIPE_STRING_LENGTH) */
+
+    char packet[sizeof(char) + 2 * sizeof(char) * PIPE_STRING_LENGTH];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_MOUNT;
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, pipename,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, request_pipename,
+              sizeof(char) * PIPE_STRING_LENGTH);
+
+    if (try_write_all(server_pipe, packet, sizeof(packet)) != sizeof(packet)) {
+        close(server_pipe);
+        unlink(pipename);
+        unlink(request_pipename);
+        return -1;
+    }
+
+    /* same order as the server, which opens the response pipe first */
+    session->pipe_in = open(pipename, O_RDONLY);
+    if (session->pipe_in < 0) {
+        close(server_pipe);
+        unlink(pipename);
+        unlink(request_pipename);
+        return -1;
+    }
+    session->pipe_out = open(request_pipename, O_WRONLY);
+    if (session->pipe_out < 0) {
+        close(server_pipe);
+        close(session->pipe_in);
+        unlink(pipename);
+        unlink(request_pipename);
+        return -1;
+    }
+
+    if (try_read_all(session->pipe_in, &session->session_id, sizeof(int)) !=
+        sizeof(int)) {
+        session->session_id = -1;
+    }
+
+    /* the server pipe is only used to mount, but it must be kept open until
+     * the server has read our request: the server waits for a writer to open
+     * its pipe before reading from it again */
+    close(server_pipe);
+
+    if (session->session_id == -1) {
+        close(session->pipe_out);
+        close(session->pipe_in);
+        unlink(pipename);
+        unlink(request_pipename);
+        return -1;
+    }
+
+    return 0;
+}
+
+tfs_session_t *tfs_session_mount(char const *client_pipe_path,
+                                 char const *server_pipe_path) {
+    tfs_session_t *session = new_session();
+    if (session == NULL) {
+        return NULL;
+    }
+
+    int result;
+    struct stat server_stat;
+    if (stat(server_pipe_path, &server_stat) == 0 &&
+        S_ISSOCK(server_stat.st_mode)) {
+        result = socket_mount(session, server_pipe_path);
+    } else {
+        result = pipe_mount(session, client_pipe_path, server_pipe_path);
+    }
+
+    if (result != 0) {
+        free_session(session);
+        return NULL;
+    }
+    return session;
+}
+
+tfs_session_t *tfs_session_mount_shared_memory(char const *client_pipe_path,
+                                               char const *server_pipe_path) {
+    tfs_session_t *session =
+        tfs_session_mount(client_pipe_path, server_pipe_path);
+    if (session == NULL) {
+        return NULL;
+    }
+
+    char shm_name[PIPE_STRING_LENGTH + 1] = {0};
+    snprintf(shm_name, sizeof(shm_name), "/tfs_shm_%d_%d", (int)getpid(),
+             atomic_fetch_add(&shm_count, 1));
+    shm_unlink(shm_name);
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        tfs_session_unmount(session);
+        return NULL;
+    }
+    /* a new shared memory object is filled with zeros, which is the initial
+     * state of the rings */
+    shm_channel_t *new_channel = MAP_FAILED;
+    if (ftruncate(fd, (off_t)sizeof(shm_channel_t)) == 0) {
+        new_channel = (shm_channel_t *)mmap(NULL, sizeof(shm_channel_t),
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    ssize_t return_value = -1;
+    if (new_channel != MAP_FAILED) {
+        /* len = opcode (char) + request_id (int) + shm_name (char *
+         * PIPE_STRING_LENGTH) */
+
+        char packet[sizeof(char) + sizeof(int) +
+                    sizeof(char) * PIPE_STRING_LENGTH];
+        size_t packet_offset = 0;
+        char op_code = TFS_OP_CODE_ATTACH_SHARED_MEMORY;
+        int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+        packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+        packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+        packetcpy(packet, &packet_offset, shm_name,
+                  sizeof(char) * PIPE_STRING_LENGTH);
+
+        return_value = tfs_session_collect(
+            session, submit_request(session, request_id, packet,
+                                    sizeof(packet), NULL, 0));
+    }
+
+    /* the server already mapped it (or failed to), the name isn't needed */
+    shm_unlink(shm_name);
+
+    if (return_value != 0) {
+        if (new_channel != MAP_FAILED) {
+            munmap(new_channel, sizeof(shm_channel_t));
+        }
+        tfs_session_unmount(session);
+        return NULL;
+    }
+
+    session->channel = new_channel;
+    return session;
+}
+
+tfs_session_t *tfs_session_mount_limited(char const *client_pipe_path,
+                                         char const *server_pipe_path,
+                                         long iops, long bandwidth) {
+    tfs_session_t *session =
+        tfs_session_mount(client_pipe_path, server_pipe_path);
+    if (session == NULL) {
+        return NULL;
+    }
+
+    /* len = opcode (char) + request_id (int) + iops (long) + bandwidth
+     * (long) */
+
+    char packet[sizeof(char) + sizeof(int) + 2 * sizeof(long)];
+    size_t packet_offset = 0;
+    char op_code = TFS_OP_CODE_SET_LIMITS;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &iops, sizeof(long));
+    packetcpy(packet, &packet_offset, &bandwidth, sizeof(long));
+
+    if (tfs_session_collect(session,
+                            submit_request(session, request_id, packet,
+                                           sizeof(packet), NULL, 0)) != 0) {
+        tfs_session_unmount(session);
+        return NULL;
+    }
+    return session;
+}
+
+int tfs_session_unmount(tfs_session_t *session) {
+    if (session == NULL) {
+        return -1;
+    }
+
+    /* the buffered writes must reach the server before the session ends */
+    int flush_result = 0;
+    pthread_mutex_lock(&session->buffers_lock);
+    for (int i = 0; i < MAX_WRITE_BUFFERS; i++) {
+        write_buffer_t *write_buffer = &session->write_buffers[i];
+        if (write_buffer->in_use &&
+            release_write_buffer(session, write_buffer) != 0) {
+            flush_result = -1;
+        }
+    }
+    pthread_mutex_unlock(&session->buffers_lock);
+
+    /* len = opcode (char) + request_id (int) */
+
+    char packet[sizeof(char) + sizeof(int)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_UNMOUNT;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    /* the server replies to every other request before this one, and the
+     * completion thread stops after receiving it (or after failing to) */
+    int return_value = (int)tfs_session_collect(session, request_id);
+    if (flush_result != 0) {
+        return_value = -1;
+    }
+    if (session->completion_thread_started) {
+        pthread_join(session->completion_thread, NULL);
+    }
+
+    /* the session is released even if the server didn't reply, as it can't
+     * be used anymore; results that weren't collected are lost */
+    if (session->channel != NULL) {
+        munmap(session->channel, sizeof(shm_channel_t));
+    }
+
+    if (close(session->pipe_out) < 0) {
+        return_value = -1;
+    }
+    if (session->pipe_in != session->pipe_out && close(session->pipe_in) < 0) {
+        return_value = -1;
+    }
+
+    if (session->pipename[0] != '\0') {
+        if (unlink(session->pipename) < 0) {
+            return_value = -1;
+        }
+        if (unlink(session->request_pipename) < 0) {
+            return_value = -1;
+        }
+    }
+
+    free_session(session);
+
+    return return_value;
+}
+
+/*
+ * Sends a tfs_open request.
+ * Input:
+ * - session: session of the request
+ * - name, flags: same as tfs_open
+ * - callback, arg: same as new_request
+ * Returns the id of the request, or -1 in case of error.
+ */
+static int submit_open(tfs_session_t *session, char const *name, int flags,
+                       tfs_callback_t callback, void *arg) {
+    /* len = opcode (char) + request_id (int) + name (char[40]) + flags (int)
+     */
+
+    char packet[sizeof(char) + 2 * sizeof(int) +
+                sizeof(char) * PIPE_STRING_LENGTH];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_OPEN;
+    int request_id = new_request(session, op_code, NULL, 0, callback, arg);
+    char file_name[PIPE_STRING_LENGTH + 1] = {0};
+    strncpy(file_name, name, PIPE_STRING_LENGTH);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, file_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, &flags, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_submit_open(tfs_session_t *session, char const *name,
+                            int flags) {
+    return submit_open(session, name, flags, NULL, NULL);
+}
+
+int tfs_session_open_async(tfs_session_t *session, char const *name, int flags,
+                           tfs_callback_t callback, void *arg) {
+    if (start_completion_thread(session) != 0) {
+        return -1;
+    }
+    return submit_open(session, name, flags, callback, arg);
+}
+
+int tfs_session_open(tfs_session_t *session, char const *name, int flags) {
+    return (int)tfs_session_collect(
+        session, tfs_session_submit_open(session, name, flags));
+}
+
+int tfs_session_submit_close(tfs_session_t *session, int fhandle) {
+    /* len = opcode (char) + request_id (int) + fhandle (int) */
+
+    char packet[sizeof(char) + 2 * sizeof(int)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_CLOSE;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_close(tfs_session_t *session, int fhandle) {
+    if (session == NULL) {
+        return -1;
+    }
+
+    /* the handle is closed even if its buffered writes fail */
+    int flush_result = 0;
+    pthread_mutex_lock(&session->buffers_lock);
+    write_buffer_t *write_buffer = find_write_buffer(session, fhandle);
+    if (write_buffer != NULL) {
+        flush_result = release_write_buffer(session, write_buffer);
+    }
+    pthread_mutex_unlock(&session->buffers_lock);
+
+    /* the server drops the lease of the handle when closing it */
+    pthread_mutex_lock(&session->caches_lock);
+    read_cache_t *read_cache = find_read_cache(session, fhandle);
+    if (read_cache != NULL) {
+        invalidate_read_cache(read_cache);
+        read_cache->in_use = false;
+    }
+    pthread_mutex_unlock(&session->caches_lock);
+
+    int result = (int)tfs_session_collect(
+        session, tfs_session_submit_close(session, fhandle));
+    if (flush_result != 0) {
+        return -1;
+    }
+    return result;
+}
+
+/*
+ * Sends a tfs_write request.
+ * Input:
+ * - session: session of the request
+ * - fhandle, buffer, len: same as tfs_write
+ * - callback, arg: same as new_request
+ * Returns the id of the request, or -1 in case of error.
+ */
+static int submit_write(tfs_session_t *session, int fhandle,
+                        void const *buffer, size_t len,
+                        tfs_callback_t callback, void *arg) {
+    if (session == NULL) {
+        return -1;
+    }
+
+    /* len = opcode (char) + request_id (int) + fhandle (int) + len (size_t)
+     * + content (char[len]) */
+
+    /* the content is sent right after the header, straight from buffer
+     * (with shared memory, it is copied into the request ring), so len has
+     * no limit */
+    char packet[sizeof(char) + 2 * sizeof(int) + sizeof(size_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_WRITE;
+    int request_id = new_request(session, op_code, NULL, 0, callback, arg);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
+
+    request_id = submit_request(session, request_id, packet, sizeof(packet),
+                                buffer, sizeof(char) * len);
+
+    return request_id;
+}
+
+int tfs_session_submit_write(tfs_session_t *session, int fhandle,
+                             void const *buffer, size_t len) {
+    return submit_write(session, fhandle, buffer, len, NULL, NULL);
+}
+
+int tfs_session_write_async(tfs_session_t *session, int fhandle,
+                            void const *buffer, size_t len,
+                            tfs_callback_t callback, void *arg) {
+    if (start_completion_thread(session) != 0) {
+        return -1;
+    }
+    return submit_write(session, fhandle, buffer, len, callback, arg);
+}
+
+ssize_t tfs_session_write(tfs_session_t *session, int fhandle,
+                          void const *buffer, size_t len) {
+    if (leave_read_cache(session, fhandle) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&session->buffers_lock);
+    write_buffer_t *write_buffer = find_write_buffer(session, fhandle);
+    if (write_buffer == NULL) {
+        pthread_mutex_unlock(&session->buffers_lock);
+        return tfs_session_collect(
+            session, tfs_session_submit_write(session, fhandle, buffer, len));
+    }
+
+    ssize_t result = (ssize_t)len;
+    if (write_buffer->len + len > write_buffer->size &&
+        flush_write_buffer(session, write_buffer) != 0) {
+        result = -1;
+    } else if (len >= write_buffer->size) {
+        /* it would be flushed right away, so there's no point copying it */
+        result = tfs_session_collect(
+            session, tfs_session_submit_write(session, fhandle, buffer, len));
+    } else {
+        memcpy(write_buffer->data + write_buffer->len, buffer, len);
+        write_buffer->len += len;
+    }
+    pthread_mutex_unlock(&session->buffers_lock);
+
+    return result;
+}
+
+/*
+ * Sends a tfs_read request.
+ * Input:
+ * - session: session of the request
+ * - fhandle, buffer, len: same as tfs_read
+ * - callback, arg: same as new_request
+ * Returns the id of the request, or -1 in case of error.
+ */
+static int submit_read(tfs_session_t *session, int fhandle, void *buffer,
+                       size_t len, tfs_callback_t callback, void *arg) {
+    /* len = opcode (char) + request_id (int) + fhandle (int) + len (size_t)
+     */
+
+    char packet[sizeof(char) + 2 * sizeof(int) + sizeof(size_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_READ;
+    int request_id =
+        new_request(session, op_code, buffer, len, callback, arg);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_submit_read(tfs_session_t *session, int fhandle, void *buffer,
+                            size_t len) {
+    return submit_read(session, fhandle, buffer, len, NULL, NULL);
+}
+
+int tfs_session_read_async(tfs_session_t *session, int fhandle, void *buffer,
+                           size_t len, tfs_callback_t callback, void *arg) {
+    if (start_completion_thread(session) != 0) {
+        return -1;
+    }
+    return submit_read(session, fhandle, buffer, len, callback, arg);
+}
+
+ssize_t tfs_session_read(tfs_session_t *session, int fhandle, void *buffer,
+                         size_t len) {
+    /* the read may need the buffered writes */
+    if (flush_handle(session, fhandle) != 0) {
+        return -1;
+    }
+    ssize_t result;
+    if (read_from_cache(session, fhandle, buffer, len, &result)) {
+        return result;
+    }
+    return tfs_session_collect(
+        session, tfs_session_submit_read(session, fhandle, buffer, len));
+}
+
+int tfs_session_submit_lseek(tfs_session_t *session, int fhandle,
+                             off_t offset, int whence) {
+    /* len = opcode (char) + request_id (int) + fhandle (int) + offset (off_t)
+     * + whence (int) */
+
+    char packet[sizeof(char) + 3 * sizeof(int) + sizeof(off_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_LSEEK;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    packetcpy(packet, &packet_offset, &offset, sizeof(off_t));
+    packetcpy(packet, &packet_offset, &whence, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+off_t tfs_session_lseek(tfs_session_t *session, int fhandle, off_t offset,
+                        int whence) {
+    /* the buffered writes go to the offset before the seek */
+    if (flush_handle(session, fhandle) != 0) {
+        return -1;
+    }
+    off_t result;
+    if (seek_in_cache(session, fhandle, offset, whence, &result)) {
+        return result;
+    }
+    if (leave_read_cache(session, fhandle) != 0) {
+        return -1;
+    }
+    return (off_t)tfs_session_collect(
+        session, tfs_session_submit_lseek(session, fhandle, offset, whence));
+}
+
+int tfs_session_submit_ftruncate(tfs_session_t *session, int fhandle,
+                                 off_t length) {
+    /* len = opcode (char) + request_id (int) + fhandle (int) + length (off_t)
+     */
+
+    char packet[sizeof(char) + 2 * sizeof(int) + sizeof(off_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_FTRUNCATE;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    packetcpy(packet, &packet_offset, &length, sizeof(off_t));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_ftruncate(tfs_session_t *session, int fhandle, off_t length) {
+    if (flush_handle(session, fhandle) != 0 ||
+        leave_read_cache(session, fhandle) != 0) {
+        return -1;
+    }
+    return (int)tfs_session_collect(
+        session, tfs_session_submit_ftruncate(session, fhandle, length));
+}
+
+int tfs_session_submit_fallocate(tfs_session_t *session, int fhandle,
+                                 off_t offset, off_t len) {
+    /* len = opcode (char) + request_id (int) + fhandle (int) + offset (off_t)
+     * + len (off_t) */
+
+    char packet[sizeof(char) + 2 * sizeof(int) + 2 * sizeof(off_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_FALLOCATE;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, &fhandle, sizeof(int));
+    packetcpy(packet, &packet_offset, &offset, sizeof(off_t));
+    packetcpy(packet, &packet_offset, &len, sizeof(off_t));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_fallocate(tfs_session_t *session, int fhandle, off_t offset,
+                          off_t len) {
+    if (flush_handle(session, fhandle) != 0 ||
+        leave_read_cache(session, fhandle) != 0) {
+        return -1;
+    }
+    return (int)tfs_session_collect(
+        session, tfs_session_submit_fallocate(session, fhandle, offset, len));
+}
+
+int tfs_session_submit_put(tfs_session_t *session, char const *name,
+                           int flags, void const *buffer, size_t len) {
+    /* len = opcode (char) + request_id (int) + name (char[40]) + flags (int)
+     * + len (size_t) + content (char[len]) */
+
+    /* the content is sent like in submit_write */
+    char packet[sizeof(char) + 2 * sizeof(int) +
+                sizeof(char) * PIPE_STRING_LENGTH + sizeof(size_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_PUT;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+    char file_name[PIPE_STRING_LENGTH + 1] = {0};
+    strncpy(file_name, name, PIPE_STRING_LENGTH);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, file_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, &flags, sizeof(int));
+    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
+
+    request_id = submit_request(session, request_id, packet, sizeof(packet),
+                                buffer, sizeof(char) * len);
+
+    return request_id;
+}
+
+ssize_t tfs_session_put(tfs_session_t *session, char const *name, int flags,
+                        void const *buffer, size_t len) {
+    return tfs_session_collect(
+        session, tfs_session_submit_put(session, name, flags, buffer, len));
+}
+
+int tfs_session_submit_get(tfs_session_t *session, char const *name,
+                           void *buffer, size_t len) {
+    /* len = opcode (char) + request_id (int) + name (char[40]) + len
+     * (size_t) */
+
+    char packet[sizeof(char) + sizeof(int) +
+                sizeof(char) * PIPE_STRING_LENGTH + sizeof(size_t)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_GET;
+    int request_id =
+        new_request(session, op_code, buffer, len, NULL, NULL);
+    char file_name[PIPE_STRING_LENGTH + 1] = {0};
+    strncpy(file_name, name, PIPE_STRING_LENGTH);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, file_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, &len, sizeof(size_t));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+ssize_t tfs_session_get(tfs_session_t *session, char const *name,
+                        void *buffer, size_t len) {
+    return tfs_session_collect(
+        session, tfs_session_submit_get(session, name, buffer, len));
+}
+
+int tfs_session_submit_copy(tfs_session_t *session, char const *source_path,
+                            char const *dest_path, int flags) {
+    /* len = opcode (char) + request_id (int) + source_path (char[40]) +
+     * dest_path (char[40]) + flags (int) */
+
+    char packet[sizeof(char) + 2 * sizeof(int) +
+                2 * sizeof(char) * PIPE_STRING_LENGTH];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_COPY;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+    char source_name[PIPE_STRING_LENGTH + 1] = {0};
+    char dest_name[PIPE_STRING_LENGTH + 1] = {0};
+    strncpy(source_name, source_path, PIPE_STRING_LENGTH);
+    strncpy(dest_name, dest_path, PIPE_STRING_LENGTH);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+    packetcpy(packet, &packet_offset, source_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, dest_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    packetcpy(packet, &packet_offset, &flags, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return request_id;
+}
+
+int tfs_session_copy(tfs_session_t *session, char const *source_path,
+                     char const *dest_path, int flags) {
+    return (int)tfs_session_collect(
+        session,
+        tfs_session_submit_copy(session, source_path, dest_path, flags));
+}
+
+int tfs_session_set_priority(tfs_session_t *session, int priority) {
+    if (session == NULL || (priority != TFS_PRIORITY_DEFAULT &&
+                            priority != TFS_PRIORITY_INTERACTIVE &&
+                            priority != TFS_PRIORITY_BULK)) {
+        return -1;
+    }
+    atomic_store(&session->priority, priority);
+    return 0;
+}
+
+int tfs_session_shutdown_after_all_closed(tfs_session_t *session) {
+    /* len = opcode (char) + request_id (int) */
+
+    char packet[sizeof(char) + sizeof(int)];
+    size_t packet_offset = 0;
+
+    char op_code = TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED;
+    int request_id = new_request(session, op_code, NULL, 0, NULL, NULL);
+
+    packetcpy(packet, &packet_offset, &op_code, sizeof(char));
+    packetcpy(packet, &packet_offset, &request_id, sizeof(int));
+
+    request_id =
+        submit_request(session, request_id, packet, sizeof(packet), NULL, 0);
+
+    return (int)tfs_session_collect(session, request_id);
+}
+
+/*
+ * The functions without a session use the one mounted by tfs_mount.
+ */
+
+int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
+    if (default_session != NULL) {
+        return -1;
+    }
+    default_session = tfs_session_mount(client_pipe_path, server_pipe_path);
+    return default_session == NULL ? -1 : 0;
+}
+
+int tfs_mount_shared_memory(char const *client_pipe_path,
+                            char const *server_pipe_path) {
+    if (default_session != NULL) {
+        return -1;
+    }
+    default_session =
+        tfs_session_mount_shared_memory(client_pipe_path, server_pipe_path);
+    return default_session == NULL ? -1 : 0;
+}
+
+int tfs_mount_limited(char const *client_pipe_path,
+                      char const *server_pipe_path, long iops,
+                      long bandwidth) {
+    if (default_session != NULL) {
+        return -1;
+    }
+    default_session = tfs_session_mount_limited(
+        client_pipe_path, server_pipe_path, iops, bandwidth);
+    return default_session == NULL ? -1 : 0;
+}
+
+int tfs_unmount() {
+    tfs_session_t *session = default_session;
+    default_session = NULL;
+    return tfs_session_unmount(session);
+}
+
+int tfs_open(char const *name, int flags) {
+    return tfs_session_open(default_session, name, flags);
+}
+
+int tfs_close(int fhandle) {
+    return tfs_session_close(default_session, fhandle);
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
+    return tfs_session_write(default_session, fhandle, buffer, len);
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    return tfs_session_read(default_session, fhandle, buffer, len);
+}
+
+off_t tfs_lseek(int fhandle, off_t offset, int whence) {
+    return tfs_session_lseek(default_session, fhandle, offset, whence);
+}
+
+int tfs_ftruncate(int fhandle, off_t length) {
+    return tfs_session_ftruncate(default_session, fhandle, length);
+}
+
+int tfs_fallocate(int fhandle, off_t offset, off_t len) {
+    return tfs_session_fallocate(default_session, fhandle, offset, len);
+}
+
+int tfs_set_write_buffer(int fhandle, size_t size) {
+    return tfs_session_set_write_buffer(default_session, fhandle, size);
+}
+
+int tfs_flush(int fhandle) {
+    return tfs_session_flush(default_session, fhandle);
+}
+
+int tfs_set_read_cache(int fhandle, int enabled) {
+    return tfs_session_set_read_cache(default_session, fhandle, enabled);
+}
+
+ssize_t tfs_put(char const *name, int flags, void const *buffer,
+                size_t len) {
+    return tfs_session_put(default_session, name, flags, buffer, len);
+}
+
+ssize_t tfs_get(char const *name, void *buffer, size_t len) {
+    return tfs_session_get(default_session, name, buffer, len);
+}
+
+int tfs_copy(char const *source_path, char const *dest_path, int flags) {
+    return tfs_session_copy(default_session, source_path, dest_path, flags);
+}
+
+int tfs_set_priority(int priority) {
+    return tfs_session_set_priority(default_session, priority);
+}
+
+int tfs_shutdown_after_all_closed() {
+    return tfs_session_shutdown_after_all_closed(default_session);
+}
+
+int tfs_submit_open(char const *name, int flags) {
+    return tfs_session_submit_open(default_session, name, flags);
+}
+
+int tfs_submit_close(int fhandle) {
+    return tfs_session_submit_close(default_session, fhandle);
+}
+
+int tfs_submit_write(int fhandle, void const *buffer, size_t len) {
+    return tfs_session_submit_write(default_session, fhandle, buffer, len);
+}
+
+int tfs_submit_read(int fhandle, void *buffer, size_t len) {
+    return tfs_session_submit_read(default_session, fhandle, buffer, len);
+}
+
+int tfs_submit_lseek(int fhandle, off_t offset, int whence) {
+    return tfs_session_submit_lseek(default_session, fhandle, offset, whence);
+}
+
+int tfs_submit_ftruncate(int fhandle, off_t length) {
+    return tfs_session_submit_ftruncate(default_session, fhandle, length);
+}
+
+int tfs_submit_fallocate(int fhandle, off_t offset, off_t len) {
+    return tfs_session_submit_fallocate(default_session, fhandle, offset, len);
+}
+
+int tfs_submit_put(char const *name, int flags, void const *buffer,
+                   size_t len) {
+    return tfs_session_submit_put(default_session, name, flags, buffer, len);
+}
+
+int tfs_submit_get(char const *name, void *buffer, size_t len) {
+    return tfs_session_submit_get(default_session, name, buffer, len);
+}
+
+int tfs_submit_copy(char const *source_path, char const *dest_path,
+                    int flags) {
+    return tfs_session_submit_copy(default_session, source_path, dest_path,
+                                   flags);
+}
+
+ssize_t tfs_collect(int request_id) {
+    return tfs_session_collect(default_session, request_id);
+}
+
+int tfs_poll(int request_id) {
+    return tfs_session_poll(default_session, request_id);
+}
+
+int tfs_open_async(char const *name, int flags, tfs_callback_t callback,
+                   void *arg) {
+    return tfs_session_open_async(default_session, name, flags, callback, arg);
+}
+
+int tfs_write_async(int fhandle, void const *buffer, size_t len,
+                    tfs_callback_t callback, void *arg) {
+    return tfs_session_write_async(default_session, fhandle, buffer, len,
+                                   callback, arg);
+}
+
+int tfs_read_async(int fhandle, void *buffer, size_t len,
+                   tfs_callback_t callback, void *arg) {
+    return tfs_session_read_async(default_session, fhandle, buffer, len,
+                                  callback, arg);
+}
+
+/*
+ * Session pool.
+ */
+
+struct tfs_pool {
+    tfs_session_t **sessions;
+    int size;
+    /* stack of the sessions that aren't acquired */
+    tfs_session_t **free_sessions;
+    int free_count;
+    pthread_mutex_t lock;
+    pthread_cond_t session_released;
+};
+
+tfs_pool_t *tfs_pool_create(char const *client_pipe_prefix,
+                            char const *server_pipe_path, int size) {
+    if (size <= 0) {
+        return NULL;
+    }
+
+    tfs_pool_t *pool = (tfs_pool_t *)malloc(sizeof(tfs_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->sessions =
+        (tfs_session_t **)calloc((size_t)size, sizeof(tfs_session_t *));
+    pool->free_sessions =
+        (tfs_session_t **)calloc((size_t)size, sizeof(tfs_session_t *));
+    if (pool->sessions == NULL || pool->free_sessions == NULL ||
+        pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool->sessions);
+        free(pool->free_sessions);
+        free(pool);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->session_released, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->sessions);
+        free(pool->free_sessions);
+        free(pool);
+        return NULL;
+    }
+    pool->size = 0;
+    pool->free_count = 0;
+
+    for (int i = 0; i < size; i++) {
+        char client_pipe[PIPE_STRING_LENGTH + 1];
+        snprintf(client_pipe, sizeof(client_pipe), "%s%d", client_pipe_prefix,
+                 i);
+        tfs_session_t *session =
+            tfs_session_mount(client_pipe, server_pipe_path);
+        if (session == NULL) {
+            tfs_pool_destroy(pool);
+            return NULL;
+        }
+        pool->sessions[pool->size++] = session;
+        pool->free_sessions[pool->free_count++] = session;
+    }
+
+    return pool;
+}
+
+tfs_session_t *tfs_pool_acquire(tfs_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->free_count == 0) {
+        pthread_cond_wait(&pool->session_released, &pool->lock);
+    }
+    tfs_session_t *session = pool->free_sessions[--pool->free_count];
+    pthread_mutex_unlock(&pool->lock);
+
+    return session;
+}
+
+void tfs_pool_release(tfs_pool_t *pool, tfs_session_t *session) {
+    pthread_mutex_lock(&pool->lock);
+    pool->free_sessions[pool->free_count++] = session;
+    pthread_cond_signal(&pool->session_released);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int tfs_pool_destroy(tfs_pool_t *pool) {
+    int result = 0;
+    for (int i = 0; i < pool->size; i++) {
+        if (tfs_session_unmount(pool->sessions[i]) != 0) {
+            result = -1;
+        }
+    }
+
+    pthread_cond_destroy(&pool->session_released);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->sessions);
+    free(pool->free_sessions);
+    free(pool);
+
+    return result;
 }
@@ -4,28 +4,76 @@
 #include "common/common.h"
 #include <sys/types.h>
 
+/* maximum number of requests of a session whose results weren't collected */
+#define MAX_PENDING_REQUESTS (64)
+
+/* maximum number of handles of a session whose writes are buffered */
+#define MAX_WRITE_BUFFERS (16)
+
+/* maximum number of handles of a session whose reads are cached */
+#define MAX_READ_CACHES (16)
+
+/* function run once the reply to an asynchronous request is received, with
+ * the id and the result of the request */
+typedef void (*tfs_callback_t)(int request_id, ssize_t result, void *arg);
+
+/* a session with a TecnicoFS server (see tfs_session_mount) */
+typedef struct tfs_session tfs_session_t;
+
+/* a fixed set of sessions shared by the threads of a process (see
+ * tfs_pool_create) */
+typedef struct tfs_pool tfs_pool_t;
+
 /*
  * Establishes a session with a TecnicoFS server.
  * Input:
  * - client_pipe_path: pathname of a named pipe that will be used for
  *   the client to receive responses. This named pipe will be created (via
- * 	 mkfifo) inside tfs_mount.
+ * 	 mkfifo) inside tfs_mount, along with the named pipe used to send the
+ * 	 session's requests, whose pathname is client_pipe_path followed by
+ * 	 ".req".
  * - server_pipe_path: pathname of the named pipe where the server is listening
- *   for client requests
+ *   for mount requests, or of the Unix domain socket where it is listening
+ *   for connections (in which case client_pipe_path is not used, and every
+ *   request and response of the session goes through the connection)
  * When successful, the new session's identifier (session_id) was
  * saved internally by the client; also, the client process has
- * successfully opened both named pipes (one for reading, the other one for
- * writing, respectively).
+ * successfully opened both of the session's named pipes (one for reading,
+ * the other one for writing, respectively).
  *
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_mount(char const *client_pipe_path, char const *server_pipe_path);
 
+/*
+ * Same as tfs_mount, but then sets up a region of shared memory with the
+ * server, through which the session's requests and responses go from then
+ * on (the session's pipe, or socket, is only used to wake the server up).
+ * Write payloads are copied straight into the shared memory and from there
+ * into the file, instead of going through pipes and intermediate buffers.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mount_shared_memory(char const *client_pipe_path,
+                            char const *server_pipe_path);
+
+/*
+ * Same as tfs_mount, but then has the server serve at most iops requests
+ * and bandwidth bytes (read or written) per second of the session, so that
+ * it can't take more than its share of the server. Either of them can be 0,
+ * for no limit. The limits can't be changed afterwards.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mount_limited(char const *client_pipe_path,
+                      char const *server_pipe_path, long iops,
+                      long bandwidth);
+
 /*
  * Ends the currently active session.
  * After notifying the server, both named pipes are closed by the client,
- * the client named pipe is deleted (via unlink) and the client's session_id is
- * set to none.
+ * the client named pipes are deleted (via unlink) and the client's session_id
+ * is set to none.
  *
  * Returns 0 if successful, -1 otherwise.
  */
@@ -55,6 +103,9 @@ int tfs_close(int fhandle);
  * 	- buffer containing the contents to write
  * 	- length of the contents (in bytes)
  *
+ * Contents of any length are streamed to the server, in chunks, as a single
+ * request.
+ *
  * Returns the number of bytes that were written (can be lower than
  * 'len' if the maximum file size is exceeded), or -1 in case of error.
  */
@@ -72,10 +123,364 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Repositions the offset of an open file
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- offset, relative to whence
+ * 	- whence: SEEK_SET, SEEK_CUR or SEEK_END
+ *
+ * Returns the resulting offset, or -1 in case of error. The offset may be
+ * placed past the end of the file, leaving a hole behind on the next write.
+ */
+off_t tfs_lseek(int fhandle, off_t offset, int whence);
+
+/* Changes the size of an open file
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- new size of the file
+ *
+ * Returns 0 if successful, -1 otherwise. If the file grows, the new bytes
+ * read back as zeros.
+ */
+int tfs_ftruncate(int fhandle, off_t length);
+
+/* Preallocates storage for a range of an open file
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- offset and length (larger than 0) of the range
+ *
+ * Returns 0 if successful, -1 otherwise. The file grows to include the range
+ * if needed, and later writes to the range don't have to allocate blocks.
+ */
+int tfs_fallocate(int fhandle, off_t offset, off_t len);
+
+/* Buffers the writes to an open file in the client, so that many small
+ * writes are sent to the server as a single one
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- size of the buffer, or 0 to stop buffering the writes to the file
+ *
+ * tfs_write then copies the contents to the buffer and returns right away,
+ * unless they don't fit in it, in which case the buffer is flushed first
+ * (and contents as big as the buffer are sent straight to the server).
+ * The buffer is also flushed by tfs_flush, and before tfs_read, tfs_lseek,
+ * tfs_ftruncate, tfs_fallocate and tfs_close on the same file handle (and
+ * tfs_unmount). Anyone else reading the file only sees the buffered writes
+ * once they are flushed. A buffered write that the server fails to do (for
+ * instance, because the file is full) is reported by the call that flushes
+ * it. The tfs_submit_* and tfs_*_async functions don't go through the
+ * buffer, so it should be flushed before using them on the file handle.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_set_write_buffer(int fhandle, size_t size);
+
+/* Sends the buffered writes to an open file to the server
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if every buffered write was done (or there were none), -1
+ * otherwise.
+ */
+int tfs_flush(int fhandle);
+
+/* Caches the contents of an open file in the client, so that reads (and
+ * seeks) are served from memory
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- enabled: 1 to cache the reads of the file, 0 to stop caching them
+ *
+ * The first tfs_read then asks the server for a read lease on the file,
+ * which comes with all of its contents, and the next reads and seeks are
+ * served from them until the lease expires (after LEASE_DURATION_MS) or the
+ * server recalls it, which it does before anyone (through any handle or
+ * session) changes the file. The next tfs_read then leases it again. If
+ * the lease isn't granted (because the file is being changed), the read
+ * just goes to the server. The offset of the file handle is kept in the
+ * client while the cache is used, and given back to the server before
+ * tfs_write, tfs_ftruncate and tfs_fallocate on the same handle (which also
+ * give the lease back). Recalls are handled by the completion thread, which
+ * is started if it isn't running yet. The tfs_submit_* and tfs_*_async
+ * functions don't go through the cache, so they shouldn't be used on the
+ * file handle while it is enabled.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_set_read_cache(int fhandle, int enabled);
+
+/* Writes a whole file in a single request, which opens it, writes to it and
+ * closes it again in the server
+ * Input:
+ * 	- file name and flags, same as tfs_open
+ * 	- buffer containing the contents to write
+ * 	- length of the contents (in bytes)
+ *
+ * Returns the same as tfs_write (-1 also if the file can't be opened).
+ */
+ssize_t tfs_put(char const *name, int flags, void const *buffer, size_t len);
+
+/* Reads a whole file in a single request, which opens it, reads from its
+ * start and closes it again in the server
+ * Input:
+ * 	- file name
+ * 	- destination buffer
+ * 	- length of the buffer
+ *
+ * Returns the same as tfs_read (-1 also if the file can't be opened).
+ */
+ssize_t tfs_get(char const *name, void *buffer, size_t len);
+
+/* Copies a file to another one inside the server, without its contents
+ * going through the client
+ * Input:
+ * 	- path name of the source file
+ * 	- path name of the destination file, which is created if needed, and
+ * 	  whose contents are replaced if it already exists
+ * 	- flags: 0, or TFS_COPY_REFLINK to share the blocks of the source with
+ * 	  the copy when possible, instead of copying them
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy(char const *source_path, char const *dest_path, int flags);
+
+/*
+ * Sets the priority class of the requests sent from then on. The server
+ * serves interactive requests (of every session) before bulk ones, which
+ * only get the workers that no interactive request needs. By default
+ * (TFS_PRIORITY_DEFAULT), requests that transfer file contents (writes,
+ * reads, puts, gets, copies, leases and fallocates) are bulk, and the
+ * others are interactive.
+ * Input:
+ * 	- priority: TFS_PRIORITY_INTERACTIVE, TFS_PRIORITY_BULK or
+ * 	  TFS_PRIORITY_DEFAULT
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_set_priority(int priority);
+
 /*
  * Orders TecnicoFS server to wait until no file is open and then shutdown
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_shutdown_after_all_closed();
 
+/*
+ * The following functions send the same requests as the functions above,
+ * but return as soon as the request is sent, without waiting for its reply,
+ * so that many requests can be in flight in the same session. Their result
+ * is then collected with tfs_collect. The server may handle requests in
+ * flight at the same time, and in any order, so a request that depends on
+ * the outcome of another one should only be sent after collecting it.
+ * Up to MAX_PENDING_REQUESTS requests can be waiting to be collected.
+ *
+ * Each of them returns the id of the request, or -1 in case of error.
+ */
+int tfs_submit_open(char const *name, int flags);
+int tfs_submit_close(int fhandle);
+int tfs_submit_write(int fhandle, void const *buffer, size_t len);
+int tfs_submit_read(int fhandle, void *buffer, size_t len);
+int tfs_submit_lseek(int fhandle, off_t offset, int whence);
+int tfs_submit_ftruncate(int fhandle, off_t length);
+int tfs_submit_fallocate(int fhandle, off_t offset, off_t len);
+int tfs_submit_put(char const *name, int flags, void const *buffer,
+                   size_t len);
+int tfs_submit_get(char const *name, void *buffer, size_t len);
+int tfs_submit_copy(char const *source_path, char const *dest_path,
+                    int flags);
+
+/*
+ * Waits for the reply to a request sent by one of the tfs_submit_* functions
+ * (which, for tfs_submit_read and tfs_submit_get, includes the content being
+ * stored in the buffer it was given).
+ * Input:
+ * 	- request_id: id of the request (or -1, for a request that couldn't be
+ * 	  sent)
+ *
+ * Returns the result of the request, the same as the corresponding function
+ * that waits for it, or -1 in case of error. The id may then be reused.
+ */
+ssize_t tfs_collect(int request_id);
+
+/*
+ * Returns 1 if the reply to a request sent by one of the tfs_submit_* or
+ * tfs_*_async functions was already received (so that tfs_collect won't
+ * wait), 0 if it wasn't, or -1 if there is no such request. Replies only
+ * arrive on their own while the completion thread is running, which is
+ * started by the first tfs_*_async call of the session.
+ */
+int tfs_poll(int request_id);
+
+/*
+ * Asynchronous versions of tfs_open, tfs_write and tfs_read. They send the
+ * request and return its id right away. Replies are received by a
+ * completion thread of the client, started by the first call of the session
+ * and stopped by tfs_unmount.
+ * If callback isn't NULL, the completion thread runs it with the result of
+ * the request (and arg) once its reply arrives, and the request can't be
+ * polled or collected. Otherwise, the request can be polled with tfs_poll
+ * and waited for with tfs_collect.
+ * Callbacks may send new requests, but must not wait for any reply (with
+ * tfs_collect or with the functions that wait for their own), as they would
+ * be waiting for the completion thread itself.
+ * Input:
+ * 	- the same arguments as the corresponding function
+ * 	- callback: function to run once the reply arrives (may be NULL)
+ * 	- arg: argument for the callback
+ *
+ * Returns the id of the request, or -1 in case of error.
+ */
+int tfs_open_async(char const *name, int flags, tfs_callback_t callback,
+                   void *arg);
+int tfs_write_async(int fhandle, void const *buffer, size_t len,
+                    tfs_callback_t callback, void *arg);
+int tfs_read_async(int fhandle, void *buffer, size_t len,
+                   tfs_callback_t callback, void *arg);
+
+/*
+ * Sessions.
+ *
+ * The functions above use the session mounted by tfs_mount, of which there
+ * is only one per process. The following ones take the session they use,
+ * so that a process can have many of them, mounted with tfs_session_mount.
+ * Every function of a session is thread-safe: any number of threads may
+ * send requests on the same session and wait for their own replies at the
+ * same time (whichever thread is waiting receives the replies for all of
+ * them, one thread at a time). The only exception is tfs_session_unmount,
+ * which no other thread may call functions of the session during (or
+ * after).
+ * File handles belong to the session that opened them: they can only be
+ * used in that session (other sessions have handles of their own, with the
+ * same numbers), and the server closes the ones left open when the session
+ * is unmounted. So do write buffers, which are only flushed by it.
+ */
+
+/*
+ * Same as tfs_mount, but creates a new session instead of the one used by
+ * the functions without a session.
+ * Returns the session, or NULL in case of error.
+ */
+tfs_session_t *tfs_session_mount(char const *client_pipe_path,
+                                 char const *server_pipe_path);
+
+/*
+ * Same as tfs_mount_shared_memory, but creates a new session.
+ * Returns the session, or NULL in case of error.
+ */
+tfs_session_t *tfs_session_mount_shared_memory(char const *client_pipe_path,
+                                               char const *server_pipe_path);
+
+/*
+ * Same as tfs_mount_limited, but creates a new session.
+ * Returns the session, or NULL in case of error.
+ */
+tfs_session_t *tfs_session_mount_limited(char const *client_pipe_path,
+                                         char const *server_pipe_path,
+                                         long iops, long bandwidth);
+
+/*
+ * Same as tfs_unmount. The session is freed even if the server can't be
+ * notified, as it can't be used anymore.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_session_unmount(tfs_session_t *session);
+
+/*
+ * Same as the functions above without "session_" in their names, on the
+ * given session.
+ */
+int tfs_session_open(tfs_session_t *session, char const *name, int flags);
+int tfs_session_close(tfs_session_t *session, int fhandle);
+ssize_t tfs_session_write(tfs_session_t *session, int fhandle,
+                          void const *buffer, size_t len);
+ssize_t tfs_session_read(tfs_session_t *session, int fhandle, void *buffer,
+                         size_t len);
+off_t tfs_session_lseek(tfs_session_t *session, int fhandle, off_t offset,
+                        int whence);
+int tfs_session_ftruncate(tfs_session_t *session, int fhandle, off_t length);
+int tfs_session_fallocate(tfs_session_t *session, int fhandle, off_t offset,
+                          off_t len);
+int tfs_session_set_write_buffer(tfs_session_t *session, int fhandle,
+                                 size_t size);
+int tfs_session_flush(tfs_session_t *session, int fhandle);
+int tfs_session_set_read_cache(tfs_session_t *session, int fhandle,
+                               int enabled);
+ssize_t tfs_session_put(tfs_session_t *session, char const *name, int flags,
+                        void const *buffer, size_t len);
+ssize_t tfs_session_get(tfs_session_t *session, char const *name,
+                        void *buffer, size_t len);
+int tfs_session_copy(tfs_session_t *session, char const *source_path,
+                     char const *dest_path, int flags);
+int tfs_session_set_priority(tfs_session_t *session, int priority);
+int tfs_session_shutdown_after_all_closed(tfs_session_t *session);
+
+int tfs_session_submit_open(tfs_session_t *session, char const *name,
+                            int flags);
+int tfs_session_submit_close(tfs_session_t *session, int fhandle);
+int tfs_session_submit_write(tfs_session_t *session, int fhandle,
+                             void const *buffer, size_t len);
+int tfs_session_submit_read(tfs_session_t *session, int fhandle, void *buffer,
+                            size_t len);
+int tfs_session_submit_lseek(tfs_session_t *session, int fhandle,
+                             off_t offset, int whence);
+int tfs_session_submit_ftruncate(tfs_session_t *session, int fhandle,
+                                 off_t length);
+int tfs_session_submit_fallocate(tfs_session_t *session, int fhandle,
+                                 off_t offset, off_t len);
+int tfs_session_submit_put(tfs_session_t *session, char const *name,
+                           int flags, void const *buffer, size_t len);
+int tfs_session_submit_get(tfs_session_t *session, char const *name,
+                           void *buffer, size_t len);
+int tfs_session_submit_copy(tfs_session_t *session, char const *source_path,
+                            char const *dest_path, int flags);
+ssize_t tfs_session_collect(tfs_session_t *session, int request_id);
+int tfs_session_poll(tfs_session_t *session, int request_id);
+
+int tfs_session_open_async(tfs_session_t *session, char const *name, int flags,
+                           tfs_callback_t callback, void *arg);
+int tfs_session_write_async(tfs_session_t *session, int fhandle,
+                            void const *buffer, size_t len,
+                            tfs_callback_t callback, void *arg);
+int tfs_session_read_async(tfs_session_t *session, int fhandle, void *buffer,
+                           size_t len, tfs_callback_t callback, void *arg);
+
+/*
+ * Session pools.
+ *
+ * A pool mounts a fixed number of sessions up front, and lends them to the
+ * threads of the process, one thread per session at a time, so that threads
+ * doing blocking calls don't wait behind each other's requests in the same
+ * session, and no thread has to mount its own.
+ */
+
+/*
+ * Creates a pool, mounting all of its sessions.
+ * Input:
+ * - client_pipe_prefix: the client pipe of each session is named after it,
+ *   followed by the index of the session
+ * - server_pipe_path: same as tfs_mount
+ * - size: number of sessions
+ * Returns the pool, or NULL in case of error.
+ */
+tfs_pool_t *tfs_pool_create(char const *client_pipe_prefix,
+                            char const *server_pipe_path, int size);
+
+/*
+ * Takes a session of the pool, waiting until one is released if all of them
+ * are taken. It must be given back with tfs_pool_release (files opened with
+ * it should be closed before, as their handles can't be used in any other
+ * session).
+ */
+tfs_session_t *tfs_pool_acquire(tfs_pool_t *pool);
+
+/*
+ * Gives a session taken with tfs_pool_acquire back to the pool.
+ */
+void tfs_pool_release(tfs_pool_t *pool, tfs_session_t *session);
+
+/*
+ * Unmounts every session of the pool and frees it. No session may be taken.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_pool_destroy(tfs_pool_t *pool);
+
 #endif /* CLIENT_API_H */
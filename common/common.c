@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 ssize_t try_read(int fd, void *buf, size_t count) {
@@ -17,3 +18,58 @@ ssize_t try_write(int fd, const void *buf, size_t count) {
     } while (bytes_written < 0 && errno == EINTR);
     return bytes_written;
 }
+
+ssize_t try_read_all(int fd, void *buf, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t bytes_read = try_read(fd, (char *)buf + total, count - total);
+        if (bytes_read < 0) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        total += (size_t)bytes_read;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t try_write_all(int fd, const void *buf, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t bytes_written =
+            try_write(fd, (char const *)buf + total, count - total);
+        if (bytes_written < 0) {
+            return -1;
+        }
+        total += (size_t)bytes_written;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t try_writev_all(int fd, struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    while (iovcnt > 0) {
+        ssize_t bytes_written = writev(fd, iov, iovcnt);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += (size_t)bytes_written;
+
+        /* skip what was written, which may end in the middle of a buffer */
+        size_t left = (size_t)bytes_written;
+        while (iovcnt > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return (ssize_t)total;
+}
@@ -3,6 +3,7 @@
 
 #include <limits.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /* tfs_open flags */
 enum {
@@ -11,6 +12,11 @@ enum {
     TFS_O_APPEND = 0b100,
 };
 
+/* tfs_copy flags */
+enum {
+    TFS_COPY_REFLINK = 0b001,
+};
+
 /* operation codes (for client-server requests) */
 enum {
     TFS_OP_CODE_MOUNT = 1,
@@ -19,13 +25,44 @@ enum {
     TFS_OP_CODE_CLOSE = 4,
     TFS_OP_CODE_WRITE = 5,
     TFS_OP_CODE_READ = 6,
-    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7
+    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7,
+    TFS_OP_CODE_LSEEK = 8,
+    TFS_OP_CODE_FTRUNCATE = 9,
+    TFS_OP_CODE_FALLOCATE = 10,
+    TFS_OP_CODE_ATTACH_SHARED_MEMORY = 11,
+    TFS_OP_CODE_LEASE = 12,
+    TFS_OP_CODE_RELEASE_LEASE = 13,
+    TFS_OP_CODE_PUT = 14,
+    TFS_OP_CODE_GET = 15,
+    TFS_OP_CODE_COPY = 16,
+    TFS_OP_CODE_SET_LIMITS = 17
+};
+
+/* request priority classes. Every request is sent preceded by its class,
+ * and the server serves the sessions whose next request is interactive
+ * before the ones whose next request is bulk */
+enum {
+    TFS_PRIORITY_DEFAULT = -1,
+    TFS_PRIORITY_INTERACTIVE = 0,
+    TFS_PRIORITY_BULK = 1,
 };
 
+#define TFS_PRIORITY_CLASSES (2)
+
 #define PIPE_STRING_LENGTH (40)
 
 #define PIPE_BUFFER_MAX_LEN (PIPE_BUF)
 
+/* size of the chunks in which the content of reads and writes is streamed */
+#define STREAM_CHUNK_SIZE (PIPE_BUFFER_MAX_LEN)
+
+/* how long (in milliseconds) a read lease lasts, unless it is recalled */
+#define LEASE_DURATION_MS (1000)
+
+/* the server recalls a read lease by sending, in place of a reply, this
+ * request id followed by the file handle and the id of the lease */
+#define LEASE_RECALL_REQUEST_ID (-1)
+
 /*
  * Same as POSIX's read, but handles EINTR correctly.
  */
@@ -36,15 +73,37 @@ ssize_t try_read(int fd, void *buf, size_t count);
  */
 ssize_t try_write(int fd, const void *buf, size_t count);
 
-/* check if all the content was read from the pipe. */
+/*
+ * Same as try_read, but keeps reading until count bytes are read, since a
+ * stream socket may return less than that.
+ * Returns the number of bytes read (less than count only at end of file), or
+ * -1 on error.
+ */
+ssize_t try_read_all(int fd, void *buf, size_t count);
+
+/*
+ * Same as try_write, but keeps writing until count bytes are written.
+ * Returns count, or -1 on error.
+ */
+ssize_t try_write_all(int fd, const void *buf, size_t count);
+
+/*
+ * Same as try_write_all, but gathers the content from iovcnt buffers, so that
+ * a header and its payload go out together without being copied into one.
+ * The iov array is changed to keep track of what is left to write.
+ * Returns the number of bytes written, or -1 on error.
+ */
+ssize_t try_writev_all(int fd, struct iovec *iov, int iovcnt);
+
+/* check if all the content was read from the pipe (or socket). */
 #define read_pipe(pipe, buffer, size)                                          \
-    if (try_read(pipe, buffer, size) != size) {                                \
+    if (try_read_all(pipe, buffer, size) != size) {                            \
         return -1;                                                             \
     }
 
-/* check if all the content was written to the pipe. */
+/* check if all the content was written to the pipe (or socket). */
 #define write_pipe(pipe, buffer, size)                                         \
-    if (try_write(pipe, buffer, size) != size) {                               \
+    if (try_write_all(pipe, buffer, size) != size) {                           \
         return -1;                                                             \
     }
 
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include "shm_ring.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* waiters wake up at least this often (in nanoseconds), in case the ring was
+ * closed right before they started waiting */
+#define FUTEX_TIMEOUT_NS (100 * 1000 * 1000)
+
+#define RING_OFFSET(position) ((position) & (SHM_RING_SIZE - 1))
+
+/*
+ * Waits while *address is value, or until woken up by futex_wake.
+ */
+static void futex_wait(_Atomic uint32_t *address, uint32_t value) {
+    struct timespec timeout = {0, FUTEX_TIMEOUT_NS};
+    /* the futex is shared by two processes, so it can't be private */
+    syscall(SYS_futex, (uint32_t *)address, FUTEX_WAIT, value, &timeout, NULL,
+            0);
+}
+
+/*
+ * Wakes up everyone waiting on the address.
+ */
+static void futex_wake(_Atomic uint32_t *address) {
+    syscall(SYS_futex, (uint32_t *)address, FUTEX_WAKE, INT_MAX, NULL, NULL,
+            0);
+}
+
+/*
+ * Waits while *address is value (as seen by the caller), flagging that there
+ * is someone waiting, so that the other side calls ring_wake.
+ */
+static void ring_wait(shm_ring_t *ring, _Atomic uint32_t *address,
+                      _Atomic uint32_t *waiting, uint32_t value) {
+    atomic_store(waiting, 1);
+    /* check again after raising the flag, as the other side may have changed
+     * the value before seeing it */
+    if (atomic_load(address) == value && !atomic_load(&ring->closed)) {
+        futex_wait(address, value);
+    }
+}
+
+/*
+ * Wakes up the other side, if it is waiting for *address to change.
+ */
+static void ring_wake(_Atomic uint32_t *address, _Atomic uint32_t *waiting) {
+    if (atomic_exchange(waiting, 0) != 0) {
+        futex_wake(address);
+    }
+}
+
+int shm_ring_put(shm_ring_t *ring, void const *buffer, size_t count) {
+    char const *bytes = (char const *)buffer;
+
+    while (count > 0) {
+        if (atomic_load(&ring->closed)) {
+            return -1;
+        }
+
+        uint32_t head = atomic_load(&ring->head);
+        size_t free_bytes = SHM_RING_SIZE - (ring->write_cursor - head);
+        if (free_bytes == 0) {
+            /* let the consumer read what was written, to make room */
+            shm_ring_flush(ring);
+            ring_wait(ring, &ring->head, &ring->writer_waiting, head);
+            continue;
+        }
+
+        uint32_t offset = RING_OFFSET(ring->write_cursor);
+        size_t chunk = SHM_RING_SIZE - offset;
+        if (chunk > free_bytes) {
+            chunk = free_bytes;
+        }
+        if (chunk > count) {
+            chunk = count;
+        }
+        memcpy(ring->data + offset, bytes, chunk);
+        ring->write_cursor += (uint32_t)chunk;
+        bytes += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+void shm_ring_flush(shm_ring_t *ring) {
+    atomic_store(&ring->tail, ring->write_cursor);
+    ring_wake(&ring->tail, &ring->reader_waiting);
+}
+
+ssize_t shm_ring_read(shm_ring_t *ring, void *buffer, size_t count) {
+    char *bytes = (char *)buffer;
+    size_t remaining = count;
+
+    while (remaining > 0) {
+        uint32_t head = atomic_load(&ring->head);
+        uint32_t tail = atomic_load(&ring->tail);
+        if (tail == head) {
+            if (atomic_load(&ring->closed)) {
+                return -1;
+            }
+            ring_wait(ring, &ring->tail, &ring->reader_waiting, tail);
+            continue;
+        }
+
+        uint32_t offset = RING_OFFSET(head);
+        size_t chunk = SHM_RING_SIZE - offset;
+        if (chunk > tail - head) {
+            chunk = tail - head;
+        }
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        memcpy(bytes, ring->data + offset, chunk);
+        atomic_store(&ring->head, head + (uint32_t)chunk);
+        ring_wake(&ring->head, &ring->writer_waiting);
+        bytes += chunk;
+        remaining -= chunk;
+    }
+    return (ssize_t)count;
+}
+
+void *shm_ring_peek(shm_ring_t *ring, size_t count) {
+    uint32_t head = atomic_load(&ring->head);
+    if (RING_OFFSET(head) + count > SHM_RING_SIZE) {
+        return NULL;
+    }
+
+    while (true) {
+        uint32_t tail = atomic_load(&ring->tail);
+        if (tail - head >= count) {
+            return ring->data + RING_OFFSET(head);
+        }
+        if (atomic_load(&ring->closed)) {
+            return NULL;
+        }
+        ring_wait(ring, &ring->tail, &ring->reader_waiting, tail);
+    }
+}
+
+void shm_ring_consume(shm_ring_t *ring, size_t count) {
+    atomic_fetch_add(&ring->head, (uint32_t)count);
+    ring_wake(&ring->head, &ring->writer_waiting);
+}
+
+bool shm_ring_is_empty(shm_ring_t *ring) {
+    return atomic_load(&ring->tail) == atomic_load(&ring->head);
+}
+
+void shm_ring_close(shm_ring_t *ring) {
+    atomic_store(&ring->closed, 1);
+    futex_wake(&ring->head);
+    futex_wake(&ring->tail);
+}
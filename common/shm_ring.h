@@ -0,0 +1,95 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* size (in bytes) of each ring, must be a power of two */
+#define SHM_RING_SIZE (1 << 16)
+
+/*
+ * Single producer, single consumer byte ring, meant to live in memory shared
+ * by two processes. The producer and the consumer only wait (on a futex)
+ * when the ring is full or empty, respectively.
+ */
+typedef struct {
+    /* next byte to be read, only changed by the consumer */
+    _Atomic uint32_t head;
+    /* end of the bytes that can be read, only changed by the producer */
+    _Atomic uint32_t tail;
+    /* end of the bytes written, but not yet published, by the producer */
+    uint32_t write_cursor;
+    _Atomic uint32_t reader_waiting;
+    _Atomic uint32_t writer_waiting;
+    _Atomic uint32_t closed;
+    char data[SHM_RING_SIZE];
+} shm_ring_t;
+
+/*
+ * Shared memory region of a session: requests go from the client to the
+ * server, responses from the server to the client.
+ */
+typedef struct {
+    shm_ring_t requests;
+    shm_ring_t responses;
+    /* set by the server when it stops serving the session, so that the
+     * client knows it has to wake the server up for its next request */
+    _Atomic uint32_t server_idle;
+} shm_channel_t;
+
+/*
+ * Copies data to the ring, without making it visible to the consumer (see
+ * shm_ring_flush). If the ring is full, what was already written is flushed
+ * and the producer waits for the consumer to make room.
+ * Input:
+ * - ring: the ring
+ * - buffer: data to be copied
+ * - count: number of bytes to copy
+ * Returns 0 if successful, -1 if the ring was closed.
+ */
+int shm_ring_put(shm_ring_t *ring, void const *buffer, size_t count);
+
+/*
+ * Makes every byte written so far visible to the consumer, waking it up if
+ * it is waiting.
+ */
+void shm_ring_flush(shm_ring_t *ring);
+
+/*
+ * Copies data out of the ring, waiting until there are enough bytes.
+ * Input:
+ * - ring: the ring
+ * - buffer: where to copy the data to
+ * - count: number of bytes to copy
+ * Returns count if successful, -1 if the ring was closed.
+ */
+ssize_t shm_ring_read(shm_ring_t *ring, void *buffer, size_t count);
+
+/*
+ * Returns a pointer to the next count bytes of the ring (waiting until there
+ * are enough of them), so that they can be used in place. They stay in the
+ * ring until shm_ring_consume is called.
+ * Returns NULL if the bytes wrap around the end of the ring (in which case
+ * they must be read with shm_ring_read) or if the ring was closed.
+ */
+void *shm_ring_peek(shm_ring_t *ring, size_t count);
+
+/*
+ * Discards the next count bytes of the ring, which must have been peeked.
+ */
+void shm_ring_consume(shm_ring_t *ring, size_t count);
+
+/*
+ * Returns true if there is nothing to be read from the ring.
+ */
+bool shm_ring_is_empty(shm_ring_t *ring);
+
+/*
+ * Marks the ring as closed, waking up whoever is waiting on it.
+ */
+void shm_ring_close(shm_ring_t *ring);
+
+#endif // SHM_RING_H
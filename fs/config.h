@@ -12,10 +12,47 @@
 #define INODE_DIRECT_BLOCK_SIZE (10)
 // Maximum number of pointers that a inode can handle
 #define INODE_BLOCK_COUNT (INODE_DIRECT_BLOCK_SIZE + BLOCK_SIZE / sizeof(int))
+// Maximum size of a file (in bytes)
+#define MAX_FILE_SIZE (BLOCK_SIZE * INODE_BLOCK_COUNT)
+// Files up to this size (in bytes) are stored inside the inode itself
+#define INODE_INLINE_DATA_SIZE (64)
+// Files that don't fit inside the inode, but are smaller than a block, are
+// packed into runs of fragments that share blocks with other small files
+#define FRAGMENT_SIZE (128)
+#define FRAGMENTS_PER_BLOCK (BLOCK_SIZE / FRAGMENT_SIZE)
+#define MAX_FRAGMENTED_FILE_SIZE (FRAGMENT_SIZE * (FRAGMENTS_PER_BLOCK - 1))
+
+// Number of snapshots of the whole file system that can exist at a time
+#define MAX_SNAPSHOTS (4)
 
 #define DELAY (5000)
 
 // Number of simultaneous connections that the server can handle at a given time
-#define SIMULTANEOUS_CONNECTIONS (50)
+// (sessions aren't tied to threads, so this only bounds the session table)
+#define SIMULTANEOUS_CONNECTIONS (500)
+
+// Number of mounts that can wait for a session to be freed when all of them
+// are taken, and how long each one waits (in milliseconds) before it is
+// rejected
+#define MOUNT_QUEUE_SIZE (SIMULTANEOUS_CONNECTIONS)
+#define MOUNT_WAIT_TIMEOUT_MS (2000)
+
+// Sessions waiting for a request for this long (in milliseconds) are closed,
+// and so are the ones whose client is gone, checked every interval
+#define SESSION_IDLE_TIMEOUT_MS (10 * 60 * 1000)
+#define SESSION_REAP_INTERVAL_MS (500)
+
+// Number of parsed requests that can be waiting for a worker thread
+#define WORK_QUEUE_SIZE (SIMULTANEOUS_CONNECTIONS)
+
+// Sessions with pending requests take turns in deficit round robin: each
+// turn lets a session spend DRR_QUANTUM more, and each of its requests costs
+// the bytes it reads or writes plus DRR_REQUEST_COST
+#define DRR_QUANTUM (16 * 1024)
+#define DRR_REQUEST_COST (256)
+
+// Number of read leases that can be held at a given time (clients just read
+// without caching when there are none left)
+#define MAX_LEASES (100)
 
 #endif // CONFIG_H
@@ -134,6 +134,78 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
     return inode_read(fhandle, buffer, len);
 }
 
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, off_t offset) {
+    if (offset < 0) {
+        return -1;
+    }
+    return inode_pread(fhandle, buffer, len, (size_t)offset);
+}
+
+int tfs_inumber(int fhandle) { return inode_of_handle(fhandle); }
+
+off_t tfs_lseek(int fhandle, off_t offset, int whence) {
+    return inode_seek(fhandle, offset, whence);
+}
+
+int tfs_ftruncate(int fhandle, off_t length) {
+    if (length < 0) {
+        return -1;
+    }
+    return inode_ftruncate(fhandle, (size_t)length);
+}
+
+int tfs_fallocate(int fhandle, off_t offset, off_t len) {
+    if (offset < 0 || len <= 0) {
+        return -1;
+    }
+    return inode_fallocate(fhandle, (size_t)offset, (size_t)len);
+}
+
+int tfs_copy(char const *source_path, char const *dest_path, int flags) {
+    if ((flags & ~TFS_COPY_REFLINK) != 0) {
+        return -1;
+    }
+
+    int source = tfs_lookup(source_path);
+    if (source == -1) {
+        return -1;
+    }
+    /* the destination is created, if needed, the same way as by tfs_open */
+    int dest_file = tfs_open(dest_path, TFS_O_CREAT);
+    if (dest_file == -1) {
+        return -1;
+    }
+
+    int result = inode_copy(source, tfs_inumber(dest_file),
+                            (flags & TFS_COPY_REFLINK) != 0);
+    if (tfs_close(dest_file) != 0) {
+        return -1;
+    }
+    return result;
+}
+
+int tfs_clone(char const *source_path, char const *dest_path) {
+    return tfs_copy(source_path, dest_path, TFS_COPY_REFLINK);
+}
+
+int tfs_snapshot_create() { return snapshot_create(); }
+
+int tfs_snapshot_delete(int snapshot) { return snapshot_delete(snapshot); }
+
+int tfs_snapshot_open(int snapshot, char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+    // skip the initial '/' character
+    return snapshot_open(snapshot, ROOT_DIR_INUM, name + 1);
+}
+
+ssize_t tfs_snapshot_read(int shandle, void *buffer, size_t len) {
+    return snapshot_file_read(shandle, buffer, len);
+}
+
+int tfs_snapshot_close(int shandle) { return snapshot_file_close(shandle); }
+
 int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
     // open at the start of the file
     int source_file = tfs_open(source_path, 0);
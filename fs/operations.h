@@ -72,6 +72,124 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Reads from an open file, starting at the given offset
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - destination buffer
+ *  - length of the buffer
+ *  - offset where to start reading
+ *  Same as tfs_read, but the offset of the file handle is left untouched.
+ */
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, off_t offset);
+
+/* Returns the i-number of the file of an open file handle (the same for
+ * every handle of the file), or -1 in case of error.
+ */
+int tfs_inumber(int fhandle);
+
+/* Repositions the offset of an open file
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - offset, relative to whence
+ *  - whence: SEEK_SET, SEEK_CUR or SEEK_END
+ *  Returns the resulting offset, or -1 in case of error.
+ *  The offset may be placed past the end of the file: a later write there
+ *  leaves a hole behind, which takes no data blocks and reads back as zeros.
+ */
+off_t tfs_lseek(int fhandle, off_t offset, int whence);
+
+/* Changes the size of an open file
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - new size of the file
+ *  Returns 0 if successful, -1 otherwise.
+ *  If the file shrinks, the blocks past its new end are freed. If it grows,
+ *  the new bytes are a hole (and read back as zeros).
+ */
+int tfs_ftruncate(int fhandle, off_t length);
+
+/* Preallocates storage for a range of an open file
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - offset and length (larger than 0) of the range
+ *  Returns 0 if successful, -1 otherwise.
+ *  The file grows to include the range if needed, and the blocks for the
+ *  holes in the range, and copies of the blocks there that the file shares
+ *  with clones (see tfs_clone) or snapshots (see tfs_snapshot_create), are
+ *  taken as a single run of consecutive blocks whenever possible, so later
+ *  writes to the range don't allocate blocks.
+ */
+int tfs_fallocate(int fhandle, off_t offset, off_t len);
+
+/* Copies a file to another one inside TecnicoFS, block to block in a single
+ * pass, without going through a buffer
+ * Input:
+ *  - path name of the source file
+ *  - path name of the destination file, which is created if needed, and
+ *    whose contents are replaced if it already exists
+ *  - flags: 0, or TFS_COPY_REFLINK to share the blocks of the source with
+ *    the copy when possible, instead of copying them
+ *  Returns 0 if successful, -1 otherwise.
+ *  Holes in the source stay holes in the copy. If the copy fails, the
+ *  destination may be left empty.
+ */
+int tfs_copy(char const *source_path, char const *dest_path, int flags);
+
+/* Clones a file: the same as tfs_copy with TFS_COPY_REFLINK. Only the block
+ * map is copied, and the data blocks are shared by both files until one of
+ * them writes to them (files that fit in their i-node are still copied).
+ * Input:
+ *  - path name of the source file
+ *  - path name of the clone, which is created if needed, and whose contents
+ *    are replaced if it already exists
+ *  Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source_path, char const *dest_path);
+
+/* Takes a point-in-time snapshot of the whole file system, which can be read
+ * while the files keep being changed (e.g. to back them up). It is taken in
+ * constant time: each file is only saved into it when it is first changed,
+ * sharing its data blocks with the live file, which copies them on write.
+ *  Returns the identifier of the snapshot if successful, -1 otherwise (at
+ *  most MAX_SNAPSHOTS can exist at a time).
+ */
+int tfs_snapshot_create();
+
+/* Deletes a snapshot, freeing the blocks only it still used
+ * Input:
+ *  - identifier of the snapshot
+ *  Returns 0 if successful, -1 otherwise (including if it has open files)
+ */
+int tfs_snapshot_delete(int snapshot);
+
+/* Opens a file of a snapshot, as it was when the snapshot was taken. The
+ * handle isn't a file handle: it can only be used with tfs_snapshot_read
+ * and tfs_snapshot_close
+ * Input:
+ *  - identifier of the snapshot
+ *  - name: absolute path name
+ *  Returns the snapshot file handle if successful, -1 otherwise.
+ */
+int tfs_snapshot_open(int snapshot, char const *name);
+
+/* Reads from a file open in a snapshot, starting at the current offset
+ * Input:
+ *  - snapshot file handle (obtained from tfs_snapshot_open)
+ *  - destination buffer
+ *  - length of the buffer
+ *  Returns the number of bytes that were copied from the file to the buffer
+ *  (can be lower than 'len' if the end of the file was reached), or -1 in
+ *  case of error
+ */
+ssize_t tfs_snapshot_read(int shandle, void *buffer, size_t len);
+
+/* Closes a file open in a snapshot
+ * Input:
+ *  - snapshot file handle (obtained from tfs_snapshot_open)
+ *  Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_close(int shandle);
+
 /* Copies the contents of a file that exists in TecnicoFS to the contents
  * of another file in the OS' file system tree (outside TecnicoFS).
  * Devolve 0 em caso de sucesso, -1 em caso de erro.
@@ -18,10 +18,59 @@ static pthread_rwlock_t inode_locks[INODE_TABLE_SIZE];
 static char freeinode_ts[INODE_TABLE_SIZE];
 static pthread_rwlock_t freeinode_ts_rwl;
 
-/* Data blocks */
+/* Data blocks, and the number of references to each one (0 if it is free).
+ * A block is referenced more than once when copies made with
+ * TFS_COPY_REFLINK share it, until one of them writes to it */
 static char fs_data[BLOCK_SIZE * DATA_BLOCKS];
-static char free_blocks[DATA_BLOCKS];
-static pthread_rwlock_t free_blocks_rwl;
+static int block_refs[DATA_BLOCKS];
+static pthread_rwlock_t block_refs_rwl;
+
+/* Fragment blocks (shared by the tails of several small files): a bitmap of
+ * the used fragments and the number of fragment runs in each block */
+static unsigned char fragment_maps[DATA_BLOCKS];
+static int fragment_refs[DATA_BLOCKS];
+static pthread_mutex_t fragments_mutex;
+
+/* Block maps detached from truncated or deleted i-nodes, waiting for the
+ * reclaimer thread to return their blocks to the allocator */
+typedef struct reclaim_entry {
+    inode_t inode;
+    struct reclaim_entry *next;
+} reclaim_entry_t;
+
+static reclaim_entry_t *reclaim_queue;
+static int reclaim_pending;
+/* number of batches reclaimed so far */
+static unsigned long reclaim_generation;
+static bool reclaim_stop;
+static pthread_t reclaim_tid;
+static pthread_mutex_t reclaim_mutex;
+static pthread_cond_t reclaim_cond;
+static pthread_cond_t reclaim_done_cond;
+
+static void *reclaim_worker(void *args);
+
+/* Snapshots of the whole file system. Taking one only stamps it with a new
+ * generation: an i-node is saved into the snapshots that don't have it yet
+ * right before it is first changed (see inode_save), and until then they see
+ * the live i-node. Saved files share their data blocks with the live ones,
+ * which copy them on write */
+typedef struct {
+    bool taken;
+    unsigned long generation;
+    /* an i-node was saved into the snapshot if its entry here matches the
+     * snapshot's generation */
+    unsigned long saved[INODE_TABLE_SIZE];
+    inode_t inodes[INODE_TABLE_SIZE];
+    /* number of snapshot file handles open in it */
+    int open_files;
+} snapshot_t;
+
+static snapshot_t snapshots[MAX_SNAPSHOTS];
+static unsigned long snapshot_generation;
+static pthread_rwlock_t snapshots_rwl;
+
+static int inode_save(int inumber);
 
 /* Volatile FS state */
 
@@ -30,6 +79,19 @@ static char free_open_file_entries[MAX_OPEN_FILES];
 static pthread_mutex_t free_open_file_entries_mutex;
 static pthread_cond_t files_opened_cond;
 
+/* Files open in snapshots, which have handles of their own (that can only
+ * be read from) */
+typedef struct {
+    int sf_snapshot; /* -1 if the entry is free */
+    int sf_inumber;
+    size_t sf_offset;
+    pthread_mutex_t lock;
+} snapshot_file_entry_t;
+
+static snapshot_file_entry_t snapshot_file_table[MAX_OPEN_FILES];
+static char free_snapshot_file_entries[MAX_OPEN_FILES];
+static pthread_mutex_t snapshot_files_mutex;
+
 static inline bool valid_inumber(int inumber) {
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
@@ -42,6 +104,10 @@ static inline bool valid_file_handle(int file_handle) {
     return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
 }
 
+static inline bool valid_snapshot(int snapshot) {
+    return snapshot >= 0 && snapshot < MAX_SNAPSHOTS;
+}
+
 /**
  * We need to defeat the optimizer for the insert_delay() function.
  * Under optimization, the empty loop would be completely optimized away.
@@ -80,16 +146,49 @@ void state_init() {
     rwl_init(&freeinode_ts_rwl);
 
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+        block_refs[i] = 0;
+        fragment_maps[i] = 0;
+        fragment_refs[i] = 0;
+    }
+    rwl_init(&block_refs_rwl);
+    mutex_init(&fragments_mutex);
+
+    reclaim_queue = NULL;
+    reclaim_pending = 0;
+    reclaim_generation = 0;
+    reclaim_stop = false;
+    mutex_init(&reclaim_mutex);
+    if (pthread_cond_init(&reclaim_cond, NULL) != 0 ||
+        pthread_cond_init(&reclaim_done_cond, NULL) != 0) {
+        perror("Failed to init condition variable");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&reclaim_tid, NULL, reclaim_worker, NULL) != 0) {
+        perror("Failed to create reclaimer thread");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < MAX_SNAPSHOTS; i++) {
+        snapshots[i].taken = false;
+        snapshots[i].generation = 0;
+        for (size_t j = 0; j < INODE_TABLE_SIZE; j++) {
+            snapshots[i].saved[j] = 0;
+        }
+        snapshots[i].open_files = 0;
     }
-    rwl_init(&free_blocks_rwl);
+    snapshot_generation = 0;
+    rwl_init(&snapshots_rwl);
 
     for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
         mutex_init(&open_file_table[i].lock);
         free_open_file_entries[i] = FREE;
+        mutex_init(&snapshot_file_table[i].lock);
+        snapshot_file_table[i].sf_snapshot = -1;
+        free_snapshot_file_entries[i] = FREE;
     }
 
     mutex_init(&free_open_file_entries_mutex);
+    mutex_init(&snapshot_files_mutex);
 
     if (pthread_cond_init(&files_opened_cond, NULL) != 0) {
         perror("Failed to init condition variable");
@@ -101,6 +200,22 @@ void state_init() {
  * Destroys FS state
  */
 void state_destroy() {
+    /* let the reclaimer thread free what is still pending, and stop it */
+    mutex_lock(&reclaim_mutex);
+    reclaim_stop = true;
+    pthread_cond_signal(&reclaim_cond);
+    mutex_unlock(&reclaim_mutex);
+    if (pthread_join(reclaim_tid, NULL) != 0) {
+        perror("Failed to join reclaimer thread");
+        exit(EXIT_FAILURE);
+    }
+    mutex_destroy(&reclaim_mutex);
+    if (pthread_cond_destroy(&reclaim_cond) != 0 ||
+        pthread_cond_destroy(&reclaim_done_cond) != 0) {
+        perror("Failed to destroy condition variable");
+        exit(EXIT_FAILURE);
+    }
+
     /* destroy all locks (rwlock and mutex) */
     for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
         rwl_destroy(&inode_locks[i]);
@@ -108,12 +223,16 @@ void state_destroy() {
 
     rwl_destroy(&freeinode_ts_rwl);
 
-    rwl_destroy(&free_blocks_rwl);
+    rwl_destroy(&block_refs_rwl);
+    mutex_destroy(&fragments_mutex);
+    rwl_destroy(&snapshots_rwl);
 
     for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
         mutex_destroy(&open_file_table[i].lock);
+        mutex_destroy(&snapshot_file_table[i].lock);
     }
     mutex_destroy(&free_open_file_entries_mutex);
+    mutex_destroy(&snapshot_files_mutex);
 
     if (pthread_cond_destroy(&files_opened_cond) != 0) {
         perror("Failed to destroy condition variable");
@@ -162,12 +281,13 @@ int inode_create(inode_type n_type) {
                     return -1;
                 }
 
+                inode_table[inumber].i_storage = I_BLOCKS;
                 inode_table[inumber].i_size = BLOCK_SIZE;
                 /* For simplificaion, a directory will only use the first entry
                  * of the array of data_blocks */
                 inode_table[inumber].i_data_blocks[0] = directory_block_number;
                 for (int i = 1; i < INODE_DIRECT_BLOCK_SIZE; i++) {
-                    inode_table[inumber].i_data_blocks[i] = -1;
+                    inode_table[inumber].i_data_blocks[i] = INODE_HOLE;
                 }
 
                 dir_entry_t *dir_entry =
@@ -182,11 +302,15 @@ int inode_create(inode_type n_type) {
                     dir_entry[i].d_inumber = -1;
                 }
             } else {
-                /* In case of a new file, simply sets its size to 0 */
+                /* In case of a new file, simply sets its size to 0 (it starts
+                 * out with its contents stored inline) */
+                inode_table[inumber].i_storage = I_INLINE;
                 inode_table[inumber].i_size = 0;
+                inode_table[inumber].i_fragment = -1;
+                inode_table[inumber].i_fragment_count = 0;
 
                 for (int i = 0; i < INODE_DIRECT_BLOCK_SIZE; i++) {
-                    inode_table[inumber].i_data_blocks[i] = -1;
+                    inode_table[inumber].i_data_blocks[i] = INODE_HOLE;
                 }
             }
 
@@ -219,10 +343,15 @@ int inode_delete(int inumber) {
         return -1;
     }
     rwl_wrlock(&inode_locks[inumber]);
+    if (inode_save(inumber) == -1) {
+        rwl_unlock(&inode_locks[inumber]);
+        rwl_unlock(&freeinode_ts_rwl);
+        return -1;
+    }
 
     freeinode_ts[inumber] = FREE;
     inode_t *inode = &inode_table[inumber];
-    if (inode_delete_data_blocks(inode) < 0) {
+    if (inode_detach_data_blocks(inode) < 0) {
         rwl_unlock(&inode_locks[inumber]);
         rwl_unlock(&freeinode_ts_rwl);
         return -1;
@@ -237,6 +366,8 @@ int inode_delete(int inumber) {
 /*
  * Deletes all allocated blocks in i-node.
  * Similar to inode_delete, but does not free the inode.
+ * The blocks themselves are freed in the background (see
+ * inode_detach_data_blocks).
  * Input:
  *  - inumber: i-node's number
  * Returns: 0 if successful, -1 if failed
@@ -259,7 +390,7 @@ int inode_truncate(int inumber) {
     rwl_wrlock(&inode_locks[inumber]);
 
     inode_t *inode = &inode_table[inumber];
-    if (inode_delete_data_blocks(inode) < 0) {
+    if (inode_save(inumber) == -1 || inode_detach_data_blocks(inode) < 0) {
         rwl_unlock(&inode_locks[inumber]);
         rwl_unlock(&freeinode_ts_rwl);
         return -1;
@@ -279,28 +410,35 @@ int inode_truncate(int inumber) {
  * Returns: 0 if successful, -1 if failed
  */
 int inode_delete_data_blocks(inode_t *inode) {
-    size_t remaining_size = inode->i_size;
-    if (remaining_size == 0) {
-        return 0;
+    if (inode->i_storage == I_FRAGMENT) {
+        if (fragment_free(inode->i_fragment, inode->i_fragment_count) == -1) {
+            return -1;
+        }
+        inode->i_fragment = -1;
+        inode->i_fragment_count = 0;
     }
-    int current_block_i = (int)(remaining_size / BLOCK_SIZE);
-    while (current_block_i >= 0) {
+
+    int current_block_i =
+        (int)((inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE) - 1;
+    while (inode->i_storage == I_BLOCKS && current_block_i >= 0) {
         int i_data_block =
             inode_get_block_number_at_index(inode, current_block_i);
-        if (i_data_block == -1) {
-            return -1;
+        /* holes have no data block to free */
+        if (i_data_block == INODE_HOLE) {
+            --current_block_i;
+            continue;
         }
         if (data_block_free(i_data_block) == -1) {
             return -1;
         }
-        /* if direct block, make sure to set it to -1 on the inode */
+        /* if direct block, make sure to turn it into a hole on the inode */
         if (current_block_i < INODE_DIRECT_BLOCK_SIZE &&
-            inode_set_block_number_at_index(inode, current_block_i, -1) == -1) {
+            inode_set_block_number_at_index(inode, current_block_i,
+                                            INODE_HOLE) == -1) {
             return -1;
         }
 
         --current_block_i;
-        remaining_size -= BLOCK_SIZE;
     }
     if (inode->i_indirect_block != -1) {
         if (data_block_free(inode->i_indirect_block) == -1) {
@@ -309,6 +447,243 @@ int inode_delete_data_blocks(inode_t *inode) {
         inode->i_indirect_block = -1;
     }
     inode->i_size = 0;
+    /* an empty file goes back to having its contents stored inline */
+    if (inode->i_node_type == T_FILE) {
+        inode->i_storage = I_INLINE;
+    }
+
+    return 0;
+}
+
+/*
+ * Empties an i-node by detaching its block map and handing it to the
+ * reclaimer thread, so that the blocks are freed in the background instead of
+ * one at a time while the i-node (and possibly the i-node table) is locked.
+ * Small i-nodes have at most one run of fragments, so they are emptied right
+ * away. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_detach_data_blocks(inode_t *inode) {
+    if (inode->i_storage != I_BLOCKS || inode->i_size == 0) {
+        return inode_delete_data_blocks(inode);
+    }
+
+    reclaim_entry_t *entry = (reclaim_entry_t *)malloc(sizeof(reclaim_entry_t));
+    if (entry == NULL) {
+        /* no memory to defer it, so free the blocks right away */
+        return inode_delete_data_blocks(inode);
+    }
+    entry->inode = *inode;
+
+    for (int i = 0; i < INODE_DIRECT_BLOCK_SIZE; i++) {
+        inode->i_data_blocks[i] = INODE_HOLE;
+    }
+    inode->i_indirect_block = -1;
+    inode->i_size = 0;
+    if (inode->i_node_type == T_FILE) {
+        inode->i_storage = I_INLINE;
+    }
+
+    mutex_lock(&reclaim_mutex);
+    entry->next = reclaim_queue;
+    reclaim_queue = entry;
+    reclaim_pending++;
+    pthread_cond_signal(&reclaim_cond);
+    mutex_unlock(&reclaim_mutex);
+
+    return 0;
+}
+
+/*
+ * Frees every block of a block map detached by inode_detach_data_blocks,
+ * returning them to the allocator in a single batch.
+ * Input:
+ *  - inode: a pointer to the detached copy of the inode
+ */
+static void reclaim_data_blocks(inode_t *inode) {
+    int blocks[INODE_BLOCK_COUNT + 1];
+    int count = 0;
+
+    int block_count = (int)((inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (int i = 0; i < block_count; i++) {
+        int block_number = inode_get_block_number_at_index(inode, i);
+        if (block_number != INODE_HOLE) {
+            blocks[count++] = block_number;
+        }
+    }
+    if (inode->i_indirect_block != -1) {
+        blocks[count++] = inode->i_indirect_block;
+    }
+
+    data_blocks_free(blocks, count);
+}
+
+/*
+ * The reclaimer thread main function: frees the blocks of the detached block
+ * maps, a batch at a time, until the FS state is destroyed.
+ */
+static void *reclaim_worker(void *args) {
+    (void)args;
+    mutex_lock(&reclaim_mutex);
+    while (true) {
+        while (reclaim_queue == NULL && !reclaim_stop) {
+            pthread_cond_wait(&reclaim_cond, &reclaim_mutex);
+        }
+        if (reclaim_queue == NULL) {
+            break;
+        }
+
+        /* take the whole queue, so that others can keep adding to it */
+        reclaim_entry_t *batch = reclaim_queue;
+        reclaim_queue = NULL;
+        mutex_unlock(&reclaim_mutex);
+
+        int reclaimed = 0;
+        while (batch != NULL) {
+            reclaim_entry_t *next = batch->next;
+            reclaim_data_blocks(&batch->inode);
+            free(batch);
+            batch = next;
+            ++reclaimed;
+        }
+
+        mutex_lock(&reclaim_mutex);
+        reclaim_pending -= reclaimed;
+        reclaim_generation++;
+        pthread_cond_broadcast(&reclaim_done_cond);
+    }
+    mutex_unlock(&reclaim_mutex);
+    return NULL;
+}
+
+/*
+ * Returns the number of batches reclaimed so far, to be later given to
+ * wait_for_reclaimed_blocks.
+ */
+static unsigned long get_reclaim_generation() {
+    mutex_lock(&reclaim_mutex);
+    unsigned long generation = reclaim_generation;
+    mutex_unlock(&reclaim_mutex);
+    return generation;
+}
+
+/*
+ * Waits until every detached block map has been freed.
+ * Input:
+ *  - generation: value of get_reclaim_generation before the failed
+ *  allocation, so that blocks reclaimed since then are not missed
+ * Returns: true if there was something to wait for (or blocks were reclaimed
+ * in the meantime), false otherwise
+ */
+static bool wait_for_reclaimed_blocks(unsigned long generation) {
+    mutex_lock(&reclaim_mutex);
+    bool waited = reclaim_pending > 0 || reclaim_generation != generation;
+    while (reclaim_pending > 0) {
+        pthread_cond_wait(&reclaim_done_cond, &reclaim_mutex);
+    }
+    mutex_unlock(&reclaim_mutex);
+    return waited;
+}
+
+/*
+ * Returns a pointer to the contents of a small i-node (one whose contents are
+ * stored inline or in a run of fragments).
+ * Input:
+ *  - inode: a pointer to the inode
+ * Returns: pointer if successful, NULL if failed
+ */
+static char *inode_small_data_get(inode_t *inode) {
+    if (inode->i_storage == I_INLINE) {
+        return inode->i_inline_data;
+    }
+    if (inode->i_storage == I_FRAGMENT) {
+        return fragment_get(inode->i_fragment);
+    }
+    return NULL;
+}
+
+/*
+ * Makes sure a small i-node has room for 'size' bytes, growing its run of
+ * fragments (or moving its contents to a new one) if needed. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ *  - size: number of bytes needed (at most MAX_FRAGMENTED_FILE_SIZE)
+ * Returns: pointer to the contents if successful, NULL if failed
+ */
+static char *inode_small_data_reserve(inode_t *inode, size_t size) {
+    int count = (int)((size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE);
+
+    if (inode->i_storage == I_INLINE && size <= INODE_INLINE_DATA_SIZE) {
+        return inode->i_inline_data;
+    }
+    if (inode->i_storage == I_FRAGMENT) {
+        if (count <= inode->i_fragment_count) {
+            return fragment_get(inode->i_fragment);
+        }
+        if (fragment_extend(inode->i_fragment, inode->i_fragment_count,
+                            count) == 0) {
+            inode->i_fragment_count = count;
+            return fragment_get(inode->i_fragment);
+        }
+    }
+
+    /* Move the contents to a new run of fragments */
+    int fragment = fragment_alloc(count);
+    if (fragment == -1) {
+        return NULL;
+    }
+    char *data = fragment_get(fragment);
+    char *old_data = inode_small_data_get(inode);
+    if (data == NULL || old_data == NULL) {
+        fragment_free(fragment, count);
+        return NULL;
+    }
+    memcpy(data, old_data, inode->i_size);
+
+    if (inode->i_storage == I_FRAGMENT) {
+        /* we already moved the contents, ignore error of fragment_free */
+        fragment_free(inode->i_fragment, inode->i_fragment_count);
+    }
+    inode->i_storage = I_FRAGMENT;
+    inode->i_fragment = fragment;
+    inode->i_fragment_count = count;
+
+    return data;
+}
+
+/*
+ * Moves the contents of a small i-node to a data block, so that it can grow
+ * past MAX_FRAGMENTED_FILE_SIZE. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ * Returns: 0 if successful, -1 if failed
+ */
+static int inode_spill_small_data(inode_t *inode) {
+    if (inode->i_size > 0) {
+        int block_number = data_block_alloc();
+        if (block_number == -1) {
+            return -1;
+        }
+        char *block = data_block_get(block_number);
+        char *data = inode_small_data_get(inode);
+        if (block == NULL || data == NULL) {
+            data_block_free(block_number);
+            return -1;
+        }
+        memcpy(block, data, inode->i_size);
+        memset(block + inode->i_size, 0, BLOCK_SIZE - inode->i_size);
+        inode->i_data_blocks[0] = block_number;
+    }
+
+    if (inode->i_storage == I_FRAGMENT) {
+        /* the contents were already moved, ignore error of fragment_free */
+        fragment_free(inode->i_fragment, inode->i_fragment_count);
+        inode->i_fragment = -1;
+        inode->i_fragment_count = 0;
+    }
+    inode->i_storage = I_BLOCKS;
 
     return 0;
 }
@@ -328,6 +703,41 @@ inode_t *inode_get(int inumber) {
     return &inode_table[inumber];
 }
 
+/*
+ * Gives an i-node its own copy of a data block it shares with others (see
+ * inode_copy), so that it can be changed. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ *  - index: index of the block in the inode
+ *  - block_number: the shared block
+ *  - copy: whether the contents of the block must be copied (they needn't
+ *    be if the caller overwrites all of them)
+ * Returns: number of the new block if successful, -1 otherwise
+ */
+static int inode_unshare_block(inode_t *inode, int index, int block_number,
+                               bool copy) {
+    int new_block_number = data_block_alloc();
+    if (new_block_number == -1) {
+        return -1;
+    }
+    char *block = data_block_get(new_block_number);
+    char *old_block = data_block_get(block_number);
+    if (block == NULL || old_block == NULL ||
+        inode_set_block_number_at_index(inode, index, new_block_number) ==
+            -1) {
+        data_block_free(new_block_number);
+        return -1;
+    }
+    if (copy) {
+        memcpy(block, old_block, BLOCK_SIZE);
+    }
+
+    /* only let go of the old block once it was copied, as whoever else
+     * shares it may write to it in place as soon as it is no longer shared */
+    data_block_free(block_number);
+    return new_block_number;
+}
+
 /*
  * Writes to the data blocks of the i-node
  * Input:
@@ -353,15 +763,50 @@ ssize_t inode_write(int fhandle, void const *buffer, size_t to_write) {
         return -1;
     }
     rwl_wrlock(&inode_locks[inumber]);
+    if (inode_save(inumber) == -1) {
+        rwl_unlock(&inode_locks[inumber]);
+        mutex_unlock(&file->lock);
+        return -1;
+    }
 
-    /* Make sure offset is not out of bounds */
-    if (file->of_offset > inode->i_size) {
-        file->of_offset = inode->i_size;
+    /* Determine how many bytes to write (the offset may be past the end of
+     * the file, in which case the gap is left as a hole) */
+    if (file->of_offset >= MAX_FILE_SIZE) {
+        to_write = 0;
+    } else if (to_write > MAX_FILE_SIZE - file->of_offset) {
+        to_write = MAX_FILE_SIZE - file->of_offset;
     }
 
-    /* Determine how many bytes to write */
-    if (to_write + file->of_offset > BLOCK_SIZE * INODE_BLOCK_COUNT) {
-        to_write = BLOCK_SIZE * INODE_BLOCK_COUNT - file->of_offset;
+    if (inode->i_storage != I_BLOCKS && to_write > 0) {
+        if (file->of_offset + to_write <= MAX_FRAGMENTED_FILE_SIZE) {
+            /* The file is still small enough to be kept inline or in a run
+             * of fragments */
+            char *data =
+                inode_small_data_reserve(inode, file->of_offset + to_write);
+            if (data == NULL) {
+                rwl_unlock(&inode_locks[inumber]);
+                mutex_unlock(&file->lock);
+                return -1;
+            }
+            if (file->of_offset > inode->i_size) {
+                memset(data + inode->i_size, 0,
+                       file->of_offset - inode->i_size);
+            }
+            memcpy(data + file->of_offset, buffer, to_write);
+            file->of_offset += to_write;
+            if (file->of_offset > inode->i_size) {
+                inode->i_size = file->of_offset;
+            }
+
+            rwl_unlock(&inode_locks[inumber]);
+            mutex_unlock(&file->lock);
+            return (ssize_t)to_write;
+        }
+        if (inode_spill_small_data(inode) == -1) {
+            rwl_unlock(&inode_locks[inumber]);
+            mutex_unlock(&file->lock);
+            return -1;
+        }
     }
 
     int current_block_i = (int)(file->of_offset / BLOCK_SIZE);
@@ -376,33 +821,51 @@ ssize_t inode_write(int fhandle, void const *buffer, size_t to_write) {
             to_write_block = to_write;
         }
 
-        /* If offset out of bonds of file size, allocate new block */
-        if (inode->i_size <= current_block_i * BLOCK_SIZE) {
-            int new_block = data_block_alloc();
-            if (new_block < 0) {
+        int block_number =
+            inode_get_block_number_at_index(inode, current_block_i);
+        /* If the block is a hole (or past the end of the file), allocate a
+         * new block */
+        bool new_block = block_number == INODE_HOLE;
+        if (!new_block && data_block_is_shared(block_number)) {
+            /* copy on write */
+            block_number = inode_unshare_block(
+                inode, current_block_i, block_number,
+                to_write_block < BLOCK_SIZE);
+            if (block_number == -1) {
+                rwl_unlock(&inode_locks[inumber]);
+                mutex_unlock(&file->lock);
+                return -1;
+            }
+        } else if (new_block) {
+            block_number = data_block_alloc();
+            if (block_number < 0) {
                 /* If it gets an error to alloc block */
                 rwl_unlock(&inode_locks[inumber]);
                 mutex_unlock(&file->lock);
                 return -1;
             }
             if (inode_set_block_number_at_index(inode, current_block_i,
-                                                new_block) < 0) {
+                                                block_number) < 0) {
                 /* we're gonna return -1 anyway, ignore error of data_block_free
                  */
-                data_block_free(new_block);
+                data_block_free(block_number);
                 rwl_unlock(&inode_locks[inumber]);
                 mutex_unlock(&file->lock);
                 return -1;
             }
         }
         /* Get block to write to */
-        void *block = data_block_get(
-            inode_get_block_number_at_index(inode, current_block_i));
+        void *block = data_block_get(block_number);
         if (block == NULL) {
             rwl_unlock(&inode_locks[inumber]);
             mutex_unlock(&file->lock);
             return -1;
         }
+        /* The parts of a new block that this write does not cover were part
+         * of a hole, so they must read back as zeros */
+        if (new_block && to_write_block < BLOCK_SIZE) {
+            memset(block, 0, BLOCK_SIZE);
+        }
 
         /* Perform the actual write */
         memcpy(block + (file->of_offset % BLOCK_SIZE),
@@ -423,6 +886,74 @@ ssize_t inode_write(int fhandle, void const *buffer, size_t to_write) {
     return (ssize_t)written;
 }
 
+/* Copies the data of an i-node, starting at an offset, to the buffer. The
+ * caller must hold the lock of the i-node (at least for reading)
+ * Input:
+ *  - i-node and its i-number
+ *  - offset where to start reading
+ *  - destination buffer
+ *  - length of the buffer
+ *  Returns the number of bytes that were copied (can be lower than 'len' if
+ *  the file size was reached), or -1 in case of error
+ */
+static ssize_t inode_read_data(inode_t *inode, size_t offset, void *buffer,
+                               size_t len) {
+    /* Determine how many bytes to read (none if the offset is past the end
+     * of the file) */
+    size_t to_read = 0;
+    if (offset < inode->i_size) {
+        to_read = inode->i_size - offset;
+    }
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    if (inode->i_storage != I_BLOCKS) {
+        if (to_read > 0) {
+            char *data = inode_small_data_get(inode);
+            if (data == NULL) {
+                return -1;
+            }
+            memcpy(buffer, data + offset, to_read);
+        }
+        return (ssize_t)to_read;
+    }
+
+    int current_block_i = (int)(offset / BLOCK_SIZE);
+
+    size_t read = to_read;
+
+    while (to_read > 0) {
+        size_t to_read_block = BLOCK_SIZE - (offset % BLOCK_SIZE);
+        /* if remaining to_read does not need the whole block */
+        if (to_read_block > to_read) {
+            to_read_block = to_read;
+        }
+
+        int block_number =
+            inode_get_block_number_at_index(inode, current_block_i);
+        if (block_number == INODE_HOLE) {
+            /* Holes read back as zeros, without touching the data blocks */
+            memset(buffer + sizeof(char) * (read - to_read), 0,
+                   to_read_block);
+        } else {
+            void *block = data_block_get(block_number);
+            if (block == NULL) {
+                return -1;
+            }
+
+            /* Perform the actual read */
+            memcpy(buffer + sizeof(char) * (read - to_read),
+                   block + (offset % BLOCK_SIZE), to_read_block);
+        }
+
+        offset += to_read_block;
+        ++current_block_i;
+        to_read -= to_read_block;
+    }
+    return (ssize_t)read;
+}
+
 /* Reads the data of the i-node to the buffer
  * Input:
  *  - file handle (obtained from a previous call to tfs_open)
@@ -448,88 +979,532 @@ ssize_t inode_read(int fhandle, void *buffer, size_t len) {
     }
     rwl_rdlock(&inode_locks[inumber]);
 
-    /* Make sure offset is not out of bounds */
-    /* For consistency with inode_write, even though is won't affect reads,
-     * the file offset is still changed */
-    if (file->of_offset > inode->i_size) {
-        file->of_offset = inode->i_size;
-    }
-
-    /* Determine how many bytes to read */
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
+    ssize_t read = inode_read_data(inode, file->of_offset, buffer, len);
+    /* The offset associated with the file handle is incremented
+     * accordingly */
+    if (read > 0) {
+        file->of_offset += (size_t)read;
     }
 
-    int current_block_i = (int)(file->of_offset / BLOCK_SIZE);
-
-    size_t read = to_read;
-
-    while (to_read > 0) {
-        size_t to_read_block = BLOCK_SIZE - (file->of_offset % BLOCK_SIZE);
-        /* if remaining to_read does not need the whole block */
-        if (to_read_block > to_read) {
-            to_read_block = to_read;
-        }
-
-        void *block = data_block_get(
-            inode_get_block_number_at_index(inode, current_block_i));
-        if (block == NULL) {
-            rwl_unlock(&inode_locks[inumber]);
-            mutex_unlock(&file->lock);
-            return -1;
-        }
-
-        /* Perform the actual read */
-        memcpy(buffer + sizeof(char) * (read - to_read),
-               block + (file->of_offset % BLOCK_SIZE), to_read_block);
-
-        /* The offset associated with the file handle is
-         * incremented accordingly */
-        file->of_offset += to_read_block;
-
-        ++current_block_i;
-        to_read -= to_read_block;
-    }
     rwl_unlock(&inode_locks[inumber]);
     mutex_unlock(&file->lock);
-    return (ssize_t)read;
+    return read;
 }
 
-/*
- * Adds an entry to the i-node directory data.
- * Input:
- *  - inumber: identifier of the i-node
- *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry
- * Returns: SUCCESS or FAIL
+/* Same as inode_read, but reads from the given offset, leaving the offset
+ * of the file handle untouched
  */
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
-    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
+ssize_t inode_pread(int fhandle, void *buffer, size_t len, size_t offset) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
         return -1;
     }
+    mutex_lock(&file->lock);
 
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
+    int inumber = file->of_inumber;
+    inode_t *inode = inode_get(inumber);
+    if (inode == NULL) {
+        mutex_unlock(&file->lock);
         return -1;
     }
+    rwl_rdlock(&inode_locks[inumber]);
 
-    if (strlen(sub_name) == 0) {
-        return -1;
-    }
+    ssize_t read = inode_read_data(inode, offset, buffer, len);
 
-    inode_t *inode = &inode_table[inumber];
-    rwl_wrlock(&inode_locks[inumber]);
+    rwl_unlock(&inode_locks[inumber]);
+    mutex_unlock(&file->lock);
+    return read;
+}
 
-    /* Locates the block containing the directory's entries */
-    // Directories only occupy one block at the moment, so get the first block
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode->i_data_blocks[0]);
-    if (dir_entry == NULL) {
-        rwl_unlock(&inode_locks[inumber]);
+/* Returns the i-number of the file of an open file handle, or -1 if the
+ * handle isn't valid
+ */
+int inode_of_handle(int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
         return -1;
     }
-
+    mutex_lock(&file->lock);
+    int inumber = file->of_inumber;
+    mutex_unlock(&file->lock);
+    return inumber;
+}
+
+/* Changes the offset of an open file
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - offset, relative to whence
+ *  - whence: SEEK_SET, SEEK_CUR or SEEK_END
+ *  Returns the resulting offset (which may be past the end of the file, up
+ *  to MAX_FILE_SIZE), or -1 in case of error
+ */
+off_t inode_seek(int fhandle, off_t offset, int whence) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    mutex_lock(&file->lock);
+
+    int inumber = file->of_inumber;
+    inode_t *inode = inode_get(inumber);
+    if (inode == NULL) {
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    off_t base;
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (off_t)file->of_offset;
+        break;
+    case SEEK_END:
+        rwl_rdlock(&inode_locks[inumber]);
+        base = (off_t)inode->i_size;
+        rwl_unlock(&inode_locks[inumber]);
+        break;
+    default:
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    if (offset < -base || base + offset > (off_t)MAX_FILE_SIZE) {
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    file->of_offset = (size_t)(base + offset);
+    mutex_unlock(&file->lock);
+    return base + offset;
+}
+
+/*
+ * Makes sure an i-node has an indirect block, allocating one (with every entry
+ * set to a hole) if needed. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ * Returns: pointer to the indirect block if successful, NULL otherwise
+ */
+static int *inode_indirect_block_get(inode_t *inode) {
+    int *block = data_block_get(inode->i_indirect_block);
+    if (block != NULL) {
+        return block;
+    }
+
+    int indirect_block_number = data_block_alloc();
+    if (indirect_block_number == -1) {
+        return NULL;
+    }
+    inode->i_indirect_block = indirect_block_number;
+    block = data_block_get(indirect_block_number);
+    if (block == NULL) {
+        return NULL;
+    }
+    /* every entry of a new indirect block starts as a hole */
+    for (int i = 0; i < BLOCK_SIZE / sizeof(int); i++) {
+        block[i] = INODE_HOLE;
+    }
+    return block;
+}
+
+/*
+ * Shrinks an i-node to 'length' bytes, freeing the blocks past the new end of
+ * the file. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ *  - length: new size, larger than 0 and smaller than the current one
+ * Returns: 0 if successful, -1 if failed
+ */
+static int inode_shrink(inode_t *inode, size_t length) {
+    if (inode->i_storage != I_BLOCKS) {
+        inode->i_size = length;
+        return 0;
+    }
+
+    int freed[INODE_BLOCK_COUNT + 1];
+    int count = 0;
+
+    int kept_block_count = (int)((length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    /* the rest of the last block is zeroed below, so it can't be shared */
+    if (length % BLOCK_SIZE != 0) {
+        int last = kept_block_count - 1;
+        int block_number = inode_get_block_number_at_index(inode, last);
+        if (block_number != INODE_HOLE && data_block_is_shared(block_number) &&
+            inode_unshare_block(inode, last, block_number, true) == -1) {
+            return -1;
+        }
+    }
+    int block_count = (int)((inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (int i = kept_block_count; i < block_count; i++) {
+        int block_number = inode_get_block_number_at_index(inode, i);
+        if (block_number == INODE_HOLE) {
+            continue;
+        }
+        if (inode_set_block_number_at_index(inode, i, INODE_HOLE) == -1) {
+            return -1;
+        }
+        freed[count++] = block_number;
+    }
+    if (kept_block_count <= INODE_DIRECT_BLOCK_SIZE &&
+        inode->i_indirect_block != -1) {
+        freed[count++] = inode->i_indirect_block;
+        inode->i_indirect_block = -1;
+    }
+
+    /* the rest of the last block must read back as zeros if the file grows
+     * again */
+    if (length % BLOCK_SIZE != 0) {
+        char *block = data_block_get(
+            inode_get_block_number_at_index(inode, kept_block_count - 1));
+        if (block != NULL) {
+            memset(block + length % BLOCK_SIZE, 0,
+                   BLOCK_SIZE - length % BLOCK_SIZE);
+        }
+    }
+
+    data_blocks_free(freed, count);
+    inode->i_size = length;
+    return 0;
+}
+
+/*
+ * Grows an i-node to 'length' bytes. The new bytes read back as zeros: in
+ * small i-nodes they are zeroed, otherwise they are left as a hole.
+ * NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ *  - length: new size, at least as large as the current one
+ * Returns: 0 if successful, -1 if failed
+ */
+static int inode_grow(inode_t *inode, size_t length) {
+    if (inode->i_storage != I_BLOCKS) {
+        if (length <= MAX_FRAGMENTED_FILE_SIZE) {
+            char *data = inode_small_data_reserve(inode, length);
+            if (data == NULL) {
+                return -1;
+            }
+            memset(data + inode->i_size, 0, length - inode->i_size);
+            inode->i_size = length;
+            return 0;
+        }
+        if (inode_spill_small_data(inode) == -1) {
+            return -1;
+        }
+    }
+
+    inode->i_size = length;
+    return 0;
+}
+
+/*
+ * Allocates a (zeroed) block for every hole of an i-node between two block
+ * indexes, and a copy of every block there that it shares with other i-nodes
+ * (see inode_copy), in a single pass over the allocation table and, whenever
+ * possible, as a run of consecutive blocks. NOT thread safe.
+ * Input:
+ *  - inode: a pointer to the inode
+ *  - first, last: indexes of the first and last blocks (inclusive)
+ * Returns: 0 if successful, -1 if failed
+ */
+static int inode_alloc_blocks(inode_t *inode, int first, int last) {
+    /* allocate the indirect block first, so that it doesn't end up in the
+     * middle of the run of data blocks */
+    if (last >= INODE_DIRECT_BLOCK_SIZE &&
+        inode_indirect_block_get(inode) == NULL) {
+        return -1;
+    }
+
+    /* shared blocks are copied now, so that writes to the range don't have
+     * to copy them on write */
+    int indexes[INODE_BLOCK_COUNT];
+    int count = 0;
+    for (int i = first; i <= last; i++) {
+        int block_number = inode_get_block_number_at_index(inode, i);
+        if (block_number == INODE_HOLE || data_block_is_shared(block_number)) {
+            indexes[count++] = i;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    int blocks[INODE_BLOCK_COUNT];
+    if (data_blocks_alloc(count, blocks) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int old_block_number =
+            inode_get_block_number_at_index(inode, indexes[i]);
+        char *block = data_block_get(blocks[i]);
+        char *old_block = old_block_number == INODE_HOLE
+                              ? NULL
+                              : data_block_get(old_block_number);
+        if (block != NULL && old_block != NULL) {
+            memcpy(block, old_block, BLOCK_SIZE);
+        } else if (block != NULL) {
+            memset(block, 0, BLOCK_SIZE);
+        }
+        /* can't fail, since the indirect block (if needed) already exists */
+        inode_set_block_number_at_index(inode, indexes[i], blocks[i]);
+        /* only let go of the shared block once it was copied (see
+         * inode_unshare_block) */
+        if (old_block_number != INODE_HOLE) {
+            data_block_free(old_block_number);
+        }
+    }
+    return 0;
+}
+
+/* Changes the size of an open file
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - new size of the file (at most MAX_FILE_SIZE)
+ *  Returns 0 if successful, -1 otherwise.
+ */
+int inode_ftruncate(int fhandle, size_t length) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || length > MAX_FILE_SIZE) {
+        return -1;
+    }
+    mutex_lock(&file->lock);
+
+    int inumber = file->of_inumber;
+    inode_t *inode = inode_get(inumber);
+    if (inode == NULL) {
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+    rwl_wrlock(&inode_locks[inumber]);
+    if (inode_save(inumber) == -1) {
+        rwl_unlock(&inode_locks[inumber]);
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    int result;
+    if (length == 0) {
+        result = inode_detach_data_blocks(inode);
+    } else if (length < inode->i_size) {
+        result = inode_shrink(inode, length);
+    } else {
+        result = inode_grow(inode, length);
+    }
+
+    rwl_unlock(&inode_locks[inumber]);
+    mutex_unlock(&file->lock);
+    return result;
+}
+
+/* Preallocates storage for a range of an open file, so that later writes to
+ * it don't have to allocate blocks. The file grows to include the range if
+ * needed, and the preallocated bytes read back as zeros.
+ * Input:
+ *  - file handle (obtained from a previous call to tfs_open)
+ *  - offset and length (larger than 0) of the range
+ *  Returns 0 if successful, -1 otherwise.
+ */
+int inode_fallocate(int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || len == 0 || len > MAX_FILE_SIZE ||
+        offset > MAX_FILE_SIZE - len) {
+        return -1;
+    }
+    mutex_lock(&file->lock);
+
+    int inumber = file->of_inumber;
+    inode_t *inode = inode_get(inumber);
+    if (inode == NULL) {
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+    rwl_wrlock(&inode_locks[inumber]);
+    if (inode_save(inumber) == -1) {
+        rwl_unlock(&inode_locks[inumber]);
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    size_t end = offset + len;
+    int result = 0;
+    if (inode->i_storage != I_BLOCKS && end <= MAX_FRAGMENTED_FILE_SIZE) {
+        /* small files are preallocated by reserving their fragments */
+        if (end > inode->i_size) {
+            result = inode_grow(inode, end);
+        }
+    } else {
+        if (inode->i_storage != I_BLOCKS) {
+            result = inode_spill_small_data(inode);
+        }
+        if (result == 0) {
+            result = inode_alloc_blocks(inode, (int)(offset / BLOCK_SIZE),
+                                        (int)((end - 1) / BLOCK_SIZE));
+        }
+        if (result == 0 && end > inode->i_size) {
+            inode->i_size = end;
+        }
+    }
+
+    rwl_unlock(&inode_locks[inumber]);
+    mutex_unlock(&file->lock);
+    return result;
+}
+
+/*
+ * Copies the contents of an i-node to another one, which must be empty. The
+ * blocks of the copy are allocated at once (as a run of consecutive blocks
+ * whenever possible) and filled block to block, and holes stay holes. A
+ * reflink copy only copies the block map instead, sharing the data blocks
+ * until either i-node writes to them.
+ * NOT thread safe.
+ * Input:
+ *  - src: a pointer to the inode to copy
+ *  - dst: a pointer to the (empty) inode to copy it to
+ *  - reflink: whether to share the data blocks of src
+ * Returns: 0 if successful, -1 if failed (leaving dst empty)
+ */
+static int inode_copy_data(inode_t *src, inode_t *dst, bool reflink) {
+    if (src->i_size == 0) {
+        return 0;
+    }
+
+    if (src->i_storage != I_BLOCKS) {
+        char *data = inode_small_data_reserve(dst, src->i_size);
+        char *src_data = inode_small_data_get(src);
+        if (data == NULL || src_data == NULL) {
+            return -1;
+        }
+        memcpy(data, src_data, src->i_size);
+        dst->i_size = src->i_size;
+        return 0;
+    }
+
+    int indexes[INODE_BLOCK_COUNT];
+    int count = 0;
+    int block_count = (int)((src->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (int i = 0; i < block_count; i++) {
+        if (inode_get_block_number_at_index(src, i) != INODE_HOLE) {
+            indexes[count++] = i;
+        }
+    }
+
+    /* allocate the indirect block first, so that it doesn't end up in the
+     * middle of the run of data blocks (the block map is never shared) */
+    dst->i_storage = I_BLOCKS;
+    if (block_count > INODE_DIRECT_BLOCK_SIZE &&
+        inode_indirect_block_get(dst) == NULL) {
+        inode_delete_data_blocks(dst);
+        return -1;
+    }
+
+    int blocks[INODE_BLOCK_COUNT];
+    if (reflink) {
+        for (int i = 0; i < count; i++) {
+            blocks[i] = inode_get_block_number_at_index(src, indexes[i]);
+        }
+        data_blocks_share(blocks, count);
+    } else if (count > 0 && data_blocks_alloc(count, blocks) == -1) {
+        inode_delete_data_blocks(dst);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!reflink) {
+            char *block = data_block_get(blocks[i]);
+            char *src_block = data_block_get(
+                inode_get_block_number_at_index(src, indexes[i]));
+            if (block != NULL && src_block != NULL) {
+                memcpy(block, src_block, BLOCK_SIZE);
+            }
+        }
+        /* can't fail, since the indirect block (if needed) already exists */
+        inode_set_block_number_at_index(dst, indexes[i], blocks[i]);
+    }
+    dst->i_size = src->i_size;
+    return 0;
+}
+
+/* Replaces the contents of a file with a copy of another one's
+ * Input:
+ *  - src_inumber: i-number of the file to copy
+ *  - dst_inumber: i-number of the file whose contents are replaced
+ *  - reflink: whether the copy shares the data blocks of the source
+ * Returns: 0 if successful, -1 otherwise (in which case the destination may
+ * be left empty)
+ */
+int inode_copy(int src_inumber, int dst_inumber, bool reflink) {
+    inode_t *src = inode_get(src_inumber);
+    inode_t *dst = inode_get(dst_inumber);
+    if (src == NULL || dst == NULL || src->i_node_type != T_FILE ||
+        dst->i_node_type != T_FILE) {
+        return -1;
+    }
+    if (src_inumber == dst_inumber) {
+        return 0;
+    }
+
+    /* lock the lowest i-number first, so that copies in opposite directions
+     * don't deadlock */
+    if (src_inumber < dst_inumber) {
+        rwl_rdlock(&inode_locks[src_inumber]);
+        rwl_wrlock(&inode_locks[dst_inumber]);
+    } else {
+        rwl_wrlock(&inode_locks[dst_inumber]);
+        rwl_rdlock(&inode_locks[src_inumber]);
+    }
+
+    int result = inode_save(dst_inumber);
+    if (result == 0) {
+        result = inode_detach_data_blocks(dst);
+    }
+    if (result == 0) {
+        result = inode_copy_data(src, dst, reflink);
+    }
+
+    rwl_unlock(&inode_locks[src_inumber]);
+    rwl_unlock(&inode_locks[dst_inumber]);
+    return result;
+}
+
+/*
+ * Adds an entry to the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
+    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    if (strlen(sub_name) == 0) {
+        return -1;
+    }
+
+    inode_t *inode = &inode_table[inumber];
+    rwl_wrlock(&inode_locks[inumber]);
+    if (inode_save(inumber) == -1) {
+        rwl_unlock(&inode_locks[inumber]);
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    // Directories only occupy one block at the moment, so get the first block
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(inode->i_data_blocks[0]);
+    if (dir_entry == NULL) {
+        rwl_unlock(&inode_locks[inumber]);
+        return -1;
+    }
+
     /* Finds and fills the first empty entry */
     for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
         if (dir_entry[i].d_inumber == -1) {
@@ -544,28 +1519,19 @@ int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
     return -1;
 }
 
-/* Looks for a given name inside a directory
+/* Looks for a given name inside the entries of a directory i-node.
+ * NOT thread safe.
  * Input:
- *  - parent directory's i-node number
+ *  - inode: a pointer to the directory's inode
  *  - name to search
  *  Returns i-number linked to the target name, -1 if not found
  */
-int find_in_dir(int inumber, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE ||
-        inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    inode_t *inode = &inode_table[inumber];
-    rwl_rdlock(&inode_locks[inumber]);
-
+static int dir_find_entry(inode_t *inode, char const *sub_name) {
     /* Locates the block containing the directory's entries */
     // Directories only occupy one block at the moment, so get the first block
     dir_entry_t *dir_entry =
         (dir_entry_t *)data_block_get(inode->i_data_blocks[0]);
     if (dir_entry == NULL) {
-        rwl_unlock(&inode_locks[inumber]);
         return -1;
     }
 
@@ -574,48 +1540,365 @@ int find_in_dir(int inumber, char const *sub_name) {
     for (int i = 0; i < MAX_DIR_ENTRIES; i++)
         if ((dir_entry[i].d_inumber != -1) &&
             (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            rwl_unlock(&inode_locks[inumber]);
             return dir_entry[i].d_inumber;
         }
 
+    return -1;
+}
+
+/* Looks for a given name inside a directory
+ * Input:
+ *  - parent directory's i-node number
+ *  - name to search
+ *  Returns i-number linked to the target name, -1 if not found
+ */
+int find_in_dir(int inumber, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE ||
+        inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    rwl_rdlock(&inode_locks[inumber]);
+    int sub_inumber = dir_find_entry(&inode_table[inumber], sub_name);
     rwl_unlock(&inode_locks[inumber]);
+    return sub_inumber;
+}
+
+/*
+ * Saves an i-node into every snapshot that still sees its live version, so
+ * that it can be changed. Saved files share their data blocks with the live
+ * ones, while directories (whose entries are changed in place) are copied.
+ * NOT thread safe (the caller holds the write lock of the i-node).
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: 0 if successful, -1 if failed
+ */
+static int inode_save(int inumber) {
+    inode_t *inode = &inode_table[inumber];
+    int result = 0;
+
+    rwl_rdlock(&snapshots_rwl);
+    for (int i = 0; i < MAX_SNAPSHOTS && result == 0; i++) {
+        snapshot_t *snapshot = &snapshots[i];
+        if (!snapshot->taken ||
+            snapshot->saved[inumber] == snapshot->generation) {
+            continue;
+        }
+
+        inode_t *saved = &snapshot->inodes[inumber];
+        saved->i_node_type = inode->i_node_type;
+        saved->i_storage = I_INLINE;
+        saved->i_size = 0;
+        for (int j = 0; j < INODE_DIRECT_BLOCK_SIZE; j++) {
+            saved->i_data_blocks[j] = INODE_HOLE;
+        }
+        saved->i_indirect_block = -1;
+        saved->i_fragment = -1;
+        saved->i_fragment_count = 0;
+        result = inode_copy_data(inode, saved, inode->i_node_type == T_FILE);
+        if (result == 0) {
+            snapshot->saved[inumber] = snapshot->generation;
+        }
+    }
+    rwl_unlock(&snapshots_rwl);
+    return result;
+}
+
+/*
+ * Returns the version of an i-node seen by a snapshot. NOT thread safe (the
+ * caller holds a lock of the i-node).
+ * Input:
+ *  - snapshot: a pointer to the snapshot
+ *  - inumber: identifier of the i-node
+ */
+static inode_t *snapshot_inode(snapshot_t *snapshot, int inumber) {
+    if (snapshot->saved[inumber] == snapshot->generation) {
+        return &snapshot->inodes[inumber];
+    }
+    return &inode_table[inumber];
+}
+
+/*
+ * Takes a snapshot of the whole file system, in constant time (the i-nodes
+ * are only saved into it when they are changed).
+ * Returns: identifier of the snapshot if successful, -1 if there are
+ * already MAX_SNAPSHOTS snapshots
+ */
+int snapshot_create() {
+    rwl_wrlock(&snapshots_rwl);
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (!snapshots[i].taken) {
+            snapshots[i].taken = true;
+            snapshots[i].generation = ++snapshot_generation;
+            rwl_unlock(&snapshots_rwl);
+            return i;
+        }
+    }
+    rwl_unlock(&snapshots_rwl);
     return -1;
 }
 
 /*
- * Allocated a new data block
+ * Deletes a snapshot, freeing the i-nodes saved into it.
+ * Input:
+ *  - snapshot: identifier of the snapshot
+ * Returns: 0 if successful, -1 if it doesn't exist or has open files
+ */
+int snapshot_delete(int snapshot) {
+    if (!valid_snapshot(snapshot)) {
+        return -1;
+    }
+
+    rwl_wrlock(&snapshots_rwl);
+    snapshot_t *s = &snapshots[snapshot];
+    mutex_lock(&snapshot_files_mutex);
+    bool busy = s->open_files > 0;
+    mutex_unlock(&snapshot_files_mutex);
+    if (!s->taken || busy) {
+        rwl_unlock(&snapshots_rwl);
+        return -1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (s->saved[i] == s->generation &&
+            inode_detach_data_blocks(&s->inodes[i]) == -1) {
+            result = -1;
+        }
+    }
+    s->taken = false;
+    rwl_unlock(&snapshots_rwl);
+    return result;
+}
+
+/*
+ * Opens a file of a snapshot, as it was when the snapshot was taken.
+ * Input:
+ *  - snapshot: identifier of the snapshot
+ *  - inumber: i-number of the parent directory
+ *  - sub_name: name of the file
+ * Returns: snapshot file handle (which can only be used with the other
+ * snapshot_file functions) if successful, -1 otherwise
+ */
+int snapshot_open(int snapshot, int inumber, char const *sub_name) {
+    if (!valid_snapshot(snapshot) || !valid_inumber(inumber)) {
+        return -1;
+    }
+
+    rwl_rdlock(&inode_locks[inumber]);
+    rwl_rdlock(&snapshots_rwl);
+    snapshot_t *s = &snapshots[snapshot];
+    int sub_inumber = -1;
+    if (s->taken && snapshot_inode(s, inumber)->i_node_type == T_DIRECTORY) {
+        sub_inumber = dir_find_entry(snapshot_inode(s, inumber), sub_name);
+    }
+
+    int shandle = -1;
+    if (sub_inumber != -1) {
+        mutex_lock(&snapshot_files_mutex);
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            if (free_snapshot_file_entries[i] == FREE) {
+                free_snapshot_file_entries[i] = TAKEN;
+                mutex_lock(&snapshot_file_table[i].lock);
+                snapshot_file_table[i].sf_snapshot = snapshot;
+                snapshot_file_table[i].sf_inumber = sub_inumber;
+                snapshot_file_table[i].sf_offset = 0;
+                mutex_unlock(&snapshot_file_table[i].lock);
+                s->open_files++;
+                shandle = i;
+                break;
+            }
+        }
+        mutex_unlock(&snapshot_files_mutex);
+    }
+
+    rwl_unlock(&snapshots_rwl);
+    rwl_unlock(&inode_locks[inumber]);
+    return shandle;
+}
+
+/*
+ * Reads from a file open in a snapshot, while the live file may be changed
+ * concurrently.
+ * Input:
+ *  - shandle: snapshot file handle (obtained from snapshot_open)
+ *  - buffer: destination buffer
+ *  - len: length of the buffer
+ * Returns: the number of bytes read (can be lower than 'len' if the end of
+ * the file was reached), or -1 in case of error
+ */
+ssize_t snapshot_file_read(int shandle, void *buffer, size_t len) {
+    if (!valid_file_handle(shandle)) {
+        return -1;
+    }
+    snapshot_file_entry_t *file = &snapshot_file_table[shandle];
+    mutex_lock(&file->lock);
+    if (file->sf_snapshot == -1) {
+        mutex_unlock(&file->lock);
+        return -1;
+    }
+
+    /* the snapshot can't be deleted while the file is open, and the i-node
+     * is only saved into it under the i-node's write lock */
+    int inumber = file->sf_inumber;
+    rwl_rdlock(&inode_locks[inumber]);
+    ssize_t read =
+        inode_read_data(snapshot_inode(&snapshots[file->sf_snapshot], inumber),
+                        file->sf_offset, buffer, len);
+    if (read > 0) {
+        file->sf_offset += (size_t)read;
+    }
+    rwl_unlock(&inode_locks[inumber]);
+
+    mutex_unlock(&file->lock);
+    return read;
+}
+
+/*
+ * Closes a file open in a snapshot.
+ * Input:
+ *  - shandle: snapshot file handle (obtained from snapshot_open)
+ * Returns: 0 if successful, -1 otherwise
+ */
+int snapshot_file_close(int shandle) {
+    mutex_lock(&snapshot_files_mutex);
+    if (!valid_file_handle(shandle) ||
+        free_snapshot_file_entries[shandle] != TAKEN) {
+        mutex_unlock(&snapshot_files_mutex);
+        return -1;
+    }
+    free_snapshot_file_entries[shandle] = FREE;
+    snapshot_file_entry_t *file = &snapshot_file_table[shandle];
+    mutex_lock(&file->lock);
+    snapshots[file->sf_snapshot].open_files--;
+    file->sf_snapshot = -1;
+    mutex_unlock(&file->lock);
+    mutex_unlock(&snapshot_files_mutex);
+    return 0;
+}
+
+/*
+ * Allocates a new data block, among the ones that are currently free
  * Returns: block index if successful, -1 otherwise
  */
-int data_block_alloc() {
-    rwl_rdlock(&free_blocks_rwl);
+static int data_block_try_alloc() {
+    rwl_rdlock(&block_refs_rwl);
 
     for (int i = 0; i < DATA_BLOCKS; i++) {
 
         if (i * (int)sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
+            insert_delay(); // simulate storage access delay to block_refs
         }
 
-        if (free_blocks[i] == FREE) {
-            rwl_unlock(&free_blocks_rwl);
-            rwl_wrlock(&free_blocks_rwl);
+        if (block_refs[i] == 0) {
+            rwl_unlock(&block_refs_rwl);
+            rwl_wrlock(&block_refs_rwl);
             // recheck since we only had read lock
-            if (free_blocks[i] == FREE) {
-                free_blocks[i] = TAKEN;
-                rwl_unlock(&free_blocks_rwl);
+            if (block_refs[i] == 0) {
+                block_refs[i] = 1;
+                rwl_unlock(&block_refs_rwl);
                 return i;
             } else {
                 // another thread got the block first, let go of the write lock
                 // and change to the read lock again
-                rwl_unlock(&free_blocks_rwl);
-                rwl_rdlock(&free_blocks_rwl);
+                rwl_unlock(&block_refs_rwl);
+                rwl_rdlock(&block_refs_rwl);
             }
         }
     }
-    rwl_unlock(&free_blocks_rwl);
+    rwl_unlock(&block_refs_rwl);
     return -1;
 }
 
-/* Frees a data block
+/*
+ * Allocated a new data block
+ * Returns: block index if successful, -1 otherwise
+ */
+int data_block_alloc() {
+    /* if every block is taken, blocks may still be waiting to be reclaimed */
+    while (true) {
+        unsigned long generation = get_reclaim_generation();
+        int block_number = data_block_try_alloc();
+        if (block_number != -1) {
+            return block_number;
+        }
+        if (!wait_for_reclaimed_blocks(generation)) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Allocates several data blocks, in a single pass over the allocation table.
+ * A run of consecutive blocks is preferred (so that files are laid out
+ * sequentially), but any free blocks are taken if there is no such run.
+ * Input:
+ *  - count: number of blocks to allocate
+ *  - block_numbers: where to store the indexes of the allocated blocks
+ * Returns: 0 if successful, -1 otherwise (in which case nothing is allocated)
+ */
+static int data_blocks_try_alloc(int count, int *block_numbers) {
+    int run_start = 0;
+    int run_length = 0;
+    int found = 0;
+
+    rwl_wrlock(&block_refs_rwl);
+    for (int i = 0; i < DATA_BLOCKS && run_length < count; i++) {
+        if (i * (int)sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to block_refs
+        }
+
+        if (block_refs[i] != 0) {
+            run_length = 0;
+            continue;
+        }
+        if (run_length++ == 0) {
+            run_start = i;
+        }
+        if (found < count) {
+            block_numbers[found++] = i;
+        }
+    }
+
+    if (run_length == count) {
+        for (int i = 0; i < count; i++) {
+            block_numbers[i] = run_start + i;
+        }
+    } else if (found < count) {
+        rwl_unlock(&block_refs_rwl);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        block_refs[block_numbers[i]] = 1;
+    }
+    rwl_unlock(&block_refs_rwl);
+    return 0;
+}
+
+/*
+ * Allocates several data blocks at once (see data_blocks_try_alloc)
+ * Input:
+ *  - count: number of blocks to allocate
+ *  - block_numbers: where to store the indexes of the allocated blocks
+ * Returns: 0 if successful, -1 otherwise
+ */
+int data_blocks_alloc(int count, int *block_numbers) {
+    if (count <= 0 || count > DATA_BLOCKS) {
+        return -1;
+    }
+    while (true) {
+        unsigned long generation = get_reclaim_generation();
+        if (data_blocks_try_alloc(count, block_numbers) == 0) {
+            return 0;
+        }
+        if (!wait_for_reclaimed_blocks(generation)) {
+            return -1;
+        }
+    }
+}
+
+/* Drops a reference to a data block, freeing it once no one else shares it
  * Input
  *  - the block index
  * Returns: 0 if success, -1 otherwise
@@ -625,11 +1908,67 @@ int data_block_free(int block_number) {
         return -1;
     }
 
-    insert_delay(); // simulate storage access delay to free_blocks
-    free_blocks[block_number] = FREE;
+    insert_delay(); // simulate storage access delay to block_refs
+    rwl_wrlock(&block_refs_rwl);
+    if (block_refs[block_number] == 0) {
+        rwl_unlock(&block_refs_rwl);
+        return -1;
+    }
+    block_refs[block_number]--;
+    rwl_unlock(&block_refs_rwl);
     return 0;
 }
 
+/* Drops a reference to each of a batch of data blocks at once (see
+ * data_block_free)
+ * Input
+ *  - the block indexes
+ *  - the number of blocks
+ */
+void data_blocks_free(int const *block_numbers, int count) {
+    insert_delay(); // simulate storage access delay to block_refs
+    rwl_wrlock(&block_refs_rwl);
+    for (int i = 0; i < count; i++) {
+        if (valid_block_number(block_numbers[i]) &&
+            block_refs[block_numbers[i]] > 0) {
+            block_refs[block_numbers[i]]--;
+        }
+    }
+    rwl_unlock(&block_refs_rwl);
+}
+
+/* Adds a reference to each of a batch of data blocks, which are then shared
+ * by one more i-node
+ * Input
+ *  - the block indexes (of blocks that are in use)
+ *  - the number of blocks
+ */
+void data_blocks_share(int const *block_numbers, int count) {
+    insert_delay(); // simulate storage access delay to block_refs
+    rwl_wrlock(&block_refs_rwl);
+    for (int i = 0; i < count; i++) {
+        if (valid_block_number(block_numbers[i])) {
+            block_refs[block_numbers[i]]++;
+        }
+    }
+    rwl_unlock(&block_refs_rwl);
+}
+
+/* Returns true if a data block is shared by more than one i-node
+ * Input
+ *  - the block index
+ */
+bool data_block_is_shared(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return false;
+    }
+
+    rwl_rdlock(&block_refs_rwl);
+    bool shared = block_refs[block_number] > 1;
+    rwl_unlock(&block_refs_rwl);
+    return shared;
+}
+
 /* Returns a pointer to the contents of a given block
  * Input:
  *  - Block's index
@@ -644,6 +1983,127 @@ void *data_block_get(int block_number) {
     return &fs_data[block_number * BLOCK_SIZE];
 }
 
+/*
+ * Allocates a run of consecutive fragments, packing it into a fragment block
+ * shared with other runs if possible
+ * Input:
+ *  - number of fragments in the run
+ * Returns: index of the first fragment if successful, -1 otherwise
+ */
+int fragment_alloc(int count) {
+    if (count <= 0 || count > FRAGMENTS_PER_BLOCK) {
+        return -1;
+    }
+    unsigned int run = (1u << count) - 1u;
+
+    mutex_lock(&fragments_mutex);
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        if (i * (int)sizeof(unsigned char) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to fragment_maps
+        }
+
+        if (fragment_refs[i] == 0) {
+            continue;
+        }
+        for (int first = 0; first + count <= FRAGMENTS_PER_BLOCK; first++) {
+            if ((fragment_maps[i] & (run << first)) == 0) {
+                fragment_maps[i] =
+                    (unsigned char)(fragment_maps[i] | (run << first));
+                fragment_refs[i]++;
+                mutex_unlock(&fragments_mutex);
+                return i * FRAGMENTS_PER_BLOCK + first;
+            }
+        }
+    }
+
+    /* no fragment block has room for the run, so start a new one */
+    int block_number = data_block_alloc();
+    if (block_number == -1) {
+        mutex_unlock(&fragments_mutex);
+        return -1;
+    }
+    fragment_maps[block_number] = (unsigned char)run;
+    fragment_refs[block_number] = 1;
+    mutex_unlock(&fragments_mutex);
+    return block_number * FRAGMENTS_PER_BLOCK;
+}
+
+/*
+ * Grows a run of fragments in place, if the fragments after it are free
+ * Input:
+ *  - index of the first fragment of the run
+ *  - current and new number of fragments in the run
+ * Returns: 0 if successful, -1 otherwise
+ */
+int fragment_extend(int fragment, int count, int new_count) {
+    int block_number = fragment / FRAGMENTS_PER_BLOCK;
+    int first = fragment % FRAGMENTS_PER_BLOCK;
+    if (fragment < 0 || !valid_block_number(block_number) || count <= 0 ||
+        new_count <= count || first + new_count > FRAGMENTS_PER_BLOCK) {
+        return -1;
+    }
+    unsigned int extra = ((1u << (new_count - count)) - 1u) << (first + count);
+
+    insert_delay(); // simulate storage access delay to fragment_maps
+    mutex_lock(&fragments_mutex);
+    if ((fragment_maps[block_number] & extra) != 0) {
+        mutex_unlock(&fragments_mutex);
+        return -1;
+    }
+    fragment_maps[block_number] =
+        (unsigned char)(fragment_maps[block_number] | extra);
+    mutex_unlock(&fragments_mutex);
+    return 0;
+}
+
+/* Frees a run of fragments, freeing its block once no other run uses it
+ * Input
+ *  - index of the first fragment of the run
+ *  - number of fragments in the run
+ * Returns: 0 if success, -1 otherwise
+ */
+int fragment_free(int fragment, int count) {
+    int block_number = fragment / FRAGMENTS_PER_BLOCK;
+    int first = fragment % FRAGMENTS_PER_BLOCK;
+    if (fragment < 0 || !valid_block_number(block_number) || count <= 0 ||
+        first + count > FRAGMENTS_PER_BLOCK) {
+        return -1;
+    }
+    unsigned int run = ((1u << count) - 1u) << first;
+
+    insert_delay(); // simulate storage access delay to fragment_maps
+    mutex_lock(&fragments_mutex);
+    if (fragment_refs[block_number] == 0) {
+        mutex_unlock(&fragments_mutex);
+        return -1;
+    }
+    fragment_maps[block_number] =
+        (unsigned char)(fragment_maps[block_number] & ~run);
+    if (--fragment_refs[block_number] == 0 &&
+        data_block_free(block_number) == -1) {
+        mutex_unlock(&fragments_mutex);
+        return -1;
+    }
+    mutex_unlock(&fragments_mutex);
+    return 0;
+}
+
+/* Returns a pointer to the contents of a given fragment
+ * Input:
+ *  - Fragment's index
+ * Returns: pointer to the first byte of the fragment, NULL otherwise
+ */
+void *fragment_get(int fragment) {
+    if (fragment < 0) {
+        return NULL;
+    }
+    char *block = data_block_get(fragment / FRAGMENTS_PER_BLOCK);
+    if (block == NULL) {
+        return NULL;
+    }
+    return block + (fragment % FRAGMENTS_PER_BLOCK) * FRAGMENT_SIZE;
+}
+
 /* Add new entry to the open file table
  * Inputs:
  *  - I-node number of the file to open
@@ -751,17 +2211,9 @@ int inode_set_block_number_at_index(inode_t *inode, int index,
     }
     // if index is in the indirect block
     if (index >= INODE_DIRECT_BLOCK_SIZE) {
-        int *block = data_block_get(inode->i_indirect_block);
+        int *block = inode_indirect_block_get(inode);
         if (block == NULL) {
-            int indirect_block_number = data_block_alloc();
-            if (indirect_block_number == -1) {
-                return -1;
-            }
-            inode->i_indirect_block = indirect_block_number;
-            block = data_block_get(indirect_block_number);
-            if (block == NULL) {
-                return -1;
-            }
+            return -1;
         }
         block[index - INODE_DIRECT_BLOCK_SIZE] = i_block_number;
     } else {
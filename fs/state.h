@@ -20,14 +20,31 @@ typedef struct {
 
 typedef enum { T_FILE, T_DIRECTORY } inode_type;
 
+/*
+ * Block map entry of a block that was never written (a hole).
+ * Holes take no data blocks and are read back as zeros.
+ */
+#define INODE_HOLE (-1)
+
+/*
+ * Where the contents of an i-node are stored: inside the i-node itself (for
+ * tiny files), in a run of fragments of a block shared with other small files,
+ * or in data blocks
+ */
+typedef enum { I_INLINE, I_FRAGMENT, I_BLOCKS } inode_storage;
+
 /*
  * I-node
  */
 typedef struct {
     inode_type i_node_type;
+    inode_storage i_storage;
     size_t i_size;
     int i_data_blocks[INODE_DIRECT_BLOCK_SIZE];
     int i_indirect_block;
+    char i_inline_data[INODE_INLINE_DATA_SIZE];
+    int i_fragment;       /* first fragment of the run (if I_FRAGMENT) */
+    int i_fragment_count; /* number of fragments in the run */
     /* in a real FS, more fields would exist here */
 } inode_t;
 
@@ -51,19 +68,41 @@ int inode_create(inode_type n_type);
 int inode_delete(int inumber);
 int inode_truncate(int inumber);
 int inode_delete_data_blocks(inode_t *inode);
+int inode_detach_data_blocks(inode_t *inode);
 inode_t *inode_get(int inumber);
 
 ssize_t inode_write(int fhandle, void const *buffer, size_t to_write);
 ssize_t inode_read(int fhandle, void *buffer, size_t len);
+ssize_t inode_pread(int fhandle, void *buffer, size_t len, size_t offset);
+int inode_of_handle(int fhandle);
+off_t inode_seek(int fhandle, off_t offset, int whence);
+int inode_ftruncate(int fhandle, size_t length);
+int inode_fallocate(int fhandle, size_t offset, size_t len);
+int inode_copy(int src_inumber, int dst_inumber, bool reflink);
+
+int snapshot_create();
+int snapshot_delete(int snapshot);
+int snapshot_open(int snapshot, int inumber, char const *sub_name);
+ssize_t snapshot_file_read(int shandle, void *buffer, size_t len);
+int snapshot_file_close(int shandle);
 
 int clear_dir_entry(int inumber, int sub_inumber);
 int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
 int find_in_dir(int inumber, char const *sub_name);
 
 int data_block_alloc();
+int data_blocks_alloc(int count, int *block_numbers);
 int data_block_free(int block_number);
+void data_blocks_free(int const *block_numbers, int count);
+void data_blocks_share(int const *block_numbers, int count);
+bool data_block_is_shared(int block_number);
 void *data_block_get(int block_number);
 
+int fragment_alloc(int count);
+int fragment_extend(int fragment, int count, int new_count);
+int fragment_free(int fragment, int count);
+void *fragment_get(int fragment);
+
 int add_to_open_file_table(int inumber, size_t offset);
 int remove_from_open_file_table(int fhandle);
 open_file_entry_t *get_open_file_entry(int fhandle);
@@ -8,20 +8,71 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
 
-static worker_t workers[SIMULTANEOUS_CONNECTIONS];
-static bool free_workers[SIMULTANEOUS_CONNECTIONS];
-static pthread_mutex_t free_worker_lock;
+/* check if all the content was read from the session. */
+#define read_session(session, buffer, size)                                    \
+    if (session_read(session, buffer, size) != size) {                         \
+        return -1;                                                             \
+    }
 
-static int pipe_in;
+static session_t sessions[SIMULTANEOUS_CONNECTIONS];
+static pthread_mutex_t sessions_lock;
+
+/* circular buffer of the mounts waiting for a session to be freed, oldest
+ * (and so the first to time out) first, guarded by sessions_lock */
+static pending_mount_t mount_queue[MOUNT_QUEUE_SIZE];
+static size_t mount_queue_head;
+static size_t mount_queue_count;
+/* signaled whenever a session is freed or a mount is queued, waits on it
+ * time out (on the monotonic clock) when the oldest mount does */
+static pthread_cond_t mount_queue_changed;
+
+/* watches the request pipes of the sessions that are waiting for a request */
+static int epoll_fd;
+
+/* sessions with a pending request, by the priority class of the request,
+ * shared by every worker of the pool */
+static work_queue_t work_queues[TFS_PRIORITY_CLASSES];
+/* number of sessions in every work queue */
+static size_t work_queue_count;
+/* number of sessions taken from the queue that are still being served */
+static int busy_workers;
+static pthread_mutex_t work_queue_lock;
+static pthread_cond_t work_queue_not_empty;
+static pthread_cond_t work_queue_not_full;
+static pthread_cond_t work_queue_idle;
+/* number of workers that must leave the pool, as they were only hired to
+ * stand in for workers waiting for leases to be given back */
+static int workers_to_retire;
+
+static lease_t leases[MAX_LEASES];
+static int next_lease_id;
+/* number of changes being made to each file, which can't be leased while
+ * there are any */
+static int inode_updates[INODE_TABLE_SIZE];
+static pthread_mutex_t leases_lock;
+/* signaled whenever a lease is dropped, waits on it time out (on the
+ * monotonic clock) when the next lease expires */
+static pthread_cond_t lease_dropped;
+
+/* the server's pipe, or its listening socket */
+static int server_pipe;
 
 static char *pipename;
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Please specify the pathname of the server's pipe.\n");
+    bool use_socket = argc >= 3 && strcmp(argv[1], "-s") == 0;
+    if (argc < 2 || (argc >= 3 && !use_socket)) {
+        printf("Please specify the pathname of the server's pipe (or, with "
+               "-s, of the server's socket).\n");
         return EXIT_FAILURE;
     }
 
@@ -38,21 +89,33 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    pipename = argv[1];
-    printf("Starting TecnicoFS server with pipe called %s\n", pipename);
+    pipename = argv[use_socket ? 2 : 1];
+    printf("Starting TecnicoFS server with %s called %s\n",
+           use_socket ? "socket" : "pipe", pipename);
 
     if (unlink(pipename) != 0 && errno != ENOENT) {
         perror("Failed to delete pipe");
         exit(EXIT_FAILURE);
     }
 
+    if (use_socket) {
+        run_socket_listener();
+    } else {
+        run_pipe_listener();
+    }
+
+    close_server(EXIT_SUCCESS);
+    return 0;
+}
+
+void run_pipe_listener() {
     if (mkfifo(pipename, 0777) < 0) {
         perror("Failed to create pipe");
         exit(EXIT_FAILURE);
     }
 
-    pipe_in = open(pipename, O_RDONLY);
-    if (pipe_in < 0) {
+    server_pipe = open(pipename, O_RDONLY);
+    if (server_pipe < 0) {
         perror("Failed to open server pipe");
         unlink(pipename);
         exit(EXIT_FAILURE);
@@ -67,7 +130,7 @@ int main(int argc, char **argv) {
         if (tmp_pipe < 0) {
             if (errno == ENOENT) {
                 /* if pipe does not exist, means we've exited */
-                return 0;
+                exit(EXIT_SUCCESS);
             }
             perror("Failed to open server pipe");
             close_server(EXIT_FAILURE);
@@ -80,9 +143,10 @@ int main(int argc, char **argv) {
         ssize_t bytes_read;
         char op_code;
 
-        bytes_read = try_read(pipe_in, &op_code, sizeof(char));
+        bytes_read = try_read(server_pipe, &op_code, sizeof(char));
 
-        // main listener loop
+        // main listener loop, the server pipe only carries mount requests
+        // (every other request goes through the request pipe of the session)
         while (bytes_read > 0) {
 
             switch (op_code) {
@@ -91,28 +155,10 @@ int main(int argc, char **argv) {
                     fprintf(stderr, "Failed to mount client\n");
                 }
                 break;
-            case TFS_OP_CODE_UNMOUNT:
-                wrap_packet_parser_fn(NULL, op_code);
-                break;
-            case TFS_OP_CODE_OPEN:
-                wrap_packet_parser_fn(parse_tfs_open_packet, op_code);
-                break;
-            case TFS_OP_CODE_CLOSE:
-                wrap_packet_parser_fn(parse_tfs_close_packet, op_code);
-                break;
-            case TFS_OP_CODE_WRITE:
-                wrap_packet_parser_fn(parse_tfs_write_packet, op_code);
-                break;
-            case TFS_OP_CODE_READ:
-                wrap_packet_parser_fn(parse_tfs_read_packet, op_code);
-                break;
-            case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
-                wrap_packet_parser_fn(NULL, op_code);
-                break;
             default:
                 break;
             }
-            bytes_read = try_read(pipe_in, &op_code, sizeof(char));
+            bytes_read = try_read(server_pipe, &op_code, sizeof(char));
         }
 
         if (bytes_read < 0) {
@@ -120,288 +166,1787 @@ int main(int argc, char **argv) {
             close_server(EXIT_FAILURE);
         }
     }
+}
 
-    close_server(EXIT_SUCCESS);
-    return 0;
+void run_socket_listener() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(pipename) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "The pathname of the socket is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, pipename);
+
+    server_pipe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_pipe < 0) {
+        perror("Failed to create socket");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(server_pipe, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("Failed to bind socket");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(server_pipe, SOMAXCONN) < 0) {
+        perror("Failed to listen on socket");
+        close_server(EXIT_FAILURE);
+    }
+
+    // main listener loop, each connection is a new session, whose requests
+    // are then read by the workers of the pool
+    while (true) {
+        int connection = accept(server_pipe, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Failed to accept connection");
+            close_server(EXIT_FAILURE);
+        }
+
+        if (mount_session(connection, connection) != 0) {
+            fprintf(stderr, "Failed to mount client\n");
+        }
+    }
 }
 
 int init_server() {
     for (int i = 0; i < SIMULTANEOUS_CONNECTIONS; ++i) {
-        workers[i].session_id = i;
-        workers[i].to_execute = false;
-        mutex_init(&workers[i].lock);
-        if (pthread_cond_init(&workers[i].cond, NULL) != 0) {
+        sessions[i].session_id = i;
+        sessions[i].in_use = false;
+        sessions[i].requests_in_flight = 0;
+        mutex_init(&sessions[i].reply_lock);
+        mutex_init(&sessions[i].requests_lock);
+        mutex_init(&sessions[i].activity_lock);
+        mutex_init(&sessions[i].fhandles_lock);
+        for (int j = 0; j < MAX_OPEN_FILES; ++j) {
+            sessions[i].fhandles[j] = -1;
+            sessions[i].fhandle_users[j] = 0;
+        }
+        if (pthread_cond_init(&sessions[i].requests_done, NULL) != 0 ||
+            pthread_cond_init(&sessions[i].fhandle_unused, NULL) != 0) {
             return -1;
         }
-        if (pthread_create(&workers[i].tid, NULL, session_worker,
-                           &workers[i]) != 0) {
+    }
+    mutex_init(&sessions_lock);
+    mount_queue_head = 0;
+    mount_queue_count = 0;
+    pthread_condattr_t mount_queue_attr;
+    if (pthread_condattr_init(&mount_queue_attr) != 0 ||
+        pthread_condattr_setclock(&mount_queue_attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&mount_queue_changed, &mount_queue_attr) != 0) {
+        return -1;
+    }
+    pthread_condattr_destroy(&mount_queue_attr);
+
+    for (int i = 0; i < MAX_LEASES; ++i) {
+        leases[i].in_use = false;
+    }
+    next_lease_id = 0;
+    memset(inode_updates, 0, sizeof(inode_updates));
+    mutex_init(&leases_lock);
+    pthread_condattr_t lease_dropped_attr;
+    if (pthread_condattr_init(&lease_dropped_attr) != 0 ||
+        pthread_condattr_setclock(&lease_dropped_attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&lease_dropped, &lease_dropped_attr) != 0) {
+        return -1;
+    }
+    pthread_condattr_destroy(&lease_dropped_attr);
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < TFS_PRIORITY_CLASSES; ++i) {
+        work_queues[i].head = 0;
+        work_queues[i].count = 0;
+    }
+    work_queue_count = 0;
+    busy_workers = 0;
+    workers_to_retire = 0;
+    mutex_init(&work_queue_lock);
+    /* workers wait on it until a session is within its limits */
+    pthread_condattr_t work_queue_attr;
+    if (pthread_condattr_init(&work_queue_attr) != 0 ||
+        pthread_condattr_setclock(&work_queue_attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&work_queue_not_empty, &work_queue_attr) != 0 ||
+        pthread_cond_init(&work_queue_not_full, NULL) != 0 ||
+        pthread_cond_init(&work_queue_idle, NULL) != 0) {
+        return -1;
+    }
+    pthread_condattr_destroy(&work_queue_attr);
+
+    pthread_t admitter_tid;
+    if (pthread_create(&admitter_tid, NULL, mount_admitter, NULL) != 0 ||
+        pthread_detach(admitter_tid) != 0) {
+        return -1;
+    }
+    pthread_t reaper_tid;
+    if (pthread_create(&reaper_tid, NULL, session_reaper, NULL) != 0 ||
+        pthread_detach(reaper_tid) != 0) {
+        return -1;
+    }
+
+    long pool_size = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool_size < 1) {
+        pool_size = 1;
+    }
+    for (long i = 0; i <= pool_size; ++i) {
+        /* the extra thread is the dispatcher */
+        pthread_t tid;
+        if (pthread_create(&tid, NULL,
+                           i < pool_size ? pool_worker : session_dispatcher,
+                           NULL) != 0) {
+            return -1;
+        }
+        if (pthread_detach(tid) != 0) {
             return -1;
         }
-        free_workers[i] = false;
     }
-    mutex_init(&free_worker_lock);
     return 0;
 }
 
-int get_available_worker() {
-    mutex_lock(&free_worker_lock);
+int take_session() {
     for (int i = 0; i < SIMULTANEOUS_CONNECTIONS; ++i) {
-        if (free_workers[i] == false) {
-            free_workers[i] = true;
-            mutex_unlock(&free_worker_lock);
+        if (!sessions[i].in_use) {
+            sessions[i].in_use = true;
             return i;
         }
     }
-    mutex_unlock(&free_worker_lock);
-    printf("All workers are full\n");
     return -1;
 }
 
-int free_worker(int session_id) {
-    mutex_lock(&free_worker_lock);
-    if (free_workers[session_id] == false) {
-        mutex_unlock(&free_worker_lock);
+int get_available_session() {
+    mutex_lock(&sessions_lock);
+    int session_id = take_session();
+    mutex_unlock(&sessions_lock);
+    if (session_id < 0) {
+        printf("All sessions are taken\n");
+    }
+    return session_id;
+}
+
+int free_session(int session_id) {
+    mutex_lock(&sessions_lock);
+    if (!sessions[session_id].in_use) {
+        mutex_unlock(&sessions_lock);
         return -1;
     }
-    free_workers[session_id] = false;
-    mutex_unlock(&free_worker_lock);
+    sessions[session_id].in_use = false;
+    /* a waiting mount can take it */
+    if (mount_queue_count > 0) {
+        pthread_cond_signal(&mount_queue_changed);
+    }
+    mutex_unlock(&sessions_lock);
 
     return 0;
 }
 
-int parse_tfs_open_packet(worker_t *worker) {
-    read_pipe(pipe_in, &worker->packet.file_name,
-              sizeof(char) * PIPE_STRING_LENGTH);
-    read_pipe(pipe_in, &worker->packet.flags, sizeof(int));
-    worker->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+int queue_mount(int pipe_in, int pipe_out) {
+    mutex_lock(&sessions_lock);
+    if (mount_queue_count == MOUNT_QUEUE_SIZE) {
+        mutex_unlock(&sessions_lock);
+        return -1;
+    }
+
+    size_t tail = (mount_queue_head + mount_queue_count) % MOUNT_QUEUE_SIZE;
+    mount_queue[tail].pipe_in = pipe_in;
+    mount_queue[tail].pipe_out = pipe_out;
+    timespec_after_ms(&mount_queue[tail].deadline, MOUNT_WAIT_TIMEOUT_MS);
+    mount_queue_count++;
 
+    /* a session may have been freed since it was looked for */
+    pthread_cond_signal(&mount_queue_changed);
+    mutex_unlock(&sessions_lock);
     return 0;
 }
 
-int parse_tfs_close_packet(worker_t *worker) {
-    read_pipe(pipe_in, &worker->packet.fhandle, sizeof(int));
+void *mount_admitter(void *args) {
+    (void)args;
+    mutex_lock(&sessions_lock);
+    while (true) {
+        if (mount_queue_count == 0) {
+            pthread_cond_wait(&mount_queue_changed, &sessions_lock);
+            continue;
+        }
+
+        pending_mount_t mount = mount_queue[mount_queue_head];
+        int session_id = take_session();
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (session_id < 0 && timespec_before(&now, &mount.deadline)) {
+            pthread_cond_timedwait(&mount_queue_changed, &sessions_lock,
+                                   &mount.deadline);
+            continue;
+        }
+
+        /* admitted, or timed out (and rejected) */
+        mount_queue_head = (mount_queue_head + 1) % MOUNT_QUEUE_SIZE;
+        mount_queue_count--;
+        mutex_unlock(&sessions_lock);
+        if (session_id < 0) {
+            printf("A mount timed out waiting for a session.\n");
+        }
+        if (admit_session(session_id, mount.pipe_in, mount.pipe_out) != 0) {
+            fprintf(stderr, "Failed to mount client\n");
+        }
+        mutex_lock(&sessions_lock);
+    }
+}
+
+void close_session(session_t *session) {
+    /* no recall is taken for the session from now on */
+    drop_leases(session, -1);
 
+    /* their replies (and the recalls already taken) are still to be
+     * written */
+    wait_for_requests(session);
+
+    release_fhandles(session);
+
+    if (session->channel != NULL) {
+        shm_ring_close(&session->channel->requests);
+        shm_ring_close(&session->channel->responses);
+        if (munmap(session->channel, sizeof(shm_channel_t)) != 0) {
+            perror("Failed to unmap shared memory");
+        }
+        session->channel = NULL;
+    }
+
+    /* closing the request pipe also removes it from the epoll instance */
+    if (close(session->pipe_in) < 0) {
+        perror("Failed to close pipe");
+    }
+    /* with sockets, the same file descriptor is used both ways */
+    if (session->pipe_out != session->pipe_in && close(session->pipe_out) < 0) {
+        perror("Failed to close pipe");
+    }
+
+    if (free_session(session->session_id) == -1) {
+        perror("Failed to free session");
+        close_server(EXIT_FAILURE);
+    }
+}
+
+int watch_session(session_t *session, int op) {
+    /* the dispatcher (or the reaper) may take it as soon as it's watched */
+    mutex_lock(&session->activity_lock);
+    session->watched = true;
+    mutex_unlock(&session->activity_lock);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = session;
+    if (epoll_ctl(epoll_fd, op, session->pipe_in, &event) != 0) {
+        /* the caller closes it, unless the reaper already took it to do so
+         * (the dispatcher can't have, as it wasn't watched) */
+        return claim_session(session) ? -1 : 0;
+    }
     return 0;
 }
 
-int parse_tfs_write_packet(worker_t *worker) {
-    read_pipe(pipe_in, &worker->packet.fhandle, sizeof(int));
-    read_pipe(pipe_in, &worker->packet.len, sizeof(size_t));
-    char *buffer = (char *)malloc(worker->packet.len * sizeof(char));
-    if (buffer == NULL) {
+bool claim_session(session_t *session) {
+    mutex_lock(&session->activity_lock);
+    bool watched = session->watched;
+    session->watched = false;
+    mutex_unlock(&session->activity_lock);
+    return watched;
+}
+
+void touch_session(session_t *session) {
+    mutex_lock(&session->activity_lock);
+    clock_gettime(CLOCK_MONOTONIC, &session->last_active);
+    mutex_unlock(&session->activity_lock);
+}
+
+bool client_gone(session_t *session) {
+    mutex_lock(&session->activity_lock);
+    bool gone = session->client_gone;
+    mutex_unlock(&session->activity_lock);
+    if (gone) {
+        return true;
+    }
+
+    /* the response pipe reports an error once its reader is gone, and the
+     * socket a hang up */
+    struct pollfd fd = {session->pipe_out, POLLOUT, 0};
+    return poll(&fd, 1, 0) == 1 && (fd.revents & (POLLERR | POLLHUP)) != 0;
+}
+
+void *session_reaper(void *args) {
+    (void)args;
+    struct timespec pause = {SESSION_REAP_INTERVAL_MS / 1000,
+                             (SESSION_REAP_INTERVAL_MS % 1000) * 1000000};
+    session_t *reaped[SIMULTANEOUS_CONNECTIONS];
+    while (true) {
+        nanosleep(&pause, NULL);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int count = 0;
+        mutex_lock(&sessions_lock);
+        for (int i = 0; i < SIMULTANEOUS_CONNECTIONS; ++i) {
+            session_t *session = &sessions[i];
+            if (!session->in_use) {
+                continue;
+            }
+
+            /* sessions with requests in flight aren't idle */
+            mutex_lock(&session->requests_lock);
+            bool busy = session->requests_in_flight > 0;
+            mutex_unlock(&session->requests_lock);
+            mutex_lock(&session->activity_lock);
+            struct timespec idle_until = session->last_active;
+            mutex_unlock(&session->activity_lock);
+            timespec_add_ms(&idle_until, SESSION_IDLE_TIMEOUT_MS);
+
+            if (!busy && (timespec_before(&idle_until, &now) ||
+                          client_gone(session))) {
+                /* only sessions waiting for a request can be taken, the
+                 * others are being served */
+                mutex_lock(&session->activity_lock);
+                if (session->watched) {
+                    session->watched = false;
+                    session->reaped = true;
+                    reaped[count++] = session;
+                }
+                mutex_unlock(&session->activity_lock);
+            }
+        }
+        mutex_unlock(&sessions_lock);
+
+        /* the workers close them, as they would after a failed request */
+        for (int i = 0; i < count; ++i) {
+            printf("The session number %d was idle or its client was gone, "
+                   "closing it.\n",
+                   reaped[i]->session_id);
+            enqueue_session(reaped[i]);
+        }
+    }
+}
+
+int own_fhandle(session_t *session, int fhandle) {
+    if (fhandle < 0) {
         return -1;
     }
 
-    read_pipe(pipe_in, buffer, worker->packet.len * sizeof(char));
-    worker->packet.buffer = buffer;
+    /* the session can't have more handles than the file system has, so
+     * there is always a free one (a handle being closed, whose requests
+     * haven't finished, still holds its file handle) */
+    int result = -1;
+    mutex_lock(&session->fhandles_lock);
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        if (session->fhandles[i] == -1 && session->fhandle_users[i] == 0) {
+            session->fhandles[i] = fhandle;
+            result = i;
+            break;
+        }
+    }
+    mutex_unlock(&session->fhandles_lock);
+    return result;
+}
 
-    return 0;
+int session_fhandle(session_t *session, int fhandle) {
+    if (fhandle < 0 || fhandle >= MAX_OPEN_FILES) {
+        return -1;
+    }
+    mutex_lock(&session->fhandles_lock);
+    int result = session->fhandles[fhandle];
+    if (result != -1) {
+        session->fhandle_users[fhandle]++;
+    }
+    mutex_unlock(&session->fhandles_lock);
+    return result;
+}
+
+void put_fhandle(session_t *session, int fhandle) {
+    mutex_lock(&session->fhandles_lock);
+    if (--session->fhandle_users[fhandle] == 0) {
+        pthread_cond_broadcast(&session->fhandle_unused);
+    }
+    mutex_unlock(&session->fhandles_lock);
+}
+
+int disown_fhandle(session_t *session, int fhandle) {
+    if (fhandle < 0 || fhandle >= MAX_OPEN_FILES) {
+        return -1;
+    }
+    mutex_lock(&session->fhandles_lock);
+    int result = session->fhandles[fhandle];
+    session->fhandles[fhandle] = -1;
+    /* no new request can find the handle now, and the ones that did are
+     * still using the file handle */
+    while (result != -1 && session->fhandle_users[fhandle] > 0) {
+        pthread_cond_wait(&session->fhandle_unused, &session->fhandles_lock);
+    }
+    mutex_unlock(&session->fhandles_lock);
+    return result;
+}
+
+void release_fhandles(session_t *session) {
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        int fhandle = disown_fhandle(session, i);
+        if (fhandle != -1) {
+            tfs_close(fhandle);
+        }
+    }
+    drop_leases(session, -1);
+}
+
+int rewatch_session(session_t *session) {
+    shm_channel_t *channel = session->channel;
+    if (channel != NULL) {
+        /* the client doesn't ring while the session is being served, so
+         * serve its next request right away */
+        if (!shm_ring_is_empty(&channel->requests)) {
+            read_priority(session);
+            enqueue_session(session);
+            return 0;
+        }
+
+        atomic_store(&channel->server_idle, 1);
+        /* the client may have sent a request before seeing the flag, in
+         * which case it only rings if it was the one to clear the flag */
+        if (!shm_ring_is_empty(&channel->requests) &&
+            atomic_exchange(&channel->server_idle, 0) == 1) {
+            read_priority(session);
+            enqueue_session(session);
+            return 0;
+        }
+    }
+    return watch_session(session, EPOLL_CTL_MOD);
 }
 
-int parse_tfs_read_packet(worker_t *worker) {
-    read_pipe(pipe_in, &worker->packet.fhandle, sizeof(int));
-    read_pipe(pipe_in, &worker->packet.len, sizeof(size_t));
+ssize_t session_read(session_t *session, void *buffer, size_t size) {
+    if (session->channel != NULL) {
+        return shm_ring_read(&session->channel->requests, buffer, size);
+    }
+    return try_read_all(session->pipe_in, buffer, size);
+}
 
+ssize_t session_write(session_t *session, void const *buffer, size_t size) {
+    if (session->channel != NULL) {
+        if (shm_ring_put(&session->channel->responses, buffer, size) != 0) {
+            return -1;
+        }
+        return (ssize_t)size;
+    }
+    ssize_t written = try_write_all(session->pipe_out, buffer, size);
+    if (written < 0 && errno == EPIPE) {
+        mark_client_gone(session);
+    }
+    return written;
+}
+
+ssize_t session_writev(session_t *session, struct iovec *iov, int iovcnt) {
+    if (session->channel != NULL) {
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (shm_ring_put(&session->channel->responses, iov[i].iov_base,
+                             iov[i].iov_len) != 0) {
+                return -1;
+            }
+            total += iov[i].iov_len;
+        }
+        return (ssize_t)total;
+    }
+    ssize_t written = try_writev_all(session->pipe_out, iov, iovcnt);
+    if (written < 0 && errno == EPIPE) {
+        mark_client_gone(session);
+    }
+    return written;
+}
+
+void mark_client_gone(session_t *session) {
+    mutex_lock(&session->activity_lock);
+    session->client_gone = true;
+    mutex_unlock(&session->activity_lock);
+}
+
+int session_write_frame(session_t *session, ssize_t result,
+                        void const *buffer) {
+    size_t len = result > 0 ? (size_t)result : 0;
+    struct iovec iov[2] = {{&result, sizeof(ssize_t)},
+                           {(void *)buffer, len}};
+    if (session_writev(session, iov, len > 0 ? 2 : 1) !=
+        (ssize_t)(sizeof(ssize_t) + len)) {
+        return -1;
+    }
     return 0;
 }
 
-void wrap_packet_parser_fn(int parser_fn(worker_t *), char op_code) {
-    int session_id;
-    if (try_read(pipe_in, &session_id, sizeof(int)) != sizeof(int)) {
-        perror("Could not read from server pipe");
+void session_flush(session_t *session) {
+    if (session->channel != NULL) {
+        shm_ring_flush(&session->channel->responses);
+    }
+}
+
+void *session_dispatcher(void *args) {
+    (void)args;
+    struct epoll_event events[SIMULTANEOUS_CONNECTIONS];
+    while (true) {
+        int count = epoll_wait(epoll_fd, events, SIMULTANEOUS_CONNECTIONS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to wait for requests");
+            close_server(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; ++i) {
+            session_t *session = (session_t *)events[i].data.ptr;
+            /* unless the reaper took it first */
+            if (claim_session(session)) {
+                session->doorbell_rung = true;
+                read_priority(session);
+                enqueue_session(session);
+            }
+        }
+    }
+}
+
+void read_priority(session_t *session) {
+    /* with shared memory, the request pipe only carried the doorbell, and
+     * the client put the request in the ring before ringing it. So if the
+     * ring is empty, the client is gone (and its ring is never closed, so
+     * reading it would block the dispatcher for good): reading the request
+     * fails on the missing doorbell instead */
+    char priority;
+    ssize_t result = -1;
+    if (session->channel != NULL) {
+        if (!shm_ring_is_empty(&session->channel->requests)) {
+            result = shm_ring_read(&session->channel->requests, &priority,
+                                   sizeof(char));
+        }
+    } else {
+        result = try_read(session->pipe_in, &priority, sizeof(char));
+    }
+
+    if (result == sizeof(char) && priority == TFS_PRIORITY_INTERACTIVE) {
+        session->priority = TFS_PRIORITY_INTERACTIVE;
+    } else {
+        session->priority = TFS_PRIORITY_BULK;
+    }
+}
+
+void enqueue_session(session_t *session) {
+    mutex_lock(&work_queue_lock);
+    work_queue_t *queue = &work_queues[(int)session->priority];
+    while (queue->count == WORK_QUEUE_SIZE) {
+        if (pthread_cond_wait(&work_queue_not_full, &work_queue_lock) != 0) {
+            perror("Failed to wait for condition variable");
+            close_server(EXIT_FAILURE);
+        }
+    }
+
+    queue->sessions[(queue->head + queue->count) % WORK_QUEUE_SIZE] = session;
+    queue->count++;
+    work_queue_count++;
+
+    if (pthread_cond_signal(&work_queue_not_empty) != 0) {
+        perror("Couldn't signal worker");
         close_server(EXIT_FAILURE);
     }
-    if (session_id < 0 || session_id >= SIMULTANEOUS_CONNECTIONS) {
-        fprintf(stderr, "session_id %d is invalid when parsing packet\n",
-                session_id);
+    mutex_unlock(&work_queue_lock);
+}
+
+session_t *dequeue_session() {
+    mutex_lock(&work_queue_lock);
+    session_t *session = NULL;
+    while (true) {
+        /* the interactive class first */
+        bool over_limits = false;
+        struct timespec ready_at;
+        for (int i = 0; i < TFS_PRIORITY_CLASSES && session == NULL; ++i) {
+            struct timespec class_ready_at;
+            session = next_session(&work_queues[i], &class_ready_at);
+            if (session == NULL && work_queues[i].count > 0 &&
+                (!over_limits || timespec_before(&class_ready_at, &ready_at))) {
+                ready_at = class_ready_at;
+                over_limits = true;
+            }
+        }
+        if (session != NULL) {
+            break;
+        }
+
+        if (workers_to_retire > 0) {
+            workers_to_retire--;
+            mutex_unlock(&work_queue_lock);
+            return NULL;
+        }
+        int result;
+        if (work_queue_count == 0) {
+            result = pthread_cond_wait(&work_queue_not_empty, &work_queue_lock);
+        } else {
+            result = pthread_cond_timedwait(&work_queue_not_empty,
+                                            &work_queue_lock, &ready_at);
+        }
+        if (result != 0 && result != ETIMEDOUT) {
+            perror("Failed to wait for condition variable");
+            close_server(EXIT_FAILURE);
+        }
+    }
+    work_queue_count--;
+    busy_workers++;
+
+    if (pthread_cond_signal(&work_queue_not_full) != 0) {
+        perror("Couldn't signal dispatcher");
         close_server(EXIT_FAILURE);
     }
+    mutex_unlock(&work_queue_lock);
+    return session;
+}
 
-    worker_t *worker = &workers[session_id];
-    mutex_lock(&worker->lock);
-    worker->packet.opcode = op_code;
+session_t *next_session(work_queue_t *queue, struct timespec *ready_at) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* every session in the queue is skipped at most once while over its
+     * limits, and the others are skipped until they get enough to spend */
+    size_t over_limits = 0;
+    while (over_limits < queue->count) {
+        session_t *session = queue->sessions[queue->head];
+        queue->head = (queue->head + 1) % WORK_QUEUE_SIZE;
+
+        struct timespec session_ready_at;
+        if (!session_within_limits(session, &now, &session_ready_at)) {
+            if (over_limits == 0 ||
+                timespec_before(&session_ready_at, ready_at)) {
+                *ready_at = session_ready_at;
+            }
+            over_limits++;
+        } else if (session->deficit <= 0) {
+            session->deficit += DRR_QUANTUM;
+            over_limits = 0;
+        } else {
+            queue->count--;
+            return session;
+        }
 
-    int result = 0;
-    if (parser_fn != NULL) {
-        result = parser_fn(worker);
+        /* back to the tail */
+        queue->sessions[(queue->head + queue->count - 1) % WORK_QUEUE_SIZE] =
+            session;
     }
+    return NULL;
+}
 
-    if (result == 0) {
-        worker->to_execute = true;
-        if (pthread_cond_signal(&worker->cond) != 0) {
-            perror("Couldn't signal worker");
+bool session_within_limits(session_t *session, struct timespec const *now,
+                           struct timespec *ready_at) {
+    /* reaped sessions are only closed */
+    if (!session->limited || session->reaped) {
+        return true;
+    }
+
+    double elapsed =
+        (double)(now->tv_sec - session->tokens_refilled.tv_sec) +
+        (double)(now->tv_nsec - session->tokens_refilled.tv_nsec) / 1e9;
+    session->tokens_refilled = *now;
+
+    /* how long until both buckets stop being negative */
+    double wait = 0;
+    if (session->iops_limit > 0) {
+        double limit = (double)session->iops_limit;
+        session->iops_tokens += elapsed * limit;
+        if (session->iops_tokens > limit) {
+            session->iops_tokens = limit;
+        }
+        if (-session->iops_tokens / limit > wait) {
+            wait = -session->iops_tokens / limit;
+        }
+    }
+    if (session->bandwidth_limit > 0) {
+        double limit = (double)session->bandwidth_limit;
+        session->bandwidth_tokens += elapsed * limit;
+        if (session->bandwidth_tokens > limit) {
+            session->bandwidth_tokens = limit;
+        }
+        if (-session->bandwidth_tokens / limit > wait) {
+            wait = -session->bandwidth_tokens / limit;
+        }
+    }
+    if (wait <= 0) {
+        return true;
+    }
+
+    *ready_at = *now;
+    /* rounded up, so that the bucket isn't still short when woken up */
+    timespec_add_ms(ready_at, (long)(wait * 1000) + 1);
+    return false;
+}
+
+void charge_session(session_t *session, packet_t const *packet) {
+    long bytes = 0;
+    switch (packet->opcode) {
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_PUT:
+    case TFS_OP_CODE_GET:
+        bytes = (long)packet->len;
+        break;
+    default:
+        break;
+    }
+
+    mutex_lock(&work_queue_lock);
+    session->deficit -= DRR_REQUEST_COST + bytes;
+    if (session->limited) {
+        session->iops_tokens -= 1;
+        session->bandwidth_tokens -= (double)bytes;
+    }
+    mutex_unlock(&work_queue_lock);
+}
+
+void finish_session() {
+    mutex_lock(&work_queue_lock);
+    busy_workers--;
+    if (busy_workers == 0 && work_queue_count == 0) {
+        if (pthread_cond_broadcast(&work_queue_idle) != 0) {
+            perror("Couldn't signal idle workers");
             close_server(EXIT_FAILURE);
         }
-    } else {
-        /* if there is an error during the parsing of the message, discard
-         * this session */
-        if (free_worker(worker->session_id) == -1) {
-            perror("Failed to free worker");
+    }
+    mutex_unlock(&work_queue_lock);
+}
+
+void wait_for_idle_workers() {
+    mutex_lock(&work_queue_lock);
+    while (busy_workers > 0 || work_queue_count > 0) {
+        if (pthread_cond_wait(&work_queue_idle, &work_queue_lock) != 0) {
+            perror("Failed to wait for condition variable");
             close_server(EXIT_FAILURE);
         }
     }
+    mutex_unlock(&work_queue_lock);
+}
+
+int hire_worker() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, pool_worker, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_detach(tid) != 0) {
+        perror("Failed to detach worker thread");
+        close_server(EXIT_FAILURE);
+    }
+    return 0;
+}
 
-    mutex_unlock(&worker->lock);
+void retire_worker() {
+    mutex_lock(&work_queue_lock);
+    workers_to_retire++;
+    if (pthread_cond_broadcast(&work_queue_not_empty) != 0) {
+        perror("Couldn't signal workers");
+        close_server(EXIT_FAILURE);
+    }
+    mutex_unlock(&work_queue_lock);
 }
 
-void *session_worker(void *args) {
-    worker_t *worker = (worker_t *)args;
-    while (true) {
-        mutex_lock(&worker->lock);
+void start_request(session_t *session) {
+    mutex_lock(&session->requests_lock);
+    session->requests_in_flight++;
+    mutex_unlock(&session->requests_lock);
+}
+
+void end_request(session_t *session) {
+    mutex_lock(&session->requests_lock);
+    session->requests_in_flight--;
+    if (session->requests_in_flight == 0) {
+        pthread_cond_broadcast(&session->requests_done);
+    }
+    mutex_unlock(&session->requests_lock);
+}
+
+void wait_for_requests(session_t *session) {
+    mutex_lock(&session->requests_lock);
+    while (session->requests_in_flight > 0) {
+        pthread_cond_wait(&session->requests_done, &session->requests_lock);
+    }
+    mutex_unlock(&session->requests_lock);
+}
+
+int send_reply(request_t *request, void const *reply, size_t size) {
+    session_t *session = request->session;
+    int result = 0;
+
+    mutex_lock(&session->reply_lock);
+    struct iovec iov[2] = {{&request->packet.request_id, sizeof(int)},
+                           {(void *)reply, size}};
+    if (session_writev(session, iov, 2) != (ssize_t)(sizeof(int) + size)) {
+        result = -1;
+    }
+    session_flush(session);
+    mutex_unlock(&session->reply_lock);
+
+    return result;
+}
+
+bool timespec_before(struct timespec const *a, struct timespec const *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+void timespec_after_ms(struct timespec *t, long ms) {
+    clock_gettime(CLOCK_MONOTONIC, t);
+    timespec_add_ms(t, ms);
+}
+
+void timespec_add_ms(struct timespec *t, long ms) {
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (ms % 1000) * 1000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+int send_recall(recall_t const *recall) {
+    session_t *session = recall->session;
+    int request_id = LEASE_RECALL_REQUEST_ID;
+    int result = 0;
+
+    mutex_lock(&session->reply_lock);
+    struct iovec iov[3] = {{&request_id, sizeof(int)},
+                           {(void *)&recall->fhandle, sizeof(int)},
+                           {(void *)&recall->lease_id, sizeof(int)}};
+    if (session_writev(session, iov, 3) != (ssize_t)(3 * sizeof(int))) {
+        result = -1;
+    }
+    session_flush(session);
+    mutex_unlock(&session->reply_lock);
 
-        while (!worker->to_execute) {
-            if (pthread_cond_wait(&worker->cond, &worker->lock) != 0) {
-                perror("Failed to wait for condition variable");
-                close_server(EXIT_FAILURE);
+    return result;
+}
+
+void send_recalls(recall_t const *recalls, int count) {
+    bool failed[MAX_LEASES];
+    for (int i = 0; i < count; ++i) {
+        failed[i] = send_recall(&recalls[i]) != 0;
+        end_request(recalls[i].session);
+    }
+
+    mutex_lock(&leases_lock);
+    for (int i = 0; i < count; ++i) {
+        for (int j = 0; failed[i] && j < MAX_LEASES; ++j) {
+            lease_t *lease = &leases[j];
+            if (lease->in_use && lease->session == recalls[i].session &&
+                lease->lease_id == recalls[i].lease_id) {
+                lease->in_use = false;
+                pthread_cond_broadcast(&lease_dropped);
             }
         }
+    }
+    mutex_unlock(&leases_lock);
+}
 
-        int result = 0;
+void begin_inode_update(session_t *session, int inumber) {
+    if (inumber < 0) {
+        return;
+    }
 
-        switch (worker->packet.opcode) {
+    mutex_lock(&leases_lock);
+    inode_updates[inumber]++;
+    bool hired = false;
+    while (true) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* recalls are sent once the lock is released, as their clients may
+         * be slow to receive them (they may be busy running callbacks, or
+         * their pipes may be full) */
+        recall_t recalls[MAX_LEASES];
+        int recall_count = 0;
+        lease_t *next_to_expire = NULL;
+        for (int i = 0; i < MAX_LEASES; ++i) {
+            lease_t *lease = &leases[i];
+            if (!lease->in_use || lease->inumber != inumber) {
+                continue;
+            }
 
-        case TFS_OP_CODE_UNMOUNT:
-            result = handle_tfs_unmount(worker);
-            break;
-        case TFS_OP_CODE_OPEN:
-            result = handle_tfs_open(worker);
-            break;
-        case TFS_OP_CODE_CLOSE:
-            result = handle_tfs_close(worker);
-            break;
-        case TFS_OP_CODE_WRITE:
-            result = handle_tfs_write(worker);
-            break;
-        case TFS_OP_CODE_READ:
-            result = handle_tfs_read(worker);
-            break;
-        case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
-            result = handle_tfs_shutdown_after_all_closed(worker);
-            break;
-        default:
+            if (lease->session != session &&
+                timespec_before(&lease->expires, &now)) {
+                /* the client already stopped using it */
+                lease->in_use = false;
+                continue;
+            }
+            if (!lease->recalled) {
+                /* the session can't be closed before the recall is sent, as
+                 * it would first drop the lease, and then wait for it */
+                lease->recalled = true;
+                start_request(lease->session);
+                recalls[recall_count].session = lease->session;
+                recalls[recall_count].fhandle = lease->fhandle;
+                recalls[recall_count].lease_id = lease->lease_id;
+                recall_count++;
+            }
+            if (lease->session == session) {
+                lease->in_use = false;
+            } else if (next_to_expire == NULL ||
+                       timespec_before(&lease->expires,
+                                       &next_to_expire->expires)) {
+                next_to_expire = lease;
+            }
+        }
+        if (recall_count > 0) {
+            /* the leases whose recall fails are dropped, so look again */
+            mutex_unlock(&leases_lock);
+            send_recalls(recalls, recall_count);
+            mutex_lock(&leases_lock);
+            continue;
+        }
+        if (next_to_expire == NULL) {
             break;
         }
 
-        if (result != 0) {
-            /* if there is an error during the handling of the message, discard
+        /* the leases are given back through requests, which need a worker
+         * other than this one */
+        if (!hired) {
+            hired = hire_worker() == 0;
+        }
+
+        struct timespec deadline = next_to_expire->expires;
+        int result =
+            pthread_cond_timedwait(&lease_dropped, &leases_lock, &deadline);
+        if (result != 0 && result != ETIMEDOUT) {
+            perror("Failed to wait for condition variable");
+            close_server(EXIT_FAILURE);
+        }
+    }
+    mutex_unlock(&leases_lock);
+
+    if (hired) {
+        retire_worker();
+    }
+}
+
+void end_inode_update(int inumber) {
+    if (inumber < 0) {
+        return;
+    }
+
+    mutex_lock(&leases_lock);
+    inode_updates[inumber]--;
+    mutex_unlock(&leases_lock);
+}
+
+void drop_leases(session_t *session, int fhandle) {
+    mutex_lock(&leases_lock);
+    for (int i = 0; i < MAX_LEASES; ++i) {
+        lease_t *lease = &leases[i];
+        if (lease->in_use && (session == NULL || lease->session == session) &&
+            (fhandle == -1 || lease->fhandle == fhandle)) {
+            lease->in_use = false;
+        }
+    }
+    pthread_cond_broadcast(&lease_dropped);
+    mutex_unlock(&leases_lock);
+}
+
+int parse_tfs_open_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.file_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
+    read_session(session, &request->packet.flags, sizeof(int));
+    request->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+
+    return 0;
+}
+
+int parse_tfs_close_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+
+    return 0;
+}
+
+int parse_tfs_write_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+    read_session(session, &request->packet.len, sizeof(size_t));
+
+    /* the content is streamed by handle_tfs_write */
+    return 0;
+}
+
+int parse_tfs_read_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+    read_session(session, &request->packet.len, sizeof(size_t));
+
+    return 0;
+}
+
+int parse_tfs_lseek_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+    read_session(session, &request->packet.offset, sizeof(off_t));
+    read_session(session, &request->packet.whence, sizeof(int));
+
+    return 0;
+}
+
+int parse_tfs_ftruncate_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+    read_session(session, &request->packet.length, sizeof(off_t));
+
+    return 0;
+}
+
+int parse_tfs_fallocate_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+    read_session(session, &request->packet.offset, sizeof(off_t));
+    read_session(session, &request->packet.length, sizeof(off_t));
+
+    return 0;
+}
+
+int parse_tfs_attach_shared_memory_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.file_name,
+                 sizeof(char) * PIPE_STRING_LENGTH);
+    request->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+
+    return 0;
+}
+
+int parse_tfs_lease_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.fhandle, sizeof(int));
+
+    return 0;
+}
+
+int parse_tfs_release_lease_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.lease_id, sizeof(int));
+
+    return 0;
+}
+
+int parse_tfs_put_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.file_name,
+                 sizeof(char) * PIPE_STRING_LENGTH);
+    read_session(session, &request->packet.flags, sizeof(int));
+    read_session(session, &request->packet.len, sizeof(size_t));
+    request->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+
+    /* the content is streamed by handle_tfs_put */
+    return 0;
+}
+
+int parse_tfs_get_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.file_name,
+                 sizeof(char) * PIPE_STRING_LENGTH);
+    read_session(session, &request->packet.len, sizeof(size_t));
+    request->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+
+    return 0;
+}
+
+int parse_tfs_copy_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.file_name,
+                 sizeof(char) * PIPE_STRING_LENGTH);
+    read_session(session, &request->packet.dest_file_name,
+                 sizeof(char) * PIPE_STRING_LENGTH);
+    read_session(session, &request->packet.flags, sizeof(int));
+    request->packet.file_name[PIPE_STRING_LENGTH] = '\0';
+    request->packet.dest_file_name[PIPE_STRING_LENGTH] = '\0';
+
+    return 0;
+}
+
+int parse_tfs_set_limits_packet(request_t *request) {
+    session_t *session = request->session;
+    read_session(session, &request->packet.iops_limit, sizeof(long));
+    read_session(session, &request->packet.bandwidth_limit, sizeof(long));
+
+    return 0;
+}
+
+int read_request(request_t *request) {
+    session_t *session = request->session;
+
+    if (session->channel != NULL && session->doorbell_rung) {
+        /* the client only rings once, when the session was idle */
+        char doorbell;
+        if (try_read(session->pipe_in, &doorbell, sizeof(char)) !=
+            sizeof(char)) {
+            return -1;
+        }
+        session->doorbell_rung = false;
+    }
+
+    if (session_read(session, &request->packet.opcode, sizeof(char)) !=
+        sizeof(char)) {
+        /* the client closed its end of the pipe (or the pipe broke) */
+        return -1;
+    }
+    read_session(session, &request->packet.request_id, sizeof(int));
+
+    switch (request->packet.opcode) {
+    case TFS_OP_CODE_UNMOUNT:
+    case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+        return 0;
+    case TFS_OP_CODE_OPEN:
+        return parse_tfs_open_packet(request);
+    case TFS_OP_CODE_CLOSE:
+        return parse_tfs_close_packet(request);
+    case TFS_OP_CODE_WRITE:
+        return parse_tfs_write_packet(request);
+    case TFS_OP_CODE_READ:
+        return parse_tfs_read_packet(request);
+    case TFS_OP_CODE_LSEEK:
+        return parse_tfs_lseek_packet(request);
+    case TFS_OP_CODE_FTRUNCATE:
+        return parse_tfs_ftruncate_packet(request);
+    case TFS_OP_CODE_FALLOCATE:
+        return parse_tfs_fallocate_packet(request);
+    case TFS_OP_CODE_ATTACH_SHARED_MEMORY:
+        return parse_tfs_attach_shared_memory_packet(request);
+    case TFS_OP_CODE_LEASE:
+        return parse_tfs_lease_packet(request);
+    case TFS_OP_CODE_RELEASE_LEASE:
+        return parse_tfs_release_lease_packet(request);
+    case TFS_OP_CODE_PUT:
+        return parse_tfs_put_packet(request);
+    case TFS_OP_CODE_GET:
+        return parse_tfs_get_packet(request);
+    case TFS_OP_CODE_COPY:
+        return parse_tfs_copy_packet(request);
+    case TFS_OP_CODE_SET_LIMITS:
+        return parse_tfs_set_limits_packet(request);
+    default:
+        /* we can't know where the next request starts */
+        return -1;
+    }
+}
+
+bool holds_session(char opcode) {
+    switch (opcode) {
+    case TFS_OP_CODE_UNMOUNT:
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_ATTACH_SHARED_MEMORY:
+    case TFS_OP_CODE_PUT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int handle_request(request_t *request) {
+    switch (request->packet.opcode) {
+    case TFS_OP_CODE_UNMOUNT:
+        return handle_tfs_unmount(request);
+    case TFS_OP_CODE_OPEN:
+        return handle_tfs_open(request);
+    case TFS_OP_CODE_CLOSE:
+        return handle_tfs_close(request);
+    case TFS_OP_CODE_WRITE:
+        return handle_tfs_write(request);
+    case TFS_OP_CODE_READ:
+        return handle_tfs_read(request);
+    case TFS_OP_CODE_LSEEK:
+        return handle_tfs_lseek(request);
+    case TFS_OP_CODE_FTRUNCATE:
+        return handle_tfs_ftruncate(request);
+    case TFS_OP_CODE_FALLOCATE:
+        return handle_tfs_fallocate(request);
+    case TFS_OP_CODE_ATTACH_SHARED_MEMORY:
+        return handle_tfs_attach_shared_memory(request);
+    case TFS_OP_CODE_LEASE:
+        return handle_tfs_lease(request);
+    case TFS_OP_CODE_RELEASE_LEASE:
+        return handle_tfs_release_lease(request);
+    case TFS_OP_CODE_PUT:
+        return handle_tfs_put(request);
+    case TFS_OP_CODE_GET:
+        return handle_tfs_get(request);
+    case TFS_OP_CODE_COPY:
+        return handle_tfs_copy(request);
+    case TFS_OP_CODE_SET_LIMITS:
+        return handle_tfs_set_limits(request);
+    case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+        return start_shutdown_worker(request);
+    default:
+        return 0;
+    }
+}
+
+void *pool_worker(void *args) {
+    (void)args;
+    request_t request;
+    while (true) {
+        request.session = dequeue_session();
+        session_t *session = request.session;
+        if (session == NULL) {
+            /* retired */
+            return NULL;
+        }
+
+        if (session->reaped) {
+            close_session(session);
+        } else if (read_request(&request) != 0) {
+            /* if there is an error during the reading of the message, discard
              * this session */
-            if (free_worker(worker->session_id) == -1) {
-                perror("Failed to free worker");
-                close_server(EXIT_FAILURE);
+            close_session(session);
+        } else if (holds_session(request.packet.opcode)) {
+            touch_session(session);
+            charge_session(session, &request.packet);
+            if (handle_request(&request) != 0) {
+                close_session(session);
+            } else if (request.packet.opcode != TFS_OP_CODE_UNMOUNT &&
+                       rewatch_session(session) != 0) {
+                perror("Failed to watch session");
+                close_session(session);
+            }
+        } else {
+            /* let other workers read and handle the next requests of the
+             * session while this one is handled */
+            touch_session(session);
+            charge_session(session, &request.packet);
+            start_request(session);
+            if (rewatch_session(session) != 0) {
+                perror("Failed to watch session");
+                end_request(session);
+                close_session(session);
+            } else {
+                /* if the reply can't be sent, the client is gone, which is
+                 * noticed by whoever reads the session's next request */
+                handle_request(&request);
+                end_request(session);
             }
         }
 
-        worker->to_execute = false;
-        mutex_unlock(&worker->lock);
+        finish_session();
+    }
+}
+
+int start_shutdown_worker(request_t *request) {
+    request_t *shutdown_request = (request_t *)malloc(sizeof(request_t));
+    if (shutdown_request == NULL) {
+        return -1;
+    }
+    *shutdown_request = *request;
+
+    start_request(request->session);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, shutdown_worker, shutdown_request) != 0) {
+        end_request(request->session);
+        free(shutdown_request);
+        return -1;
+    }
+    if (pthread_detach(tid) != 0) {
+        perror("Failed to detach shutdown thread");
+        close_server(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+void *shutdown_worker(void *args) {
+    request_t *request = (request_t *)args;
+    if (handle_tfs_shutdown_after_all_closed(request) != 0) {
+        fprintf(stderr, "Failed to shutdown the server\n");
     }
+    end_request(request->session);
+    free(request);
+    return NULL;
 }
 
 int handle_tfs_mount() {
     char client_pipe_name[PIPE_STRING_LENGTH + 1];
-    read_pipe(pipe_in, client_pipe_name, sizeof(char) * PIPE_STRING_LENGTH);
+    char request_pipe_name[PIPE_STRING_LENGTH + 1];
+    read_pipe(server_pipe, client_pipe_name, sizeof(char) * PIPE_STRING_LENGTH);
+    read_pipe(server_pipe, request_pipe_name,
+              sizeof(char) * PIPE_STRING_LENGTH);
     client_pipe_name[PIPE_STRING_LENGTH] = '\0';
+    request_pipe_name[PIPE_STRING_LENGTH] = '\0';
 
-    int session_id = get_available_worker();
     int pipe_out = open(client_pipe_name, O_WRONLY);
     if (pipe_out < 0) {
         perror("Failed to open pipe");
         return -1;
     }
+    /* the client opens its request pipe right after opening its side of the
+     * response pipe */
+    int pipe_in = open(request_pipe_name, O_RDONLY);
+    if (pipe_in < 0) {
+        perror("Failed to open pipe");
+        close(pipe_out);
+        return -1;
+    }
+
+    return mount_session(pipe_in, pipe_out);
+}
+
+int mount_session(int pipe_in, int pipe_out) {
+    int session_id = get_available_session();
+    if (session_id < 0 && queue_mount(pipe_in, pipe_out) == 0) {
+        /* the client is answered once a session is freed, or when it times
+         * out */
+        return 0;
+    }
+    return admit_session(session_id, pipe_in, pipe_out);
+}
 
+int admit_session(int session_id, int pipe_in, int pipe_out) {
     if (session_id < 0) {
         printf("The number of sessions was exceeded.\n");
     } else {
-        printf("The session number %d was created with success.\n", session_id);
-        workers[session_id].pipe_out = pipe_out;
+        sessions[session_id].pipe_in = pipe_in;
+        sessions[session_id].pipe_out = pipe_out;
+        sessions[session_id].channel = NULL;
+        sessions[session_id].watched = false;
+        sessions[session_id].client_gone = false;
+        sessions[session_id].reaped = false;
+        touch_session(&sessions[session_id]);
+        /* not in the work queue yet, so the scheduler isn't looking */
+        sessions[session_id].deficit = DRR_QUANTUM;
+        sessions[session_id].limited = false;
     }
 
-    write_pipe(pipe_out, &session_id, sizeof(int));
-
-    if (session_id < 0) {
-        // we cannot mount this client, close its pipe
-        if (close(pipe_out) < 0) {
-            perror("Failed to close pipe");
+    if (try_write(pipe_out, &session_id, sizeof(int)) != sizeof(int) ||
+        session_id < 0) {
+        // we cannot mount this client, close its pipes
+        if (session_id < 0) {
+            if (close(pipe_in) < 0 ||
+                (pipe_out != pipe_in && close(pipe_out) < 0)) {
+                perror("Failed to close pipe");
+            }
+        } else {
+            close_session(&sessions[session_id]);
         }
         return -1;
     }
+
+    if (watch_session(&sessions[session_id], EPOLL_CTL_ADD) != 0) {
+        perror("Failed to watch session");
+        close_session(&sessions[session_id]);
+        return -1;
+    }
+
+    printf("The session number %d was created with success.\n", session_id);
     return 0;
 }
 
-int handle_tfs_unmount(worker_t *worker) {
+int handle_tfs_unmount(request_t *request) {
     int result = 0;
 
-    write_pipe(worker->pipe_out, &result, sizeof(int));
+    session_t *session = request->session;
 
-    if (close(worker->pipe_out) < 0) {
-        perror("Failed to close pipe");
+    /* the client gets every other reply before this one */
+    wait_for_requests(session);
+    if (send_reply(request, &result, sizeof(int)) != 0) {
+        return -1;
     }
 
-    if (free_worker(worker->session_id) == -1) {
-        perror("Failed to free worker");
-        close_server(EXIT_FAILURE);
-    }
+    close_session(session);
 
     printf("The session number %d was unmounted with success.\n",
-           worker->session_id);
+           session->session_id);
     return 0;
 }
 
-int handle_tfs_open(worker_t *worker) {
-    packet_t *packet = &worker->packet;
+int handle_tfs_open(request_t *request) {
+    packet_t *packet = &request->packet;
 
+    /* truncating the file changes it */
+    int inumber = -1;
+    if (packet->flags & TFS_O_TRUNC) {
+        inumber = tfs_lookup(packet->file_name);
+    }
+    begin_inode_update(request->session, inumber);
     int result = tfs_open(packet->file_name, packet->flags);
-    write_pipe(worker->pipe_out, &result, sizeof(int));
-    return 0;
+    end_inode_update(inumber);
+
+    /* the client gets a handle of the session, not of the file system */
+    int fhandle = own_fhandle(request->session, result);
+    if (result != -1 && fhandle == -1) {
+        tfs_close(result);
+    }
+    return send_reply(request, &fhandle, sizeof(int));
 }
 
-int handle_tfs_close(worker_t *worker) {
-    packet_t *packet = &worker->packet;
+int handle_tfs_close(request_t *request) {
+    packet_t *packet = &request->packet;
 
-    int result = tfs_close(packet->fhandle);
-    write_pipe(worker->pipe_out, &result, sizeof(int));
+    /* before the handle of the file system can be taken again */
+    int fhandle = disown_fhandle(request->session, packet->fhandle);
+    int result = tfs_close(fhandle);
+    if (result == 0) {
+        drop_leases(request->session, packet->fhandle);
+    }
+    return send_reply(request, &result, sizeof(int));
+}
 
-    return 0;
+int handle_tfs_write(request_t *request) {
+    int fhandle = session_fhandle(request->session, request->packet.fhandle);
+    int inumber = tfs_inumber(fhandle);
+    begin_inode_update(request->session, inumber);
+    ssize_t written;
+    int result = stream_tfs_write(request, fhandle, &written);
+    end_inode_update(inumber);
+    if (fhandle != -1) {
+        put_fhandle(request->session, request->packet.fhandle);
+    }
+    if (result != 0) {
+        return -1;
+    }
+    return send_reply(request, &written, sizeof(ssize_t));
 }
 
-int handle_tfs_write(worker_t *worker) {
-    packet_t *packet = &worker->packet;
+int stream_tfs_write(request_t *request, int fhandle, ssize_t *written) {
+    packet_t *packet = &request->packet;
+    session_t *session = request->session;
 
-    int result = (int)tfs_write(packet->fhandle, packet->buffer, packet->len);
-    write_pipe(worker->pipe_out, &result, sizeof(int));
+    /* with shared memory, the content is used right where the client put it
+     * (unless it wraps around the end of the ring, or doesn't fit in it) */
+    char *content = NULL;
+    if (session->channel != NULL) {
+        content = shm_ring_peek(&session->channel->requests, packet->len);
+    }
+    if (content != NULL) {
+        *written = tfs_write(fhandle, content, packet->len);
+        shm_ring_consume(&session->channel->requests, packet->len);
+        return 0;
+    }
 
-    free(worker->packet.buffer);
+    /* otherwise it is written to the file one chunk at a time. The whole
+     * content is read even if the file can't take it, or the next request
+     * would start in the middle of it */
+    char buffer[STREAM_CHUNK_SIZE];
+    *written = 0;
+    bool stopped = false;
+    size_t done = 0;
+    do {
+        size_t chunk = packet->len - done;
+        if (chunk > STREAM_CHUNK_SIZE) {
+            chunk = STREAM_CHUNK_SIZE;
+        }
+        read_session(session, buffer, chunk);
+        done += chunk;
 
+        if (stopped) {
+            continue;
+        }
+        ssize_t chunk_written = tfs_write(fhandle, buffer, chunk);
+        if (chunk_written < 0) {
+            /* like write, only fail if nothing was written */
+            if (*written == 0) {
+                *written = -1;
+            }
+            stopped = true;
+        } else {
+            *written += chunk_written;
+            /* the file is full */
+            stopped = (size_t)chunk_written < chunk;
+        }
+    } while (done < packet->len);
     return 0;
 }
 
-int handle_tfs_read(worker_t *worker) {
-    packet_t *packet = &worker->packet;
-    char *buffer = (char *)malloc(sizeof(char) * packet->len);
-    if (buffer == NULL) {
+int handle_tfs_read(request_t *request) {
+    int fhandle = session_fhandle(request->session, request->packet.fhandle);
+    int result = stream_tfs_read(request, fhandle);
+    if (fhandle != -1) {
+        put_fhandle(request->session, request->packet.fhandle);
+    }
+    return result;
+}
+
+int stream_tfs_read(request_t *request, int fhandle) {
+    packet_t *packet = &request->packet;
+    session_t *session = request->session;
+    char buffer[STREAM_CHUNK_SIZE];
+    int reply_result = 0;
+
+    /* the content is sent in frames of up to STREAM_CHUNK_SIZE bytes, each
+     * preceded by its size. The stream ends once len bytes are sent, or with
+     * a frame of size 0 (end of file) or -1 (error) */
+    mutex_lock(&session->reply_lock);
+    if (session_write(session, &packet->request_id, sizeof(int)) !=
+        sizeof(int)) {
+        reply_result = -1;
+    }
+    size_t done = 0;
+    while (reply_result == 0) {
+        size_t chunk = packet->len - done;
+        if (chunk > STREAM_CHUNK_SIZE) {
+            chunk = STREAM_CHUNK_SIZE;
+        }
+        ssize_t result = tfs_read(fhandle, buffer, chunk);
+        if (session_write_frame(session, result, buffer) != 0) {
+            reply_result = -1;
+        }
+        if (result <= 0) {
+            break;
+        }
+        done += (size_t)result;
+        if (done == packet->len) {
+            break;
+        }
+    }
+    session_flush(session);
+    mutex_unlock(&session->reply_lock);
+
+    return reply_result;
+}
+
+int handle_tfs_put(request_t *request) {
+    packet_t *packet = &request->packet;
+
+    /* the same steps as handle_tfs_open and handle_tfs_write. If the file
+     * can't be opened, the content is still read (and the write fails) */
+    int inumber = -1;
+    if (packet->flags & TFS_O_TRUNC) {
+        inumber = tfs_lookup(packet->file_name);
+    }
+    begin_inode_update(request->session, inumber);
+    int fhandle = tfs_open(packet->file_name, packet->flags);
+    end_inode_update(inumber);
+
+    inumber = tfs_inumber(fhandle);
+    begin_inode_update(request->session, inumber);
+    ssize_t written;
+    int result = stream_tfs_write(request, fhandle, &written);
+    end_inode_update(inumber);
+
+    if (fhandle != -1 && tfs_close(fhandle) != 0) {
+        written = -1;
+    }
+    if (result != 0) {
         return -1;
     }
+    return send_reply(request, &written, sizeof(ssize_t));
+}
+
+int handle_tfs_get(request_t *request) {
+    packet_t *packet = &request->packet;
+
+    /* if the file can't be opened, the read fails, replying with a frame of
+     * size -1 */
+    int fhandle = tfs_open(packet->file_name, 0);
+    int result = stream_tfs_read(request, fhandle);
+    if (fhandle != -1) {
+        tfs_close(fhandle);
+    }
+    return result;
+}
+
+int handle_tfs_copy(request_t *request) {
+    packet_t *packet = &request->packet;
 
-    int result = (int)tfs_read(packet->fhandle, buffer, packet->len);
+    /* the destination is changed (unless it doesn't exist yet) */
+    int inumber = tfs_lookup(packet->dest_file_name);
+    begin_inode_update(request->session, inumber);
+    int result =
+        tfs_copy(packet->file_name, packet->dest_file_name, packet->flags);
+    end_inode_update(inumber);
+    return send_reply(request, &result, sizeof(int));
+}
+
+int handle_tfs_lseek(request_t *request) {
+    packet_t *packet = &request->packet;
 
-    write_pipe(worker->pipe_out, &result, sizeof(int));
+    int fhandle = session_fhandle(request->session, packet->fhandle);
+    off_t result = tfs_lseek(fhandle, packet->offset, packet->whence);
+    if (fhandle != -1) {
+        put_fhandle(request->session, packet->fhandle);
+    }
+    return send_reply(request, &result, sizeof(off_t));
+}
+
+int handle_tfs_ftruncate(request_t *request) {
+    packet_t *packet = &request->packet;
+
+    int fhandle = session_fhandle(request->session, packet->fhandle);
+    int inumber = tfs_inumber(fhandle);
+    begin_inode_update(request->session, inumber);
+    int result = tfs_ftruncate(fhandle, packet->length);
+    end_inode_update(inumber);
+    if (fhandle != -1) {
+        put_fhandle(request->session, packet->fhandle);
+    }
+    return send_reply(request, &result, sizeof(int));
+}
+
+int handle_tfs_fallocate(request_t *request) {
+    packet_t *packet = &request->packet;
+
+    int fhandle = session_fhandle(request->session, packet->fhandle);
+    int inumber = tfs_inumber(fhandle);
+    begin_inode_update(request->session, inumber);
+    int result = tfs_fallocate(fhandle, packet->offset, packet->length);
+    end_inode_update(inumber);
+    if (fhandle != -1) {
+        put_fhandle(request->session, packet->fhandle);
+    }
+    return send_reply(request, &result, sizeof(int));
+}
+
+int handle_tfs_attach_shared_memory(request_t *request) {
+    session_t *session = request->session;
+
+    shm_channel_t *channel = MAP_FAILED;
+    int fd = shm_open(request->packet.file_name, O_RDWR, 0);
+    if (fd >= 0) {
+        channel = (shm_channel_t *)mmap(NULL, sizeof(shm_channel_t),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED,
+                                        fd, 0);
+        close(fd);
+    }
+
+    int result = 0;
+    if (channel == MAP_FAILED) {
+        result = -1;
+    } else if (session->channel != NULL) {
+        munmap(channel, sizeof(shm_channel_t));
+        result = -1;
+    } else {
+        /* the client rings for its first request through the rings */
+        atomic_store(&channel->server_idle, 1);
+    }
 
-    if (result > 0) {
-        write_pipe(worker->pipe_out, buffer, (size_t)result * sizeof(char));
+    /* the reply still goes through the pipe, the client only starts using
+     * the rings after getting it (and after every other reply) */
+    wait_for_requests(session);
+    if (send_reply(request, &result, sizeof(int)) != 0) {
+        if (result == 0) {
+            munmap(channel, sizeof(shm_channel_t));
+        }
+        return -1;
     }
-    free(buffer);
 
+    if (result == 0) {
+        session->channel = channel;
+    }
     return 0;
 }
 
-int handle_tfs_shutdown_after_all_closed(worker_t *worker) {
+int handle_tfs_lease(request_t *request) {
+    packet_t *packet = &request->packet;
+    session_t *session = request->session;
+    char buffer[STREAM_CHUNK_SIZE];
+
+    int fhandle = session_fhandle(session, packet->fhandle);
+    int inumber = tfs_inumber(fhandle);
+    off_t offset = tfs_lseek(fhandle, 0, SEEK_CUR);
+    int lease_id = -1;
+    if (inumber != -1 && offset != -1) {
+        mutex_lock(&leases_lock);
+        /* whoever changes the file after this recalls the lease, so the
+         * contents sent below are the latest unless the client is told */
+        for (int i = 0; i < MAX_LEASES && inode_updates[inumber] == 0; ++i) {
+            lease_t *lease = &leases[i];
+            if (!lease->in_use) {
+                lease->in_use = true;
+                lease->lease_id = next_lease_id;
+                lease->session = session;
+                lease->fhandle = packet->fhandle;
+                lease->inumber = inumber;
+                lease->recalled = false;
+                timespec_after_ms(&lease->expires, LEASE_DURATION_MS);
+                lease_id = next_lease_id;
+                next_lease_id = (next_lease_id + 1) % INT_MAX;
+                break;
+            }
+        }
+        mutex_unlock(&leases_lock);
+    }
+
+    int reply_result = 0;
+    mutex_lock(&session->reply_lock);
+    struct iovec iov[3] = {{&packet->request_id, sizeof(int)},
+                           {&lease_id, sizeof(int)},
+                           {&offset, sizeof(off_t)}};
+    if (session_writev(session, iov, 3) !=
+        (ssize_t)(2 * sizeof(int) + sizeof(off_t))) {
+        reply_result = -1;
+    }
+    /* the whole file, in the same frames as handle_tfs_read, ending with a
+     * frame of size 0 (or -1) */
+    off_t done = 0;
+    while (reply_result == 0 && lease_id != -1) {
+        ssize_t result =
+            tfs_pread(fhandle, buffer, STREAM_CHUNK_SIZE, done);
+        if (session_write_frame(session, result, buffer) != 0) {
+            reply_result = -1;
+        }
+        if (result <= 0) {
+            break;
+        }
+        done += result;
+    }
+    session_flush(session);
+    mutex_unlock(&session->reply_lock);
+    if (fhandle != -1) {
+        put_fhandle(session, packet->fhandle);
+    }
+
+    return reply_result;
+}
+
+int handle_tfs_release_lease(request_t *request) {
+    int result = -1;
+
+    mutex_lock(&leases_lock);
+    for (int i = 0; i < MAX_LEASES; ++i) {
+        lease_t *lease = &leases[i];
+        if (lease->in_use && lease->session == request->session &&
+            lease->lease_id == request->packet.lease_id) {
+            lease->in_use = false;
+            pthread_cond_broadcast(&lease_dropped);
+            result = 0;
+            break;
+        }
+    }
+    mutex_unlock(&leases_lock);
+
+    return send_reply(request, &result, sizeof(int));
+}
+
+int handle_tfs_set_limits(request_t *request) {
+    packet_t *packet = &request->packet;
+    session_t *session = request->session;
+    int result = -1;
+
+    mutex_lock(&work_queue_lock);
+    if (!session->limited && packet->iops_limit >= 0 &&
+        packet->bandwidth_limit >= 0) {
+        /* the buckets start full */
+        session->limited = true;
+        session->iops_limit = packet->iops_limit;
+        session->bandwidth_limit = packet->bandwidth_limit;
+        session->iops_tokens = (double)packet->iops_limit;
+        session->bandwidth_tokens = (double)packet->bandwidth_limit;
+        clock_gettime(CLOCK_MONOTONIC, &session->tokens_refilled);
+        result = 0;
+    }
+    mutex_unlock(&work_queue_lock);
+
+    return send_reply(request, &result, sizeof(int));
+}
+
+int handle_tfs_shutdown_after_all_closed(request_t *request) {
     int result = tfs_destroy_after_all_closed();
-    write_pipe(worker->pipe_out, &result, sizeof(int));
+    if (send_reply(request, &result, sizeof(int)) != 0) {
+        return -1;
+    }
 
     if (unlink(pipename) != 0 && errno != ENOENT) {
         perror("Failed to delete pipe");
         exit(EXIT_FAILURE);
     }
 
+    /* let the workers reply to the requests they are handling, such as the
+     * closing of the last open files, which we were waiting for */
+    wait_for_idle_workers();
+
     printf("\nSuccessfully ended the server, as requested by client.\n");
     exit(EXIT_SUCCESS);
 
@@ -414,7 +1959,7 @@ void close_server_by_user(int singnum) {
 }
 
 void close_server(int status) {
-    if (close(pipe_in) < 0) {
+    if (close(server_pipe) < 0) {
         perror("Failed to close pipe");
         exit(EXIT_FAILURE);
     }
@@ -2,50 +2,529 @@
 #define TFS_SERVER_H
 
 #include "common/common.h"
+#include "common/shm_ring.h"
 #include "config.h"
 #include <pthread.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* Represents a packet */
 typedef struct {
     char opcode;
+    // sent back before the reply, as replies may be sent out of order
+    int request_id;
     char client_pipe[PIPE_STRING_LENGTH + 1];
     char file_name[PIPE_STRING_LENGTH + 1];
+    char dest_file_name[PIPE_STRING_LENGTH + 1];
     int flags;
     int fhandle;
     size_t len;
-    char *buffer;
+    off_t offset;
+    int whence;
+    off_t length;
+    int lease_id;
+    long iops_limit;
+    long bandwidth_limit;
 } packet_t;
 
-/* Represents a worker */
+/* Represents a client session, which isn't tied to any thread. Requests are
+ * read from the session's own request pipe and replies written to its
+ * response pipe (with sockets, both are the session's connection). Once the
+ * client attaches a shared memory region, requests and replies go through
+ * its rings instead, and the request pipe only carries the client's
+ * doorbell.
+ * Only one worker reads the requests of a session at a time, but several of
+ * them may be handling requests of the same session, replying in whatever
+ * order they finish. */
 typedef struct {
     int session_id;
-    packet_t packet;
+    int pipe_in;
+    int pipe_out;
+    shm_channel_t *channel;
+    // whether the session was queued because its request pipe is readable
+    bool doorbell_rung;
+    // priority class of the session's next request, which is read ahead of
+    // it when the session is queued
+    char priority;
+    bool in_use;
+    // held while a reply is written, so that replies don't interleave
+    pthread_mutex_t reply_lock;
+    // requests being handled after the session's next request could be read
+    int requests_in_flight;
+    pthread_mutex_t requests_lock;
+    pthread_cond_t requests_done;
+    // guards the fields below, which the reaper uses to find sessions that
+    // are idle or whose client is gone
+    pthread_mutex_t activity_lock;
+    // whether the session is waiting for its next request in the epoll
+    // instance (and so isn't queued or being served)
+    bool watched;
+    // when the last request of the session was read
+    struct timespec last_active;
+    // whether writing a reply failed because the client is gone (EPIPE)
+    bool client_gone;
+    // whether the reaper took the session for a worker to close it
+    bool reaped;
+    // the file handles of the file system that the session opened, indexed
+    // by the handles its client uses (-1 if free)
+    int fhandles[MAX_OPEN_FILES];
+    // how many requests are using each of the handles above, which closing
+    // it waits for, so the file handle isn't given to someone else under
+    // them
+    int fhandle_users[MAX_OPEN_FILES];
+    pthread_mutex_t fhandles_lock;
+    pthread_cond_t fhandle_unused;
+    // the fields below are used by the scheduler, under work_queue_lock
+    // what the session can still spend before its turn ends (negative if it
+    // overspent), in deficit round robin
+    long deficit;
+    // whether the client set the limits below (which it can only do once),
+    // in requests and bytes per second (0 for no limit)
+    bool limited;
+    long iops_limit;
+    long bandwidth_limit;
+    // token buckets for the limits, which hold up to a second worth of
+    // tokens and are refilled as time goes by (a request is served as long
+    // as they aren't negative, and then takes what it costs)
+    double iops_tokens;
+    double bandwidth_tokens;
+    struct timespec tokens_refilled;
+} session_t;
+
+/* Represents the sessions whose next request is of a priority class, in a
+ * circular buffer, in the order they take turns */
+typedef struct {
+    session_t *sessions[WORK_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+} work_queue_t;
+
+/* Represents a mount waiting for a session to be freed, which is rejected if
+ * none is by the deadline */
+typedef struct {
+    int pipe_in;
     int pipe_out;
-    bool to_execute;
-    pthread_t tid;
-    pthread_mutex_t lock;
-    pthread_cond_t cond;
-} worker_t;
+    struct timespec deadline;
+} pending_mount_t;
+
+/* Represents a read lease, which lets a session cache the contents of a file
+ * it opened until the lease expires or is recalled (when someone changes the
+ * file) */
+typedef struct {
+    bool in_use;
+    int lease_id;
+    session_t *session;
+    // the file handle of the session the lease was taken through
+    int fhandle;
+    int inumber;
+    // whether the session was asked to give the lease back
+    bool recalled;
+    struct timespec expires;
+} lease_t;
+
+/* Represents a recall of a lease, copied out of the lease so that it can be
+ * sent once leases_lock is released */
+typedef struct {
+    session_t *session;
+    int fhandle;
+    int lease_id;
+} recall_t;
+
+/* Represents a request of a session */
+typedef struct {
+    session_t *session;
+    packet_t packet;
+} request_t;
+
+/*
+ * Listens for mount requests on the server's named pipe.
+ */
+void run_pipe_listener();
+
+/*
+ * Listens for connections on the server's Unix domain socket, mounting a new
+ * session for each one.
+ */
+void run_socket_listener();
 
 /*
- * Initializes the server.
+ * Initializes the server, starting a pool of worker threads with one thread
+ * per online processor, and the dispatcher thread that feeds it.
  * Returns 0 if successful, -1 otherwise.
  */
 int init_server();
 
 /*
- * Returns a worker.
- * Returns session_id if there is a worker available, -1 otherwise.
+ * Takes the first free session. Must be called with sessions_lock held.
+ * Returns session_id if there is a session available, -1 otherwise.
+ */
+int take_session();
+
+/*
+ * Returns a session.
+ * Returns session_id if there is a session available, -1 otherwise.
+ */
+int get_available_session();
+
+/*
+ * Changes the state of the session to free, letting the oldest waiting
+ * mount (if any) take it.
+ * Returns 0 if successful, -1 if session is already free.
+ */
+int free_session(int session_id);
+
+/*
+ * Queues a mount that found no free session, to wait for one for up to
+ * MOUNT_WAIT_TIMEOUT_MS.
+ * Input:
+ * - pipe_in: file descriptor of the request pipe (or socket)
+ * - pipe_out: file descriptor of the response pipe (or socket)
+ * Returns 0 if successful, -1 if there are already MOUNT_QUEUE_SIZE mounts
+ * waiting.
+ */
+int queue_mount(int pipe_in, int pipe_out);
+
+/*
+ * The admission thread main function: gives the sessions that are freed to
+ * the waiting mounts, oldest first, and rejects the mounts that time out.
+ */
+void *mount_admitter(void *args);
+
+/*
+ * Waits for the requests in flight of a session to be handled, and then
+ * closes the file handles it opened and its pipes, and frees it.
+ * Input:
+ * - session: session to be closed
+ */
+void close_session(session_t *session);
+
+/*
+ * Takes a session that is waiting for a request out of the dispatcher's (and
+ * the reaper's) reach, so that only the caller queues it.
+ * Returns true if the session was waiting, false if someone took it first.
+ */
+bool claim_session(session_t *session);
+
+/*
+ * Records that a request of the session was just read.
+ */
+void touch_session(session_t *session);
+
+/*
+ * Records that writing to the client of the session failed with EPIPE.
+ */
+void mark_client_gone(session_t *session);
+
+/*
+ * Returns true if the client of the session is gone: writing to it failed
+ * with EPIPE, or its response pipe (or socket) reports so.
+ */
+bool client_gone(session_t *session);
+
+/*
+ * The reaper thread main function: every SESSION_REAP_INTERVAL_MS, takes the
+ * sessions that are waiting for a request and have been idle for
+ * SESSION_IDLE_TIMEOUT_MS, or whose client is gone, and queues them for a
+ * worker to close them (which also closes their file handles).
+ */
+void *session_reaper(void *args);
+
+/*
+ * Gives a file handle of the file system that a session opened a handle of
+ * the session's own, which is the one its client uses.
+ * Input:
+ * - session: session that opened the file handle
+ * - fhandle: file handle of the file system, or -1 if the open failed
+ * Returns the handle of the session, or -1 if fhandle is -1.
+ */
+int own_fhandle(session_t *session, int fhandle);
+
+/*
+ * Finds the file handle of the file system behind a handle of a session,
+ * which can't be closed until it is given back with put_fhandle.
+ * Input:
+ * - session: session whose client sent the handle
+ * - fhandle: handle of the session
+ * Returns the file handle of the file system, or -1 if the session has no
+ * such handle (it's not one the session opened, or it was closed).
+ */
+int session_fhandle(session_t *session, int fhandle);
+
+/*
+ * Gives back a handle of a session that session_fhandle found.
+ * Input:
+ * - session: session whose client sent the handle
+ * - fhandle: handle of the session
+ */
+void put_fhandle(session_t *session, int fhandle);
+
+/*
+ * Takes a handle away from a session, before the file handle of the file
+ * system behind it is closed (and can be given to someone else), waiting
+ * for the requests that are still using it.
+ * Input:
+ * - session: session whose client sent the handle
+ * - fhandle: handle of the session
+ * Returns the file handle of the file system, or -1 if the session has no
+ * such handle.
+ */
+int disown_fhandle(session_t *session, int fhandle);
+
+/*
+ * Closes the file handles that a session opened and didn't close.
+ */
+void release_fhandles(session_t *session);
+
+/*
+ * Makes the dispatcher queue the session (once) as soon as its request pipe
+ * has a request to be read.
+ * Input:
+ * - session: session to be watched
+ * - op: EPOLL_CTL_ADD for a new session, EPOLL_CTL_MOD for a session that
+ *   was already being watched
+ * Returns 0 if successful, -1 otherwise.
+ */
+int watch_session(session_t *session, int op);
+
+/*
+ * Waits for the next request of a session that was just served. With shared
+ * memory, the session is queued right away if there is already a request in
+ * its ring; otherwise it is marked as idle, so that the client rings.
+ * Input:
+ * - session: session to be watched
+ * Returns 0 if successful, -1 otherwise.
+ */
+int rewatch_session(session_t *session);
+
+/*
+ * Reads from the requests of a session (its pipe, or its request ring).
+ * Returns the number of bytes read, or -1 on error.
+ */
+ssize_t session_read(session_t *session, void *buffer, size_t size);
+
+/*
+ * Writes to the replies of a session (its pipe, or its response ring).
+ * Returns the number of bytes written, or -1 on error.
+ */
+ssize_t session_write(session_t *session, void const *buffer, size_t size);
+
+/*
+ * Same as session_write, but gathers the content from iovcnt buffers, so that
+ * a reply and its header don't have to be copied into one first.
+ * Returns the number of bytes written, or -1 on error.
+ */
+ssize_t session_writev(session_t *session, struct iovec *iov, int iovcnt);
+
+/*
+ * Writes a frame of streamed content: its size (result), followed by the
+ * content in buffer when result is positive. A result of 0 (end of file) or
+ * -1 (error) ends the stream.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int session_write_frame(session_t *session, ssize_t result,
+                        void const *buffer);
+
+/*
+ * Makes what was written to the response ring of a session visible to the
+ * client (nothing to do for pipes and sockets).
+ */
+void session_flush(session_t *session);
+
+/*
+ * The dispatcher thread main function, it waits for requests on the request
+ * pipes of every session and queues the sessions that have one.
+ * Input:
+ * - args: unused
  */
-int get_available_worker();
+void *session_dispatcher(void *args);
 
 /*
- * Changes the state of the worker to free.
- * Returns 0 if successful, -1 if worker is already free.
+ * Reads the priority class that comes ahead of the next request of a
+ * session that has one, before it is queued, without ever blocking (it is
+ * called by the dispatcher). If it can't be read, the session is queued as
+ * bulk, and reading the request fails too.
+ * Input:
+ * - session: session with a pending request
  */
-int free_worker(int session_id);
+void read_priority(session_t *session);
+
+/*
+ * Adds a session to the tail of the work queue of the priority class of its
+ * next request, waiting while it is full.
+ * Input:
+ * - session: session with a pending request
+ */
+void enqueue_session(session_t *session);
+
+/*
+ * Removes the next session to be served from the work queues, waiting while
+ * they are empty or every session in them is over its limits. The sessions
+ * whose next request is interactive are served first, and the bulk ones only
+ * when there are none (that are within their limits). In each work queue,
+ * sessions are served in deficit round robin: the session at the head is
+ * served if it has something left to spend, and otherwise gets DRR_QUANTUM
+ * more and goes to the tail (as do the sessions over their limits, without
+ * getting more).
+ * The session counts as being served until finish_session is called.
+ * Returns the session, or NULL if the calling worker must leave the pool
+ * (see retire_worker).
+ */
+session_t *dequeue_session();
+
+/*
+ * Checks whether a session in the work queue is within its limits, after
+ * refilling its token buckets. Must be called with work_queue_lock held.
+ * Input:
+ * - session: session to be checked
+ * - now: the current time
+ * - ready_at: where to store when the session will be within its limits,
+ *   if it isn't yet
+ * Returns true if the session can be served, false otherwise.
+ */
+bool session_within_limits(session_t *session, struct timespec const *now,
+                           struct timespec *ready_at);
+
+/*
+ * Takes the next session to be served out of a work queue (see
+ * dequeue_session). Must be called with work_queue_lock held.
+ * Input:
+ * - queue: work queue of a priority class
+ * - ready_at: where to store when the first session will be within its
+ *   limits, if none is
+ * Returns the session, or NULL if the work queue is empty or every session
+ * in it is over its limits (in which case ready_at is set).
+ */
+session_t *next_session(work_queue_t *queue, struct timespec *ready_at);
+
+/*
+ * Charges the session being served for a request that was read, against
+ * both its deficit and its token buckets.
+ * Input:
+ * - session: session that sent the request
+ * - packet: the request
+ */
+void charge_session(session_t *session, packet_t const *packet);
+
+/*
+ * Marks a session taken from the work queue as served.
+ */
+void finish_session();
+
+/*
+ * Waits until the work queue is empty and no session is being served.
+ */
+void wait_for_idle_workers();
+
+/*
+ * Adds a worker to the pool, to stand in for one that has to wait for
+ * something only other requests can bring about.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int hire_worker();
+
+/*
+ * Makes a worker of the pool leave it (once the work queue is empty), after
+ * the worker that hired another one is done waiting.
+ */
+void retire_worker();
+
+/*
+ * Marks a request of a session as in flight: it is handled while the
+ * session's next requests are read and handled.
+ * Input:
+ * - session: session of the request
+ */
+void start_request(session_t *session);
+
+/*
+ * Marks a request in flight of a session as handled.
+ * Input:
+ * - session: session of the request
+ */
+void end_request(session_t *session);
+
+/*
+ * Waits until no request of a session is in flight.
+ * Input:
+ * - session: the session
+ */
+void wait_for_requests(session_t *session);
+
+/*
+ * Sends the reply to a request, preceded by the request's id.
+ * Input:
+ * - request: request being replied to
+ * - reply: content of the reply
+ * - size: size of the reply
+ * Returns 0 if successful, -1 otherwise.
+ */
+int send_reply(request_t *request, void const *reply, size_t size);
+
+/*
+ * Returns true if the time a is before the time b.
+ */
+bool timespec_before(struct timespec const *a, struct timespec const *b);
+
+/*
+ * Sets t to the given number of milliseconds from now, on the monotonic
+ * clock.
+ */
+void timespec_after_ms(struct timespec *t, long ms);
+
+/*
+ * Adds the given number of milliseconds to t.
+ */
+void timespec_add_ms(struct timespec *t, long ms);
+
+/*
+ * Tells the session holding a lease to stop using it, in place of a reply.
+ * Input:
+ * - recall: recall of the lease
+ * Returns 0 if successful, -1 otherwise.
+ */
+int send_recall(recall_t const *recall);
+
+/*
+ * Sends recalls taken while holding leases_lock, which must no longer be
+ * held, as a client may take long to receive them. Each session had a
+ * request started (see start_request) when its recall was taken, so that it
+ * isn't closed meanwhile, which is ended here. The leases whose recall
+ * can't be sent are dropped, as their client is gone.
+ * Input:
+ * - recalls: the recalls
+ * - count: number of recalls
+ */
+void send_recalls(recall_t const *recalls, int count);
+
+/*
+ * Must be called before changing the contents of a file, which can't happen
+ * while anyone else holds a lease on it: the leases on the file are recalled,
+ * and the caller waits until they are given back (or expire). No new lease
+ * on the file is granted until end_inode_update is called. The leases of the
+ * session making the change are dropped without waiting, as it can't give
+ * them back until the change is done (it learns of the recall first anyway).
+ * Input:
+ * - session: session changing the file
+ * - inumber: i-number of the file (nothing is done if it is -1)
+ */
+void begin_inode_update(session_t *session, int inumber);
+
+/*
+ * Must be called after changing the contents of a file.
+ * Input:
+ * - inumber: i-number of the file (nothing is done if it is -1)
+ */
+void end_inode_update(int inumber);
+
+/*
+ * Drops the leases matching a session and a file handle, waking up whoever
+ * is waiting for them to be given back.
+ * Input:
+ * - session: session of the leases, or NULL for any session
+ * - fhandle: file handle of the leases, or -1 for any file handle
+ */
+void drop_leases(session_t *session, int fhandle);
 
 /*
  * Reads the content of the pipe for the tfs_open function.
@@ -60,7 +539,8 @@ int parse_tfs_open_packet();
 int parse_tfs_close_packet();
 
 /*
- * Reads the content of the pipe for the tfs_write function.
+ * Reads the content of the pipe for the tfs_write function, except for the
+ * content to be written, which is left for handle_tfs_write.
  * Returns 0 if successful, -1 otherwise.
  */
 int parse_tfs_write_packet();
@@ -72,69 +552,290 @@ int parse_tfs_write_packet();
 int parse_tfs_read_packet();
 
 /*
- * Given the opcode, it executes the associated parser function.
+ * Reads the content of the pipe for the tfs_lseek function.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_lseek_packet();
+
+/*
+ * Reads the content of the pipe for the tfs_ftruncate function.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_ftruncate_packet();
+
+/*
+ * Reads the content of the pipe for the tfs_fallocate function.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_fallocate_packet();
+
+/*
+ * Reads the content of the pipe for the tfs_mount_shared_memory function.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_attach_shared_memory_packet();
+
+/*
+ * Reads the content of the pipe for a lease request.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_lease_packet();
+
+/*
+ * Reads the content of the pipe for the release of a lease.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_release_lease_packet();
+
+/*
+ * Reads the content of the pipe for a put request (open, write and close),
+ * except for the content to be written, which is left for handle_tfs_put.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_put_packet();
+
+/*
+ * Reads the content of the pipe for a get request (open, read and close).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_get_packet();
+
+/*
+ * Reads the content of the pipe for the tfs_copy function.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_copy_packet();
+
+/*
+ * Reads the content of the pipe for the limits of a session.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int parse_tfs_set_limits_packet();
+
+/*
+ * Reads the opcode and the id of the next request of a session and then
+ * executes the associated parser function.
  * Input:
- * - parser_fn: function to be executed
- * - op_code: op_code of the function to be used
- * Returns the result of the parser function.
+ * - request: request whose session is set, where to store the packet
+ * Returns 0 if successful, -1 otherwise.
  */
-void wrap_packet_parser_fn(int parser_fn(worker_t *), char op_code);
+int read_request(request_t *request);
 
 /*
- * The worker thread main function, it waits for a signal, handles the request
- * and waits for the next request.
+ * Returns true if a request must be handled before the next request of its
+ * session is read, because it still reads from the session (the content of
+ * a write) or changes the session itself.
  * Input:
- * - args: worker
+ * - opcode: operation code of the request
  */
-void *session_worker(void *args);
+bool holds_session(char opcode);
 
 /*
- * Mounts the client to the server.
+ * Executes the handler function associated with a request.
+ * Input:
+ * - request: request to be handled
+ * Returns 0 if successful, -1 otherwise.
+ */
+int handle_request(request_t *request);
+
+/*
+ * The worker thread main function, it takes sessions from the work queue,
+ * reads their next request and handles it. Unless the request holds the
+ * session, the session is watched again before the request is handled, so
+ * that its next requests are handled at the same time.
+ * Input:
+ * - args: unused
+ */
+void *pool_worker(void *args);
+
+/*
+ * Starts a thread of its own to handle tfs_shutdown_after_all_closed, which
+ * waits for every file to be closed and so must not hold up a worker of the
+ * pool (the one that would close them).
+ * Input:
+ * - request: request to be handled
+ * Returns 0 if successful, -1 otherwise.
+ */
+int start_shutdown_worker(request_t *request);
+
+/*
+ * The shutdown thread main function.
+ * Input:
+ * - args: request to be handled, freed once it is handled
+ */
+void *shutdown_worker(void *args);
+
+/*
+ * Mounts the client to the server, opening the response and request pipes
+ * of the new session.
  * Returns 0 if successful, -1 otherwise.
  */
 int handle_tfs_mount();
 
 /*
- * Unmounts the client of the server.
+ * Creates a session that reads requests from pipe_in and writes replies to
+ * pipe_out. If there are no sessions available, the mount waits in a queue
+ * for one to be freed (without blocking the caller), and is only rejected if
+ * the queue is full or the wait times out.
  * Input:
- * - worker: worker that is going to handle the function
+ * - pipe_in: file descriptor of the request pipe (or socket)
+ * - pipe_out: file descriptor of the response pipe (or socket)
+ * Returns 0 if successful, -1 otherwise.
  */
-int handle_tfs_unmount(worker_t *worker);
+int mount_session(int pipe_in, int pipe_out);
+
+/*
+ * Sets up a session taken for a mount, and tells the client its session_id
+ * (or -1 if the mount was rejected, in which case both pipes are closed).
+ * Input:
+ * - session_id: the session, or -1 to reject the mount
+ * - pipe_in: file descriptor of the request pipe (or socket)
+ * - pipe_out: file descriptor of the response pipe (or socket)
+ * Returns 0 if successful, -1 otherwise.
+ */
+int admit_session(int session_id, int pipe_in, int pipe_out);
+
+/*
+ * Unmounts the client of the server, once its requests in flight are
+ * handled.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_unmount(request_t *request);
 
 /*
  * Executes tfs_open.
  * Input:
- * - worker: worker that is going to handle the function
+ * - request: request to be handled
+ */
+int handle_tfs_open(request_t *request);
+
+/*
+ * Executes tfs_write (see stream_tfs_write), once no one else holds a lease
+ * on the file.
+ * Input:
+ * - request: request to be handled
  */
-int handle_tfs_open(worker_t *worker);
+int handle_tfs_write(request_t *request);
 
 /*
- * Executes tfs_write.
+ * Executes tfs_write, streaming the content from the session one chunk at a
+ * time, without replying.
  * Input:
- * - worker: worker that is going to handle the function
+ * - request: request to be handled
+ * - fhandle: file handle of the file system to write to
+ * - written: where to store the result of the write
+ * Returns 0 if the whole content was read from the session, -1 otherwise.
  */
-int handle_tfs_write(worker_t *worker);
+int stream_tfs_write(request_t *request, int fhandle, ssize_t *written);
 
 /*
- * Executes tfs_read.
+ * Executes tfs_read (see stream_tfs_read).
  * Input:
- * - worker: worker that is going to handle the function
+ * - request: request to be handled
  */
-int handle_tfs_read(worker_t *worker);
+int handle_tfs_read(request_t *request);
+
+/*
+ * Executes tfs_read, streaming the content to the session one chunk at a
+ * time.
+ * Input:
+ * - request: request to be handled
+ * - fhandle: file handle of the file system to read from
+ */
+int stream_tfs_read(request_t *request, int fhandle);
 
 /*
  * Executes tfs_close.
  * Input:
- * - worker: worker that is going to handle the function
+ * - request: request to be handled
+ */
+int handle_tfs_close(request_t *request);
+
+/*
+ * Opens the file named in the request with its flags, writes the content
+ * (streamed like in stream_tfs_write) and closes it, replying with the
+ * result of the write (or -1, if the file couldn't be opened or closed).
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_put(request_t *request);
+
+/*
+ * Opens the file named in the request, reads up to len bytes from its start
+ * (streamed like in handle_tfs_read) and closes it.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_get(request_t *request);
+
+/*
+ * Executes tfs_copy, once no one else holds a lease on the destination.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_copy(request_t *request);
+
+/*
+ * Executes tfs_lseek.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_lseek(request_t *request);
+
+/*
+ * Executes tfs_ftruncate.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_ftruncate(request_t *request);
+
+/*
+ * Executes tfs_fallocate.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_fallocate(request_t *request);
+
+/*
+ * Maps the shared memory region named in the request, so that the session's
+ * next requests and replies go through its rings.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_attach_shared_memory(request_t *request);
+
+/*
+ * Grants a read lease on the file of a handle, unless it is being changed,
+ * replying with the id of the lease (or -1) and the offset of the handle,
+ * followed (if it was granted) by the whole file, in the same frames as
+ * handle_tfs_read.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_lease(request_t *request);
+
+/*
+ * Drops a lease the session gave back.
+ * Input:
+ * - request: request to be handled
+ */
+int handle_tfs_release_lease(request_t *request);
+
+/*
+ * Sets the limits of the session, which fails if they were set before (so
+ * that they can't be lifted) or are negative.
+ * Input:
+ * - request: request to be handled
  */
-int handle_tfs_close(worker_t *worker);
+int handle_tfs_set_limits(request_t *request);
 
 /*
  * Executes tfs_tfs_destroy_after_all_closed and closes the server.
  * Input:
- * - worker: worker that is going to handle the function
+ * - request: request to be handled
  */
-int handle_tfs_shutdown_after_all_closed(worker_t *worker);
+int handle_tfs_shutdown_after_all_closed(request_t *request);
 
 /*
  * Handles the SIGINT signal.
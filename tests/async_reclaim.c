@@ -0,0 +1,89 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_COUNT 4
+#define ROUND_COUNT 10
+#define FILE_BLOCKS 200
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+void *fill_and_truncate(void *arg);
+
+/* Fill large files and truncate them over and over again, concurrently, so
+ * that new blocks are often needed before the blocks of the truncated files
+ * have been reclaimed in the background. */
+int main() {
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    pthread_t tid[THREAD_COUNT];
+    int file_id[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        file_id[i] = i;
+        assert(pthread_create(&tid[i], NULL, fill_and_truncate, &file_id[i]) ==
+               0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* every block is given back eventually */
+    assert(count_free_blocks() == free_blocks);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void *fill_and_truncate(void *arg) {
+    char path[MAX_FILE_NAME];
+    char input[BLOCK_SIZE];
+    char output[BLOCK_SIZE];
+    int id = *((int *)arg);
+    sprintf(path, "/f%d", id);
+
+    for (int round = 0; round < ROUND_COUNT; round++) {
+        memset(input, 'A' + (id * ROUND_COUNT + round) % 26, BLOCK_SIZE);
+
+        int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        for (int i = 0; i < FILE_BLOCKS; i++) {
+            assert(tfs_write(f, input, BLOCK_SIZE) == BLOCK_SIZE);
+        }
+        assert(tfs_close(f) != -1);
+
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        for (int i = 0; i < FILE_BLOCKS; i++) {
+            assert(tfs_read(f, output, BLOCK_SIZE) == BLOCK_SIZE);
+            assert(memcmp(input, output, BLOCK_SIZE) == 0);
+        }
+        assert(tfs_read(f, output, BLOCK_SIZE) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    int f = tfs_open(path, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}
@@ -0,0 +1,121 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Write a file with many asynchronous writes whose callbacks count them,
+ * read it back with a request that is polled and then collected, and
+ * finally with a chain of callbacks, each reading the next chunk. */
+
+#define CHUNK_SIZE 1000
+#define CHUNK_COUNT 40
+
+static char input[CHUNK_SIZE * CHUNK_COUNT];
+static char output[CHUNK_SIZE * CHUNK_COUNT];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int completed = 0;
+static int fhandle;
+
+void count_write(int request_id, ssize_t result, void *arg) {
+    (void)request_id;
+    (void)arg;
+    assert(result == CHUNK_SIZE);
+    pthread_mutex_lock(&lock);
+    completed++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+void read_next(int request_id, ssize_t result, void *arg) {
+    (void)request_id;
+    int chunk = (int)(size_t)arg;
+    assert(result == CHUNK_SIZE);
+
+    pthread_mutex_lock(&lock);
+    completed++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    /* callbacks may send new requests */
+    if (chunk + 1 < CHUNK_COUNT) {
+        assert(tfs_read_async(fhandle, output + (chunk + 1) * CHUNK_SIZE,
+                              CHUNK_SIZE, read_next,
+                              (void *)(size_t)(chunk + 1)) != -1);
+    }
+}
+
+void wait_for_completed(int count) {
+    pthread_mutex_lock(&lock);
+    while (completed < count) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    completed = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_mount("/tmp/tfs_async", argv[1]) == 0);
+
+    int request = tfs_open_async("/f1", TFS_O_CREAT, NULL, NULL);
+    assert(request != -1);
+    fhandle = (int)tfs_collect(request);
+    assert(fhandle != -1);
+
+    /* writes keep their order, as the server reads each one whole */
+    for (int i = 0; i < CHUNK_COUNT; i++) {
+        assert(tfs_write_async(fhandle, input + i * CHUNK_SIZE, CHUNK_SIZE,
+                               count_write, NULL) != -1);
+    }
+    wait_for_completed(CHUNK_COUNT);
+
+    assert(tfs_lseek(fhandle, 0, SEEK_SET) == 0);
+    request = tfs_read_async(fhandle, output, sizeof(output), NULL, NULL);
+    assert(request != -1);
+    while (tfs_poll(request) == 0) {
+        sched_yield();
+    }
+    assert(tfs_poll(request) == 1);
+    assert(tfs_collect(request) == sizeof(output));
+    assert(tfs_poll(request) == -1);
+    assert(memcmp(input, output, sizeof(output)) == 0);
+
+    memset(output, 0, sizeof(output));
+    assert(tfs_lseek(fhandle, 0, SEEK_SET) == 0);
+    request = tfs_read_async(fhandle, output, CHUNK_SIZE, read_next, NULL);
+    assert(request != -1);
+    /* requests with a callback can't be collected */
+    assert(tfs_poll(request) == -1);
+    wait_for_completed(CHUNK_COUNT);
+    assert(memcmp(input, output, sizeof(output)) == 0);
+
+    assert(tfs_close(fhandle) != -1);
+    assert(tfs_unmount() == 0);
+
+    /* the completion thread is started again for the next session */
+    assert(tfs_mount("/tmp/tfs_async", argv[1]) == 0);
+    request = tfs_open_async("/f1", 0, NULL, NULL);
+    assert(request != -1);
+    fhandle = (int)tfs_collect(request);
+    assert(fhandle != -1);
+    assert(tfs_read(fhandle, output, sizeof(output)) == sizeof(output));
+    assert(tfs_close(fhandle) != -1);
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
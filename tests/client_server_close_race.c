@@ -0,0 +1,106 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Pipeline a read and a close of the same handle on one session, so that
+ * the server may handle them at the same time, while another session keeps
+ * opening and reading a file of its own (and may get the file handle of the
+ * server the close gives back). Check that the read only ever sees its own
+ * file, and that the other session's handles aren't moved by it. */
+
+#define FILE_SIZE (16 * 1024)
+#define ROUNDS 200
+
+static char output[FILE_SIZE];
+static atomic_bool done;
+
+typedef struct {
+    ssize_t result;
+    atomic_bool received;
+} reply_t;
+
+void note_reply(int request_id, ssize_t result, void *arg) {
+    (void)request_id;
+    reply_t *reply = (reply_t *)arg;
+    reply->result = result;
+    atomic_store(&reply->received, true);
+}
+
+void *open_and_read(void *arg) {
+    tfs_session_t *session = (tfs_session_t *)arg;
+    char buffer[FILE_SIZE];
+    while (!atomic_load(&done)) {
+        int f = tfs_session_open(session, "/other", 0);
+        assert(f != -1);
+        assert(tfs_session_read(session, f, buffer, FILE_SIZE) == FILE_SIZE);
+        for (int i = 0; i < FILE_SIZE; i++) {
+            assert(buffer[i] == 'o');
+        }
+        assert(tfs_session_close(session, f) != -1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    char input[FILE_SIZE];
+
+    tfs_session_t *session = tfs_session_mount("/tmp/tfs_close_race", argv[1]);
+    assert(session != NULL);
+    tfs_session_t *other =
+        tfs_session_mount("/tmp/tfs_close_race_other", argv[1]);
+    assert(other != NULL);
+
+    memset(input, 'r', FILE_SIZE);
+    assert(tfs_session_put(session, "/racing", TFS_O_CREAT, input,
+                           FILE_SIZE) == FILE_SIZE);
+    memset(input, 'o', FILE_SIZE);
+    assert(tfs_session_put(other, "/other", TFS_O_CREAT, input, FILE_SIZE) ==
+           FILE_SIZE);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, open_and_read, other) == 0);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int f = tfs_session_open(session, "/racing", 0);
+        assert(f != -1);
+        reply_t reply;
+        atomic_store(&reply.received, false);
+        assert(tfs_session_read_async(session, f, output, FILE_SIZE,
+                                      note_reply, &reply) != -1);
+        /* sent before the read's reply arrives */
+        assert(tfs_session_close(session, f) != -1);
+        while (!atomic_load(&reply.received)) {
+            struct timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+        }
+        /* the read may have found the handle closed already, but otherwise
+         * it read the whole file it opened */
+        if (reply.result != -1) {
+            assert(reply.result == FILE_SIZE);
+            for (int i = 0; i < FILE_SIZE; i++) {
+                assert(output[i] == 'r');
+            }
+        }
+    }
+
+    atomic_store(&done, true);
+    assert(pthread_join(thread, NULL) == 0);
+
+    assert(tfs_session_unmount(other) == 0);
+    assert(tfs_session_unmount(session) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Copy files inside the server, with and without TFS_COPY_REFLINK, checking
+ * the copies, and copy over a file cached by another session, which must
+ * then see the new contents. */
+
+#define CONTENT_SIZE (20 * 1024)
+
+static char input[CONTENT_SIZE];
+static char output[CONTENT_SIZE + 1];
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    for (int i = 0; i < CONTENT_SIZE; i++) {
+        input[i] = (char)('a' + i % 26);
+    }
+
+    tfs_session_t *session = tfs_session_mount("/tmp/tfs_copy", argv[1]);
+    assert(session != NULL);
+    tfs_session_t *reader = tfs_session_mount("/tmp/tfs_copy_reader", argv[1]);
+    assert(reader != NULL);
+
+    assert(tfs_session_put(session, "/original", TFS_O_CREAT, input,
+                           CONTENT_SIZE) == CONTENT_SIZE);
+    assert(tfs_session_copy(session, "/original", "/copy", 0) == 0);
+    assert(tfs_session_get(session, "/copy", output, sizeof(output)) ==
+           CONTENT_SIZE);
+    assert(memcmp(input, output, CONTENT_SIZE) == 0);
+
+    assert(tfs_session_copy(session, "/original", "/reflink",
+                            TFS_COPY_REFLINK) == 0);
+    assert(tfs_session_get(session, "/reflink", output, sizeof(output)) ==
+           CONTENT_SIZE);
+    assert(memcmp(input, output, CONTENT_SIZE) == 0);
+
+    assert(tfs_session_copy(session, "/missing", "/copy", 0) == -1);
+
+    /* copying over a cached file recalls its lease */
+    char const *small = "small contents";
+    assert(tfs_session_put(session, "/small", TFS_O_CREAT, small,
+                           strlen(small)) == (ssize_t)strlen(small));
+    int f = tfs_session_open(reader, "/copy", 0);
+    assert(f != -1);
+    assert(tfs_session_set_read_cache(reader, f, 1) == 0);
+    assert(tfs_session_read(reader, f, output, sizeof(output)) ==
+           CONTENT_SIZE);
+    assert(tfs_session_copy(session, "/small", "/copy", 0) == 0);
+    assert(tfs_session_lseek(reader, f, 0, SEEK_SET) == 0);
+    assert(tfs_session_read(reader, f, output, sizeof(output)) ==
+           (ssize_t)strlen(small));
+    assert(memcmp(output, small, strlen(small)) == 0);
+    assert(tfs_session_close(reader, f) != -1);
+
+    assert(tfs_session_unmount(reader) == 0);
+    assert(tfs_session_unmount(session) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Open every file handle of the server from a client that then exits without
+ * closing them or unmounting, and check that the server closes its session
+ * and gives the handles back, so that another client can open as many
+ * files. Do it with a client using pipes, and with one using shared memory,
+ * whose request ring is left empty (but never closed). */
+
+#define CLIENT_PIPE_NAME_LEN 40
+
+void open_all_files(tfs_session_t *session, int *fhandles) {
+    char path[CLIENT_PIPE_NAME_LEN];
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        sprintf(path, "/f%d", i);
+        fhandles[i] = tfs_session_open(session, path, TFS_O_CREAT);
+        assert(fhandles[i] != -1);
+    }
+}
+
+void crash_client(char const *server_pipe, bool shared_memory) {
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        tfs_session_t *session =
+            shared_memory
+                ? tfs_session_mount_shared_memory("/tmp/tfs_dead", server_pipe)
+                : tfs_session_mount("/tmp/tfs_dead", server_pipe);
+        assert(session != NULL);
+        int fhandles[MAX_OPEN_FILES];
+        open_all_files(session, fhandles);
+        /* crash, leaving the handles open */
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    unlink("/tmp/tfs_dead");
+    unlink("/tmp/tfs_dead.req");
+}
+
+void check_handles_given_back(char const *server_pipe) {
+    int fhandles[MAX_OPEN_FILES];
+
+    /* the server notices that the client is gone on its own time */
+    tfs_session_t *session = tfs_session_mount("/tmp/tfs_alive", server_pipe);
+    assert(session != NULL);
+    int f;
+    struct timespec pause = {0, 10 * 1000000};
+    for (int i = 0; (f = tfs_session_open(session, "/f0", 0)) == -1; ++i) {
+        assert(i < 1000);
+        nanosleep(&pause, NULL);
+    }
+    assert(tfs_session_close(session, f) != -1);
+
+    open_all_files(session, fhandles);
+    assert(tfs_session_open(session, "/one_too_many", TFS_O_CREAT) == -1);
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        assert(tfs_session_close(session, fhandles[i]) != -1);
+    }
+    assert(tfs_session_unmount(session) == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    crash_client(argv[1], false);
+    check_handles_given_back(argv[1]);
+
+    crash_client(argv[1], true);
+    check_handles_given_back(argv[1]);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
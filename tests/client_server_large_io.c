@@ -0,0 +1,76 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Write and read whole files much larger than a pipe's buffer (and than a
+ * shared memory ring) with a single call each, and check that a write bigger
+ * than the maximum file size (or to an invalid file) leaves the session
+ * usable. This is done once through pipes and once through shared memory. */
+
+#define LARGE_SIZE (200 * 1024)
+#define TOO_LARGE_SIZE (1024 * 1024)
+
+void run_test(char *input, char *output);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    char *input = malloc(TOO_LARGE_SIZE);
+    char *output = malloc(TOO_LARGE_SIZE);
+    assert(input != NULL && output != NULL);
+    for (size_t i = 0; i < TOO_LARGE_SIZE; i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_mount("/tmp/tfs_large_io", argv[1]) == 0);
+    run_test(input, output);
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_mount_shared_memory("/tmp/tfs_large_io", argv[1]) == 0);
+    run_test(input, output);
+    assert(tfs_unmount() == 0);
+
+    free(input);
+    free(output);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void run_test(char *input, char *output) {
+    int f = tfs_open("/f1", TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, input, LARGE_SIZE) == LARGE_SIZE);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, TOO_LARGE_SIZE) == LARGE_SIZE);
+    assert(memcmp(input, output, LARGE_SIZE) == 0);
+    assert(tfs_read(f, output, TOO_LARGE_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    /* the whole content is sent, even if the file can't take all of it */
+    f = tfs_open("/f2", TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    ssize_t written = tfs_write(f, input, TOO_LARGE_SIZE);
+    assert(written > LARGE_SIZE && written < TOO_LARGE_SIZE);
+    assert(tfs_write(f, input, TOO_LARGE_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_write(-1, input, LARGE_SIZE) == -1);
+    assert(tfs_read(-1, output, LARGE_SIZE) == -1);
+
+    f = tfs_open("/f2", 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, TOO_LARGE_SIZE) == written);
+    assert(memcmp(input, output, (size_t)written) == 0);
+    assert(tfs_close(f) != -1);
+}
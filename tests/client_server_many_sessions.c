@@ -0,0 +1,70 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Mount many more sessions than there are workers (and than the server used
+ * to accept), keep all of them mounted at the same time while they make
+ * requests, and then unmount them. */
+
+#define CLIENT_COUNT 100
+#define REQUEST_COUNT 10
+#define CLIENT_PIPE_NAME_LEN 40
+#define CLIENT_PIPE_NAME_FORMAT "/tmp/tfs_c%d"
+
+void run_test(char *server_pipe, int client_id);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    int child_pids[CLIENT_COUNT];
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            /* run test on child */
+            run_test(argv[1], i);
+            exit(0);
+        } else {
+            child_pids[i] = pid;
+        }
+    }
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int result;
+        waitpid(child_pids[i], &result, 0);
+        assert(WIFEXITED(result));
+        assert(WEXITSTATUS(result) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void run_test(char *server_pipe, int client_id) {
+    char client_pipe[CLIENT_PIPE_NAME_LEN];
+    sprintf(client_pipe, CLIENT_PIPE_NAME_FORMAT, client_id);
+
+    assert(tfs_mount(client_pipe, server_pipe) == 0);
+
+    /* give every other client the time to mount */
+    sleep(1);
+
+    /* the open file table is much smaller than the number of sessions, so
+     * only make requests that don't need an open file */
+    for (int i = 0; i < REQUEST_COUNT; i++) {
+        assert(tfs_lseek(-1, 0, SEEK_SET) == -1);
+        assert(tfs_close(-1) == -1);
+    }
+
+    assert(tfs_unmount() == 0);
+}
@@ -0,0 +1,85 @@
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Take every session of the server, and mount one more: it waits until a
+ * session is unmounted and then gets it, instead of being rejected. Then
+ * mount another one while nobody unmounts, which is only rejected once it
+ * has waited for MOUNT_WAIT_TIMEOUT_MS. */
+
+#define CLIENT_PIPE_NAME_LEN 40
+#define CLIENT_PIPE_NAME_FORMAT "/tmp/tfs_q%d"
+
+static tfs_session_t *sessions[SIMULTANEOUS_CONNECTIONS];
+static char *server_pipe;
+static atomic_bool waiting_mounted;
+
+long elapsed_ms(struct timespec const *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void *mount_waiting(void *arg) {
+    tfs_session_t **session = (tfs_session_t **)arg;
+    *session = tfs_session_mount("/tmp/tfs_q_waiting", server_pipe);
+    atomic_store(&waiting_mounted, true);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+    server_pipe = argv[1];
+
+    char path[CLIENT_PIPE_NAME_LEN];
+    for (int i = 0; i < SIMULTANEOUS_CONNECTIONS; ++i) {
+        sprintf(path, CLIENT_PIPE_NAME_FORMAT, i);
+        sessions[i] = tfs_session_mount(path, server_pipe);
+        assert(sessions[i] != NULL);
+    }
+
+    /* the extra mount waits for a session to be unmounted */
+    tfs_session_t *waiting = NULL;
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, mount_waiting, &waiting) == 0);
+    struct timespec pause = {0, 300 * 1000000};
+    nanosleep(&pause, NULL);
+    assert(!atomic_load(&waiting_mounted));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tfs_session_unmount(sessions[0]) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(waiting != NULL);
+    assert(elapsed_ms(&start) < MOUNT_WAIT_TIMEOUT_MS / 2);
+
+    int f = tfs_session_open(waiting, "/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_session_write(waiting, f, "queued", 6) == 6);
+    assert(tfs_session_close(waiting, f) != -1);
+
+    /* with nobody unmounting, the next mount times out */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tfs_session_mount("/tmp/tfs_q_rejected", server_pipe) == NULL);
+    assert(elapsed_ms(&start) >= MOUNT_WAIT_TIMEOUT_MS);
+
+    assert(tfs_session_unmount(waiting) == 0);
+    for (int i = 1; i < SIMULTANEOUS_CONNECTIONS; ++i) {
+        assert(tfs_session_unmount(sessions[i]) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
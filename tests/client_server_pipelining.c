@@ -0,0 +1,134 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Several clients each keep many requests in flight in their session,
+ * writing and reading files without waiting for each reply, and collecting
+ * the results in a different order from the one they were sent in. The
+ * first client does it through shared memory. */
+
+#define CLIENT_COUNT 3
+#define FILE_COUNT 6
+#define FILE_SIZE (6 * 1024)
+#define CLIENT_PIPE_NAME_LEN 40
+#define CLIENT_PIPE_NAME_FORMAT "/tmp/tfs_pipelining_c%d"
+#define FILE_NAME_FORMAT "/c%df%d"
+
+void run_test(char *server_pipe, int client_id);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    int child_pids[CLIENT_COUNT];
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            /* run test on child */
+            run_test(argv[1], i);
+            exit(0);
+        } else {
+            child_pids[i] = pid;
+        }
+    }
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int result;
+        waitpid(child_pids[i], &result, 0);
+        assert(WIFEXITED(result));
+        assert(WEXITSTATUS(result) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void run_test(char *server_pipe, int client_id) {
+    char client_pipe[CLIENT_PIPE_NAME_LEN];
+    sprintf(client_pipe, CLIENT_PIPE_NAME_FORMAT, client_id);
+
+    static char input[FILE_COUNT][FILE_SIZE];
+    static char output[FILE_COUNT][FILE_SIZE];
+    int requests[FILE_COUNT];
+    int fhandles[FILE_COUNT];
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        memset(input[i], 'A' + (client_id * FILE_COUNT + i) % 26, FILE_SIZE);
+    }
+
+    if (client_id == 0) {
+        assert(tfs_mount_shared_memory(client_pipe, server_pipe) == 0);
+    } else {
+        assert(tfs_mount(client_pipe, server_pipe) == 0);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[CLIENT_PIPE_NAME_LEN];
+        sprintf(path, FILE_NAME_FORMAT, client_id, i);
+        requests[i] = tfs_submit_open(path, TFS_O_CREAT);
+        assert(requests[i] != -1);
+    }
+    for (int i = FILE_COUNT - 1; i >= 0; i--) {
+        fhandles[i] = (int)tfs_collect(requests[i]);
+        assert(fhandles[i] != -1);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = tfs_submit_write(fhandles[i], input[i], FILE_SIZE);
+        assert(requests[i] != -1);
+    }
+    for (int i = FILE_COUNT - 1; i >= 0; i--) {
+        assert(tfs_collect(requests[i]) == FILE_SIZE);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = tfs_submit_lseek(fhandles[i], 0, SEEK_SET);
+        assert(requests[i] != -1);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_collect(requests[i]) == 0);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = tfs_submit_read(fhandles[i], output[i], FILE_SIZE);
+        assert(requests[i] != -1);
+    }
+    for (int i = FILE_COUNT - 1; i >= 0; i--) {
+        assert(tfs_collect(requests[i]) == FILE_SIZE);
+        assert(memcmp(input[i], output[i], FILE_SIZE) == 0);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        requests[i] = tfs_submit_close(fhandles[i]);
+        assert(requests[i] != -1);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_collect(requests[i]) == 0);
+    }
+
+    /* only so many results can be waiting to be collected */
+    int pending[MAX_PENDING_REQUESTS];
+    for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+        pending[i] = tfs_submit_lseek(-1, 0, SEEK_SET);
+        assert(pending[i] != -1);
+    }
+    assert(tfs_submit_close(-1) == -1);
+    for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+        assert(tfs_collect(pending[i]) == -1);
+    }
+    assert(tfs_collect(pending[0]) == -1);
+
+    /* requests that aren't collected don't get in the way of unmounting */
+    assert(tfs_submit_lseek(-1, 0, SEEK_SET) != -1);
+    assert(tfs_unmount() == 0);
+}
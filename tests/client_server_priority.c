@@ -0,0 +1,180 @@
+#include "client/tecnicofs_client_api.h"
+#include "fs/config.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Queue a bulk put on each of four sessions per worker of the server, and
+ * then an open (which is interactive) on another one, and check that the
+ * open is served ahead of the puts queued before it, by counting the puts
+ * still without a reply when the open's arrives. The puts are small enough
+ * that deficit round robin alone serves them in the order they were queued,
+ * and before them a large put on a fresh session per worker keeps every
+ * worker busy until the rest are queued, which a loaded host may still
+ * delay, so the open only has to overtake half of the puts, over every
+ * round. Then check that the priority of a session can be overridden. */
+
+#define SESSIONS_PER_WORKER 4
+#define PUT_SIZE (1024)
+#define BLOCKER_SIZE (192 * 1024)
+#define ROUNDS 5
+
+static char input[BLOCKER_SIZE];
+static tfs_session_t **bulk;
+static int *put_ids;
+static int bulk_sessions;
+
+/* the result of an open, and how many puts hadn't been replied to when it
+ * arrived */
+typedef struct {
+    ssize_t result;
+    int overtaken;
+    atomic_bool received;
+} open_reply_t;
+
+void note_open_reply(int request_id, ssize_t result, void *arg) {
+    (void)request_id;
+    open_reply_t *reply = (open_reply_t *)arg;
+    reply->result = result;
+    reply->overtaken = 0;
+    for (int i = 0; i < bulk_sessions; i++) {
+        if (put_ids[i] != -1 && tfs_session_poll(bulk[i], put_ids[i]) == 0) {
+            reply->overtaken++;
+        }
+    }
+    atomic_store(&reply->received, true);
+}
+
+/* opens a file asynchronously, and waits for the reply */
+ssize_t open_async(tfs_session_t *session, char const *name, int flags,
+                   open_reply_t *reply) {
+    atomic_store(&reply->received, false);
+    assert(tfs_session_open_async(session, name, flags, note_open_reply,
+                                  reply) != -1);
+    while (!atomic_load(&reply->received)) {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+    return reply->result;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+    memset(input, 'B', BLOCKER_SIZE);
+    /* the server has a worker per processor, each of which is kept busy by
+     * a blocker, so there are enough puts to queue behind all of them */
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) {
+        workers = 1;
+    }
+    bulk_sessions = SESSIONS_PER_WORKER * (int)workers;
+    /* each put being served takes a file handle for a while, and the
+     * server has MAX_OPEN_FILES */
+    bool handles_to_spare = workers < MAX_OPEN_FILES;
+    /* the puts whose replies arrived after the open's */
+    int overtaken = 0;
+
+    tfs_session_t *session = tfs_session_mount("/tmp/tfs_priority", argv[1]);
+    assert(session != NULL);
+    int f = tfs_session_open(session, "/interactive", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_session_close(session, f) != -1);
+
+    bulk = malloc((size_t)bulk_sessions * sizeof(tfs_session_t *));
+    put_ids = malloc((size_t)bulk_sessions * sizeof(int));
+    assert(bulk != NULL && put_ids != NULL);
+    for (int i = 0; i < bulk_sessions; i++) {
+        put_ids[i] = -1;
+    }
+    open_reply_t open_reply;
+    char path[40];
+    for (int i = 0; i < bulk_sessions; i++) {
+        sprintf(path, "/tmp/tfs_priority_bulk%d", i);
+        bulk[i] = tfs_session_mount(path, argv[1]);
+        assert(bulk[i] != NULL);
+        /* which starts the completion thread of the session, so the
+         * replies to its puts arrive on their own */
+        f = (int)open_async(bulk[i], "/bulk", TFS_O_CREAT, &open_reply);
+        assert(f != -1);
+        assert(tfs_session_close(bulk[i], f) != -1);
+    }
+
+    tfs_session_t **blockers =
+        malloc((size_t)workers * sizeof(tfs_session_t *));
+    int *blocker_ids = malloc((size_t)workers * sizeof(int));
+    assert(blockers != NULL && blocker_ids != NULL);
+    for (int round = 0; round < ROUNDS; round++) {
+        /* the blockers all put the same file, so they mostly wait for one
+         * another, which still keeps their workers busy */
+        for (int i = 0; i < workers; i++) {
+            sprintf(path, "/tmp/tfs_priority_blocker%d", i);
+            blockers[i] = tfs_session_mount(path, argv[1]);
+            assert(blockers[i] != NULL);
+            blocker_ids[i] =
+                tfs_session_submit_put(blockers[i], "/blocker",
+                                       TFS_O_CREAT | TFS_O_TRUNC, input,
+                                       BLOCKER_SIZE);
+            assert(blocker_ids[i] != -1);
+        }
+        for (int i = 0; i < bulk_sessions; i++) {
+            put_ids[i] = tfs_session_submit_put(
+                bulk[i], "/bulk", TFS_O_CREAT | TFS_O_TRUNC, input, PUT_SIZE);
+            assert(put_ids[i] != -1);
+        }
+        open_async(session, "/interactive", 0, &open_reply);
+        for (int i = 0; i < workers; i++) {
+            ssize_t result = tfs_session_collect(blockers[i], blocker_ids[i]);
+            assert(!handles_to_spare || result == BLOCKER_SIZE);
+            assert(tfs_session_unmount(blockers[i]) == 0);
+        }
+        for (int i = 0; i < bulk_sessions; i++) {
+            ssize_t result = tfs_session_collect(bulk[i], put_ids[i]);
+            assert(!handles_to_spare || result == PUT_SIZE);
+        }
+        assert(!handles_to_spare || open_reply.result != -1);
+        if (open_reply.result != -1) {
+            assert(tfs_session_close(session, (int)open_reply.result) != -1);
+        }
+
+        overtaken += open_reply.overtaken;
+    }
+    /* without priorities, the open would come after every put */
+    assert(overtaken >= ROUNDS * bulk_sessions / 2);
+
+    for (int i = 0; i < bulk_sessions; i++) {
+        assert(tfs_session_unmount(bulk[i]) == 0);
+    }
+    free(bulk);
+    free(put_ids);
+    free(blockers);
+    free(blocker_ids);
+
+    /* overriding the priority doesn't change what the requests do */
+    assert(tfs_session_set_priority(session, 2) == -1);
+    assert(tfs_session_set_priority(session, TFS_PRIORITY_BULK) == 0);
+    f = tfs_session_open(session, "/interactive", 0);
+    assert(f != -1);
+    assert(tfs_session_set_priority(session, TFS_PRIORITY_INTERACTIVE) == 0);
+    assert(tfs_session_write(session, f, "interactive", 11) == 11);
+    assert(tfs_session_set_priority(session, TFS_PRIORITY_DEFAULT) == 0);
+    assert(tfs_session_lseek(session, f, 0, SEEK_SET) == 0);
+    char output[12] = {0};
+    assert(tfs_session_read(session, f, output, 11) == 11);
+    assert(strcmp(output, "interactive") == 0);
+    assert(tfs_session_close(session, f) != -1);
+
+    assert(tfs_session_unmount(session) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
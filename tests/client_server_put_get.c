@@ -0,0 +1,93 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Write and read whole files with a single request each, many more times
+ * than there are file handles in the server (so that each request must
+ * close the file it opened), with some of the requests in flight at the same
+ * time, and check that a put to a file that can't be opened leaves the
+ * session usable. This is done once through pipes and once through shared
+ * memory. */
+
+#define FILES 10
+#define ROUNDS 5
+#define CONTENT_SIZE 5000
+
+static char input[FILES][CONTENT_SIZE];
+static char output[FILES][CONTENT_SIZE];
+
+void run_test() {
+    char path[PIPE_STRING_LENGTH];
+    int requests[FILES];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < FILES; i++) {
+            sprintf(path, "/o%d", i);
+            requests[i] = tfs_submit_put(path, TFS_O_CREAT | TFS_O_TRUNC,
+                                         input[i], CONTENT_SIZE);
+            assert(requests[i] != -1);
+        }
+        for (int i = 0; i < FILES; i++) {
+            assert(tfs_collect(requests[i]) == CONTENT_SIZE);
+        }
+
+        for (int i = 0; i < FILES; i++) {
+            sprintf(path, "/o%d", i);
+            memset(output[i], 0, CONTENT_SIZE);
+            requests[i] = tfs_submit_get(path, output[i], CONTENT_SIZE);
+            assert(requests[i] != -1);
+        }
+        for (int i = 0; i < FILES; i++) {
+            assert(tfs_collect(requests[i]) == CONTENT_SIZE);
+            assert(memcmp(input[i], output[i], CONTENT_SIZE) == 0);
+        }
+    }
+
+    /* appending, and getting less than the whole file */
+    char const *line = "one more line\n";
+    assert(tfs_put("/o0", TFS_O_APPEND, line, strlen(line)) ==
+           (ssize_t)strlen(line));
+    assert(tfs_get("/o0", output[0], CONTENT_SIZE) == CONTENT_SIZE);
+    char buffer[CONTENT_SIZE + 100];
+    assert(tfs_get("/o0", buffer, sizeof(buffer)) ==
+           CONTENT_SIZE + (ssize_t)strlen(line));
+    assert(memcmp(buffer + CONTENT_SIZE, line, strlen(line)) == 0);
+
+    /* files that don't exist */
+    assert(tfs_put("/missing", 0, line, strlen(line)) == -1);
+    assert(tfs_get("/missing", buffer, sizeof(buffer)) == -1);
+
+    /* the files are all closed, and the session is still usable */
+    int f = tfs_open("/o1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, CONTENT_SIZE) == CONTENT_SIZE);
+    assert(memcmp(buffer, input[1], CONTENT_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    for (int i = 0; i < FILES; i++) {
+        for (int j = 0; j < CONTENT_SIZE; j++) {
+            input[i][j] = (char)('A' + (i + j) % 26);
+        }
+    }
+
+    assert(tfs_mount("/tmp/tfs_put_get", argv[1]) == 0);
+    run_test();
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_mount_shared_memory("/tmp/tfs_put_get", argv[1]) == 0);
+    run_test();
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
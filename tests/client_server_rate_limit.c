@@ -0,0 +1,122 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Send requests as fast as possible on sessions mounted with a limit of
+ * requests per second and with a limit of bytes per second, checking that
+ * no more of them are served than the limits let through in the time they
+ * took (a second worth of them, the buckets starting full, plus the rest of
+ * the time at the limit, with a margin), while a session without limits is
+ * served many more requests in the meantime. Only upper bounds on what was
+ * served in the measured time are checked, so a slow host can't fail them. */
+
+#define IOPS_LIMIT 20
+#define IOPS_REQUESTS 60
+#define BANDWIDTH_LIMIT (64 * 1024)
+#define WRITE_SIZE (8 * 1024)
+#define WRITES 20
+/* how many times more requests the session without limits must be served */
+#define FAST_FACTOR 4
+
+static char *server_pipe;
+static atomic_bool limited_done;
+
+long elapsed_ms(struct timespec const *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Returns the most a token bucket lets through in the given time: a second
+ * worth, which it starts with, plus the rest of the time at the limit, with
+ * a margin of a half.
+ */
+long most_served(long limit, long elapsed_ms) {
+    return (limit + limit * elapsed_ms / 1000) * 3 / 2;
+}
+
+void *run_fast(void *arg) {
+    long *served = (long *)arg;
+    tfs_session_t *session =
+        tfs_session_mount("/tmp/tfs_rate_fast", server_pipe);
+    assert(session != NULL);
+    int f = tfs_session_open(session, "/fast", TFS_O_CREAT);
+    assert(f != -1);
+
+    *served = 0;
+    while (!atomic_load(&limited_done)) {
+        assert(tfs_session_lseek(session, f, 0, SEEK_SET) == 0);
+        (*served)++;
+    }
+
+    assert(tfs_session_close(session, f) != -1);
+    assert(tfs_session_unmount(session) == 0);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+    server_pipe = argv[1];
+
+    assert(tfs_session_mount_limited("/tmp/tfs_rate_bad", server_pipe, -1,
+                                     0) == NULL);
+
+    /* requests per second, with a session without limits alongside */
+    tfs_session_t *session =
+        tfs_session_mount_limited("/tmp/tfs_rate_iops", server_pipe,
+                                  IOPS_LIMIT, 0);
+    assert(session != NULL);
+    long fast_served;
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, run_fast, &fast_served) == 0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int f = tfs_session_open(session, "/limited", TFS_O_CREAT);
+    assert(f != -1);
+    for (int i = 1; i < IOPS_REQUESTS; i++) {
+        assert(tfs_session_lseek(session, f, 0, SEEK_SET) == 0);
+    }
+    assert(IOPS_REQUESTS <= most_served(IOPS_LIMIT, elapsed_ms(&start)));
+    atomic_store(&limited_done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(fast_served >= FAST_FACTOR * IOPS_REQUESTS);
+
+    assert(tfs_session_close(session, f) != -1);
+    assert(tfs_session_unmount(session) == 0);
+
+    /* bytes per second */
+    session = tfs_session_mount_limited("/tmp/tfs_rate_bandwidth",
+                                        server_pipe, 0, BANDWIDTH_LIMIT);
+    assert(session != NULL);
+    f = tfs_session_open(session, "/limited", TFS_O_TRUNC);
+    assert(f != -1);
+    static char input[WRITE_SIZE];
+    memset(input, 'R', WRITE_SIZE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_session_write(session, f, input, WRITE_SIZE) ==
+               WRITE_SIZE);
+    }
+    assert((long)WRITES * WRITE_SIZE <=
+           most_served(BANDWIDTH_LIMIT, elapsed_ms(&start)));
+
+    assert(tfs_session_close(session, f) != -1);
+    assert(tfs_session_unmount(session) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
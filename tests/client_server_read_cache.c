@@ -0,0 +1,127 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Cache a file in one session and read it over and over, checking that the
+ * reads don't reach the server (whose offset for the handle, asked for past
+ * the cache, stays put), and that changes made by another session
+ * recall the lease right away (without waiting for it to expire) so that
+ * the next read sees them. */
+
+static tfs_session_t *reader;
+static tfs_session_t *writer;
+
+long elapsed_ms(struct timespec const *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* asks the server for the offset of a handle of the reader, which the cache
+ * doesn't answer as the request is sent straight away */
+off_t server_offset(int fhandle) {
+    int request = tfs_session_submit_lseek(reader, fhandle, 0, SEEK_CUR);
+    assert(request != -1);
+    return (off_t)tfs_session_collect(reader, request);
+}
+
+void check_contents(int fhandle, char const *expected) {
+    char buffer[64] = {0};
+    assert(tfs_session_lseek(reader, fhandle, 0, SEEK_SET) == 0);
+    assert(tfs_session_read(reader, fhandle, buffer, sizeof(buffer) - 1) ==
+           (ssize_t)strlen(expected));
+    assert(strcmp(buffer, expected) == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    char const *first = "key = first value";
+    char const *second = "key = second value";
+    char buffer[64];
+
+    reader = tfs_session_mount("/tmp/tfs_cache_reader", argv[1]);
+    assert(reader != NULL);
+    writer = tfs_session_mount("/tmp/tfs_cache_writer", argv[1]);
+    assert(writer != NULL);
+
+    int w = tfs_session_open(writer, "/config", TFS_O_CREAT);
+    assert(w != -1);
+    assert(tfs_session_write(writer, w, first, strlen(first)) ==
+           strlen(first));
+
+    int r = tfs_session_open(reader, "/config", 0);
+    assert(r != -1);
+    assert(tfs_session_set_read_cache(reader, r, 1) == 0);
+    check_contents(r, first);
+
+    /* reads and seeks are served by the client: the server's offset for
+     * the handle doesn't move */
+    for (int i = 0; i < 100; i++) {
+        check_contents(r, first);
+    }
+    assert(tfs_session_lseek(reader, r, 4, SEEK_SET) == 4);
+    assert(tfs_session_read(reader, r, buffer, 5) == 5);
+    assert(memcmp(buffer, first + 4, 5) == 0);
+    assert(server_offset(r) == 0);
+
+    /* the writer doesn't wait for the lease to expire */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tfs_session_lseek(writer, w, 0, SEEK_SET) == 0);
+    assert(tfs_session_write(writer, w, second, strlen(second)) ==
+           strlen(second));
+    assert(elapsed_ms(&start) < LEASE_DURATION_MS / 2);
+    check_contents(r, second);
+
+    /* and neither does truncating it */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int t = tfs_session_open(writer, "/config", TFS_O_TRUNC);
+    assert(t != -1);
+    assert(elapsed_ms(&start) < LEASE_DURATION_MS / 2);
+    check_contents(r, "");
+    assert(tfs_session_close(writer, t) != -1);
+
+    assert(tfs_session_lseek(writer, w, 0, SEEK_SET) == 0);
+    assert(tfs_session_write(writer, w, first, strlen(first)) ==
+           strlen(first));
+    check_contents(r, first);
+
+    /* an expired lease is taken again */
+    struct timespec pause = {LEASE_DURATION_MS / 1000 + 1, 0};
+    nanosleep(&pause, NULL);
+    check_contents(r, first);
+
+    /* the offset kept in the client is given back before a write */
+    assert(tfs_session_lseek(reader, r, 0, SEEK_END) ==
+           (off_t)strlen(first));
+    assert(tfs_session_write(reader, r, "!", 1) == 1);
+    assert(server_offset(r) ==
+           (off_t)strlen(first) + 1);
+    assert(tfs_session_lseek(reader, r, 0, SEEK_SET) == 0);
+    assert(tfs_session_read(reader, r, buffer, sizeof(buffer)) ==
+           (ssize_t)strlen(first) + 1);
+    assert(buffer[strlen(first)] == '!');
+
+    /* without the cache, reads go to the server again */
+    assert(tfs_session_set_read_cache(reader, r, 0) == 0);
+    assert(tfs_session_lseek(reader, r, 0, SEEK_SET) == 0);
+    assert(tfs_session_read(reader, r, buffer, 3) == 3);
+    assert(server_offset(r) == 3);
+
+    assert(tfs_session_close(reader, r) != -1);
+    assert(tfs_session_close(writer, w) != -1);
+    assert(tfs_session_unmount(reader) == 0);
+    assert(tfs_session_unmount(writer) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Seek past the end of files, resize them and preallocate them through the
+ * client API, concurrently, checking the contents of the files. */
+
+#define CLIENT_COUNT 10
+#define CLIENT_PIPE_NAME_LEN 40
+#define CLIENT_PIPE_NAME_FORMAT "/tmp/tfs_c%d"
+#define TFS_FILE_NAME_FORMAT "/resize_f%d"
+#define HOLE_SIZE 2000
+#define BUFFER_LEN 3000
+
+void run_test(char *server_pipe, int client_id);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    int child_pids[CLIENT_COUNT];
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            /* run test on child */
+            run_test(argv[1], i);
+            exit(0);
+        } else {
+            child_pids[i] = pid;
+        }
+    }
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int result;
+        waitpid(child_pids[i], &result, 0);
+        assert(WIFEXITED(result));
+        assert(WEXITSTATUS(result) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void run_test(char *server_pipe, int client_id) {
+    char *str = "AAA!";
+    char buffer[BUFFER_LEN];
+
+    char client_pipe[CLIENT_PIPE_NAME_LEN];
+    sprintf(client_pipe, CLIENT_PIPE_NAME_FORMAT, client_id);
+    char path[CLIENT_PIPE_NAME_LEN];
+    sprintf(path, TFS_FILE_NAME_FORMAT, client_id);
+
+    assert(tfs_mount(client_pipe, server_pipe) == 0);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    assert(tfs_lseek(f, HOLE_SIZE, SEEK_SET) == HOLE_SIZE);
+    assert(tfs_write(f, str, strlen(str)) == strlen(str));
+    assert(tfs_lseek(f, 0, SEEK_SET) == 0);
+    assert(tfs_read(f, buffer, BUFFER_LEN) == HOLE_SIZE + strlen(str));
+    for (int i = 0; i < HOLE_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(memcmp(buffer + HOLE_SIZE, str, strlen(str)) == 0);
+
+    /* cut the file in the middle of the string and then grow it again */
+    assert(tfs_ftruncate(f, HOLE_SIZE + 2) == 0);
+    assert(tfs_fallocate(f, 0, BUFFER_LEN) == 0);
+    assert(tfs_lseek(f, 0, SEEK_END) == BUFFER_LEN);
+    assert(tfs_lseek(f, HOLE_SIZE, SEEK_SET) == HOLE_SIZE);
+    assert(tfs_read(f, buffer, BUFFER_LEN) == BUFFER_LEN - HOLE_SIZE);
+    assert(memcmp(buffer, str, 2) == 0);
+    for (int i = 2; i < BUFFER_LEN - HOLE_SIZE; i++) {
+        assert(buffer[i] == 0);
+    }
+
+    assert(tfs_ftruncate(f, -1) == -1);
+    assert(tfs_fallocate(f, 0, 0) == -1);
+
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_unmount() == 0);
+}
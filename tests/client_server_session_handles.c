@@ -0,0 +1,55 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Open files in two sessions, which get handles with the same numbers, and
+ * check that each session only reaches its own files through them. Then
+ * unmount one of the sessions with its files still open, and check that the
+ * server can still be shut down once every file is closed, as the session's
+ * handles are closed along with it. */
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    char buffer[16];
+
+    tfs_session_t *first = tfs_session_mount("/tmp/tfs_handles_1", argv[1]);
+    assert(first != NULL);
+    tfs_session_t *second = tfs_session_mount("/tmp/tfs_handles_2", argv[1]);
+    assert(second != NULL);
+
+    /* each session numbers its handles on its own */
+    int f = tfs_session_open(first, "/first", TFS_O_CREAT);
+    assert(f != -1);
+    int g = tfs_session_open(second, "/second", TFS_O_CREAT);
+    assert(g == f);
+    assert(tfs_session_write(first, f, "first", 5) == 5);
+    assert(tfs_session_write(second, g, "second", 6) == 6);
+    assert(tfs_session_get(first, "/first", buffer, sizeof(buffer)) == 5);
+    assert(memcmp(buffer, "first", 5) == 0);
+    assert(tfs_session_get(first, "/second", buffer, sizeof(buffer)) == 6);
+    assert(memcmp(buffer, "second", 6) == 0);
+
+    /* a handle of one session can't be used from another one */
+    int other = tfs_session_open(first, "/first", 0);
+    assert(other != -1 && other != f);
+    assert(tfs_session_lseek(second, other, 0, SEEK_SET) == -1);
+    assert(tfs_session_write(second, other, "stolen", 6) == -1);
+    assert(tfs_session_close(second, other) == -1);
+    assert(tfs_session_read(first, other, buffer, sizeof(buffer)) == 5);
+    assert(memcmp(buffer, "first", 5) == 0);
+
+    /* the handles left open are closed on unmount */
+    assert(tfs_session_unmount(first) == 0);
+    assert(tfs_session_close(second, g) != -1);
+    assert(tfs_session_shutdown_after_all_closed(second) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
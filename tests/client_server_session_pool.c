@@ -0,0 +1,135 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Many threads take turns on a small pool of sessions, each writing its own
+ * file and reading it back with the session it was opened with, which is
+ * the only one the handle belongs to. Then several threads share a single
+ * session (one of them with shared memory), sending requests and waiting
+ * for their replies at the same time. */
+
+#define POOL_SIZE 3
+#define POOL_THREADS 8
+#define SHARED_THREADS 4
+#define ROUNDS 5
+#define CONTENT_SIZE 3000
+
+static tfs_pool_t *pool;
+static tfs_session_t *shared_session;
+
+void fill(char *buffer, int seed) {
+    for (int i = 0; i < CONTENT_SIZE; i++) {
+        buffer[i] = (char)('A' + (seed + i) % 26);
+    }
+}
+
+void *pool_worker(void *arg) {
+    int id = (int)(size_t)arg;
+    char path[PIPE_STRING_LENGTH];
+    char input[CONTENT_SIZE];
+    char output[CONTENT_SIZE];
+    sprintf(path, "/p%d", id);
+    fill(input, id);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        tfs_session_t *session = tfs_pool_acquire(pool);
+        int f = tfs_session_open(session, path, TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_session_write(session, f, input, CONTENT_SIZE) ==
+               CONTENT_SIZE);
+        assert(tfs_session_lseek(session, f, 0, SEEK_SET) == 0);
+        assert(tfs_session_read(session, f, output, CONTENT_SIZE) ==
+               CONTENT_SIZE);
+        assert(memcmp(input, output, CONTENT_SIZE) == 0);
+        assert(tfs_session_close(session, f) != -1);
+
+        /* once closed, the handle isn't one of the session anymore (and no
+         * other thread can have opened it again in a session it holds) */
+        assert(tfs_session_close(session, f) == -1);
+        tfs_pool_release(pool, session);
+    }
+    return NULL;
+}
+
+void *shared_worker(void *arg) {
+    int id = (int)(size_t)arg;
+    char path[PIPE_STRING_LENGTH];
+    char input[CONTENT_SIZE];
+    char output[CONTENT_SIZE];
+    sprintf(path, "/s%d", id);
+    fill(input, id + POOL_THREADS);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int f = tfs_session_open(shared_session, path,
+                                 TFS_O_CREAT | TFS_O_TRUNC);
+        assert(f != -1);
+        int write = tfs_session_submit_write(shared_session, f, input,
+                                             CONTENT_SIZE);
+        assert(write != -1);
+        assert(tfs_session_collect(shared_session, write) == CONTENT_SIZE);
+        assert(tfs_session_lseek(shared_session, f, 0, SEEK_SET) == 0);
+        assert(tfs_session_read(shared_session, f, output, CONTENT_SIZE) ==
+               CONTENT_SIZE);
+        assert(memcmp(input, output, CONTENT_SIZE) == 0);
+        assert(tfs_session_close(shared_session, f) != -1);
+    }
+    return NULL;
+}
+
+void run_shared_workers() {
+    pthread_t threads[SHARED_THREADS];
+    for (int i = 0; i < SHARED_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, shared_worker,
+                              (void *)(size_t)i) == 0);
+    }
+    for (int i = 0; i < SHARED_THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    pool = tfs_pool_create("/tmp/tfs_pool", argv[1], POOL_SIZE);
+    assert(pool != NULL);
+
+    pthread_t threads[POOL_THREADS];
+    for (int i = 0; i < POOL_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, pool_worker,
+                              (void *)(size_t)i) == 0);
+    }
+    for (int i = 0; i < POOL_THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(tfs_pool_destroy(pool) == 0);
+
+    shared_session = tfs_session_mount("/tmp/tfs_shared", argv[1]);
+    assert(shared_session != NULL);
+    run_shared_workers();
+    assert(tfs_session_unmount(shared_session) == 0);
+
+    shared_session =
+        tfs_session_mount_shared_memory("/tmp/tfs_shared", argv[1]);
+    assert(shared_session != NULL);
+    run_shared_workers();
+    assert(tfs_session_unmount(shared_session) == 0);
+
+    /* the session of the functions without one is independent */
+    assert(tfs_mount("/tmp/tfs_default", argv[1]) == 0);
+    assert(tfs_mount("/tmp/tfs_default", argv[1]) == -1);
+    int f = tfs_open("/p0", 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_unmount() == 0);
+    assert(tfs_unmount() == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
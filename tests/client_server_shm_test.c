@@ -0,0 +1,103 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Several clients talk to the server through shared memory at the same time,
+ * each writing a file in chunks of different sizes (so that requests wrap
+ * around the end of the rings, and some of them don't even fit in a ring)
+ * and then reading it back. */
+
+#define CLIENT_COUNT 4
+#define CHUNK_COUNT 40
+#define FILE_SIZE (200 * 1024)
+#define CLIENT_PIPE_NAME_LEN 40
+#define CLIENT_PIPE_NAME_FORMAT "/tmp/tfs_shm_c%d"
+#define FILE_NAME_FORMAT "/shm%d"
+
+void run_test(char *server_pipe, int client_id);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    int child_pids[CLIENT_COUNT];
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            /* run test on child */
+            run_test(argv[1], i);
+            exit(0);
+        } else {
+            child_pids[i] = pid;
+        }
+    }
+
+    for (int i = 0; i < CLIENT_COUNT; ++i) {
+        int result;
+        waitpid(child_pids[i], &result, 0);
+        assert(WIFEXITED(result));
+        assert(WEXITSTATUS(result) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void run_test(char *server_pipe, int client_id) {
+    char client_pipe[CLIENT_PIPE_NAME_LEN];
+    char path[CLIENT_PIPE_NAME_LEN];
+    sprintf(client_pipe, CLIENT_PIPE_NAME_FORMAT, client_id);
+    sprintf(path, FILE_NAME_FORMAT, client_id);
+
+    char *input = malloc(FILE_SIZE);
+    char *output = malloc(FILE_SIZE);
+    assert(input != NULL && output != NULL);
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('A' + (i + (size_t)client_id) % 26);
+    }
+
+    assert(tfs_mount_shared_memory(client_pipe, server_pipe) == 0);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    /* chunk sizes aren't a divisor of the ring size, so they end up wrapping
+     * around it */
+    size_t written = 0;
+    for (int i = 0; i < CHUNK_COUNT && written < FILE_SIZE; i++) {
+        size_t len = (size_t)(1000 + 997 * i);
+        if (len > FILE_SIZE - written) {
+            len = FILE_SIZE - written;
+        }
+        assert(tfs_write(f, input + written, len) == len);
+        written += len;
+    }
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    size_t read = 0;
+    while (read < written) {
+        ssize_t r = tfs_read(f, output + read, 3000);
+        assert(r > 0);
+        read += (size_t)r;
+    }
+    assert(tfs_read(f, output, 1) == 0);
+    assert(memcmp(input, output, written) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_unmount() == 0);
+
+    free(input);
+    free(output);
+}
@@ -0,0 +1,111 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Append short lines to a file whose writes are buffered, checking through
+ * a second handle (which doesn't flush them) when they reach the server:
+ * once the buffer fills up, on tfs_flush, before a read or a seek on the
+ * same handle, and on tfs_close. */
+
+#define LINE_SIZE 100
+#define BUFFER_SIZE 1000
+
+static char line[LINE_SIZE];
+
+/* returns how much of the file the server has */
+ssize_t file_size(int fhandle) {
+    char buffer[BUFFER_SIZE * 4];
+    assert(tfs_lseek(fhandle, 0, SEEK_SET) == 0);
+    return tfs_read(fhandle, buffer, sizeof(buffer));
+}
+
+void append_lines(int fhandle, int count) {
+    for (int i = 0; i < count; i++) {
+        assert(tfs_write(fhandle, line, LINE_SIZE) == LINE_SIZE);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf(
+            "You must provide the following arguments: 'server_pipe_path'\n");
+        return 1;
+    }
+
+    memset(line, 'L', LINE_SIZE - 1);
+    line[LINE_SIZE - 1] = '\n';
+
+    assert(tfs_mount("/tmp/tfs_write_buffer", argv[1]) == 0);
+
+    int f = tfs_open("/log", TFS_O_CREAT | TFS_O_APPEND);
+    assert(f != -1);
+    int reader = tfs_open("/log", 0);
+    assert(reader != -1);
+    assert(tfs_set_write_buffer(f, BUFFER_SIZE) == 0);
+
+    /* nothing is sent until the buffer is full */
+    append_lines(f, BUFFER_SIZE / LINE_SIZE);
+    assert(file_size(reader) == 0);
+    append_lines(f, 1);
+    assert(file_size(reader) == BUFFER_SIZE);
+
+    /* tfs_flush sends the rest */
+    assert(tfs_flush(f) == 0);
+    assert(file_size(reader) == BUFFER_SIZE + LINE_SIZE);
+    assert(tfs_flush(f) == 0);
+
+    /* a read on the same handle sees the buffered writes */
+    append_lines(f, 2);
+    assert(file_size(reader) == BUFFER_SIZE + LINE_SIZE);
+    char buffer[LINE_SIZE];
+    assert(tfs_read(f, buffer, LINE_SIZE) == 0);
+    assert(file_size(reader) == BUFFER_SIZE + 3 * LINE_SIZE);
+
+    /* writes as big as the buffer go straight to the server */
+    char big[BUFFER_SIZE];
+    memset(big, 'B', BUFFER_SIZE);
+    append_lines(f, 1);
+    assert(tfs_write(f, big, BUFFER_SIZE) == BUFFER_SIZE);
+    assert(file_size(reader) == 2 * BUFFER_SIZE + 4 * LINE_SIZE);
+    assert(tfs_lseek(reader, -BUFFER_SIZE - LINE_SIZE, SEEK_END) ==
+           BUFFER_SIZE + 3 * LINE_SIZE);
+    assert(tfs_read(reader, buffer, LINE_SIZE) == LINE_SIZE);
+    assert(memcmp(buffer, line, LINE_SIZE) == 0);
+
+    /* closing the handle flushes it */
+    append_lines(f, 3);
+    assert(file_size(reader) == 2 * BUFFER_SIZE + 4 * LINE_SIZE);
+    assert(tfs_close(f) != -1);
+    assert(file_size(reader) == 2 * BUFFER_SIZE + 7 * LINE_SIZE);
+
+    /* and so does turning buffering off */
+    f = tfs_open("/log", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_set_write_buffer(f, BUFFER_SIZE) == 0);
+    append_lines(f, 2);
+    assert(file_size(reader) == 0);
+    assert(tfs_set_write_buffer(f, 0) == 0);
+    assert(file_size(reader) == 2 * LINE_SIZE);
+    append_lines(f, 1);
+    assert(file_size(reader) == 3 * LINE_SIZE);
+    assert(tfs_close(f) != -1);
+
+    /* unmounting flushes every handle (and closes them) */
+    f = tfs_open("/log", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_set_write_buffer(f, BUFFER_SIZE) == 0);
+    append_lines(f, 4);
+    assert(tfs_unmount() == 0);
+
+    assert(tfs_mount("/tmp/tfs_write_buffer", argv[1]) == 0);
+    reader = tfs_open("/log", 0);
+    assert(reader != -1);
+    assert(file_size(reader) == 7 * LINE_SIZE);
+    assert(tfs_close(reader) != -1);
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Copy files of every size (stored inline, in fragments and in blocks, with
+ * holes) inside TecnicoFS, over new and existing files, checking their
+ * contents. Then copy a large file over the same destination many more
+ * times than there are blocks for, and copy two files over each other
+ * concurrently. */
+
+#define LARGE_SIZE (30 * BLOCK_SIZE + 100)
+#define HOLE_OFFSET (15 * BLOCK_SIZE)
+#define ROUNDS 50
+
+static char input[LARGE_SIZE];
+static char output[LARGE_SIZE + 1];
+
+void write_file(char const *path, size_t size) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, input, size) == size);
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *expected, size_t size) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, sizeof(output)) == size);
+    assert(memcmp(output, expected, size) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *copy_worker(void *arg) {
+    char const **paths = (char const **)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_copy(paths[0], paths[1], 0) == 0);
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < LARGE_SIZE; i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+
+    size_t sizes[] = {0, 10, INODE_INLINE_DATA_SIZE + 1,
+                      MAX_FRAGMENTED_FILE_SIZE, BLOCK_SIZE + 1, LARGE_SIZE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+        write_file("/source", sizes[i]);
+        /* to a new file, and over a larger one */
+        assert(tfs_copy("/source", "/new", 0) == 0);
+        check_file("/new", input, sizes[i]);
+        write_file("/old", LARGE_SIZE);
+        assert(tfs_copy("/source", "/old", 0) == 0);
+        check_file("/old", input, sizes[i]);
+        check_file("/source", input, sizes[i]);
+
+        int f = tfs_open("/new", TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    /* holes are copied too */
+    char expected[LARGE_SIZE];
+    memset(expected, 0, LARGE_SIZE);
+    memcpy(expected + HOLE_OFFSET, "hole", 4);
+    int f = tfs_open("/sparse", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_lseek(f, HOLE_OFFSET, SEEK_SET) == HOLE_OFFSET);
+    assert(tfs_write(f, "hole", 4) == 4);
+    assert(tfs_close(f) != -1);
+    assert(tfs_copy("/sparse", "/sparse_copy", 0) == 0);
+    check_file("/sparse_copy", expected, HOLE_OFFSET + 4);
+
+    /* copies to itself and from files that don't exist */
+    assert(tfs_copy("/source", "/source", 0) == 0);
+    check_file("/source", input, LARGE_SIZE);
+    assert(tfs_copy("/missing", "/new", 0) == -1);
+    assert(tfs_copy("/source", "", 0) == -1);
+
+    /* the blocks of the replaced contents are freed */
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_copy("/source", "/new", 0) == 0);
+    }
+    check_file("/new", input, LARGE_SIZE);
+
+    char const *forward[] = {"/source", "/new"};
+    char const *backward[] = {"/new", "/source"};
+    pthread_t tid[2];
+    assert(pthread_create(&tid[0], NULL, copy_worker, forward) == 0);
+    assert(pthread_create(&tid[1], NULL, copy_worker, backward) == 0);
+    assert(pthread_join(tid[0], NULL) == 0);
+    assert(pthread_join(tid[1], NULL) == 0);
+    check_file("/source", input, LARGE_SIZE);
+    check_file("/new", input, LARGE_SIZE);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PREALLOCATED_BLOCKS 50
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+/*
+ * Checks that the file has 'size' bytes, the first 'data_size' of them equal
+ * to the input and the remaining ones zeroed.
+ */
+void check_contents(int f, char const *input, size_t data_size, size_t size) {
+    char output[BLOCK_SIZE];
+
+    assert(tfs_lseek(f, 0, SEEK_END) == size);
+    assert(tfs_lseek(f, 0, SEEK_SET) == 0);
+    for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+        size_t to_read =
+            size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+        assert(tfs_read(f, output, BLOCK_SIZE) == to_read);
+        for (size_t i = 0; i < to_read; i++) {
+            assert(output[i] == (offset + i < data_size ? input[i] : 0));
+        }
+    }
+}
+
+/* Shrink and grow files with tfs_ftruncate, checking their contents and that
+ * the blocks past the end are freed, and then preallocate a large file with
+ * tfs_fallocate, checking that it gets a run of consecutive blocks that later
+ * writes reuse. */
+int main() {
+    char input[BLOCK_SIZE];
+    memset(input, 'A', BLOCK_SIZE);
+
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    for (int i = 0; i < 12; i++) {
+        assert(tfs_write(f, input, BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    /* 12 blocks, plus the indirect block */
+    assert(count_free_blocks() == free_blocks - 13);
+
+    assert(tfs_ftruncate(f, 5 * BLOCK_SIZE - 100) == 0);
+    assert(count_free_blocks() == free_blocks - 5);
+    check_contents(f, input, 5 * BLOCK_SIZE - 100, 5 * BLOCK_SIZE - 100);
+
+    /* growing leaves a hole, and the old contents don't come back */
+    assert(tfs_ftruncate(f, 7 * BLOCK_SIZE) == 0);
+    assert(count_free_blocks() == free_blocks - 5);
+    check_contents(f, input, 5 * BLOCK_SIZE - 100, 7 * BLOCK_SIZE);
+
+    /* the same for small files */
+    assert(tfs_ftruncate(f, 0) == 0);
+    assert(tfs_lseek(f, 0, SEEK_SET) == 0);
+    assert(tfs_write(f, input, 300) == 300);
+    assert(tfs_ftruncate(f, 200) == 0);
+    check_contents(f, input, 200, 200);
+    assert(tfs_ftruncate(f, 500) == 0);
+    check_contents(f, input, 200, 500);
+    assert(tfs_ftruncate(f, 3 * BLOCK_SIZE) == 0);
+    check_contents(f, input, 200, 3 * BLOCK_SIZE);
+
+    assert(tfs_ftruncate(f, -1) == -1);
+    assert(tfs_ftruncate(f, MAX_FILE_SIZE + 1) == -1);
+    assert(tfs_ftruncate(f, 0) == 0);
+    assert(tfs_close(f) != -1);
+    assert(count_free_blocks() == free_blocks);
+
+    f = tfs_open("/f2", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_fallocate(f, 0, 0) == -1);
+    assert(tfs_fallocate(f, MAX_FILE_SIZE, 1) == -1);
+    assert(tfs_fallocate(f, BLOCK_SIZE, PREALLOCATED_BLOCKS * BLOCK_SIZE) ==
+           0);
+    /* the first block is a hole, the rest was taken (plus the indirect
+     * block), as a run of consecutive blocks */
+    assert(count_free_blocks() == free_blocks - PREALLOCATED_BLOCKS - 1);
+    check_contents(f, input, 0, (PREALLOCATED_BLOCKS + 1) * BLOCK_SIZE);
+
+    inode_t *inode = inode_get(tfs_lookup("/f2"));
+    assert(inode != NULL);
+    assert(inode_get_block_number_at_index(inode, 0) == INODE_HOLE);
+    int first_block = inode_get_block_number_at_index(inode, 1);
+    for (int i = 1; i <= PREALLOCATED_BLOCKS; i++) {
+        assert(inode_get_block_number_at_index(inode, i) ==
+               first_block + i - 1);
+    }
+
+    /* writing to the preallocated range doesn't take any more blocks */
+    assert(tfs_lseek(f, BLOCK_SIZE, SEEK_SET) == BLOCK_SIZE);
+    for (int i = 0; i < PREALLOCATED_BLOCKS; i++) {
+        assert(tfs_write(f, input, BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    assert(count_free_blocks() == free_blocks - PREALLOCATED_BLOCKS - 1);
+    assert(tfs_close(f) != -1);
+
+    /* preallocating a small file reserves its fragments */
+    f = tfs_open("/f3", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_fallocate(f, 0, 300) == 0);
+    check_contents(f, input, 0, 300);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
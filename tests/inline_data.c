@@ -0,0 +1,93 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 20
+#define SMALL_SIZE 10
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+/* Write small files, checking that they take no data blocks, and then make
+ * them grow past INODE_INLINE_DATA_SIZE, checking that their contents are
+ * moved to data blocks. */
+int main() {
+    char input[BLOCK_SIZE];
+    char output[BLOCK_SIZE];
+    char path[MAX_FILE_NAME];
+
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, input, SMALL_SIZE) == SMALL_SIZE);
+        /* leave a small hole, still inside the inode */
+        assert(tfs_lseek(f, 2 * SMALL_SIZE, SEEK_SET) == 2 * SMALL_SIZE);
+        assert(tfs_write(f, input, SMALL_SIZE) == SMALL_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, output, BLOCK_SIZE) == 3 * SMALL_SIZE);
+        assert(memcmp(output, input, SMALL_SIZE) == 0);
+        for (int j = SMALL_SIZE; j < 2 * SMALL_SIZE; j++) {
+            assert(output[j] == 0);
+        }
+        assert(memcmp(output + 2 * SMALL_SIZE, input, SMALL_SIZE) == 0);
+
+        /* grow the file past the inline threshold */
+        assert(tfs_write(f, input, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks - 2 * FILE_COUNT);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_lseek(f, 2 * SMALL_SIZE, SEEK_SET) == 2 * SMALL_SIZE);
+        assert(tfs_read(f, output, SMALL_SIZE) == SMALL_SIZE);
+        assert(memcmp(output, input, SMALL_SIZE) == 0);
+        assert(tfs_read(f, output, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(memcmp(output, input, BLOCK_SIZE) == 0);
+        assert(tfs_close(f) != -1);
+
+        /* once truncated, the file is stored inline again */
+        f = tfs_open(path, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_write(f, input, SMALL_SIZE) == SMALL_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
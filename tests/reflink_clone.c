@@ -0,0 +1,186 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Clone a large file many more times than there are blocks for, checking
+ * that the clones take no data blocks of their own, then write to the clones
+ * concurrently (each write taking its own copy of a shared block), shrink
+ * one into the middle of a shared block, replace the original, preallocate
+ * a range of a clone and fill it with the disk full, and check that no file
+ * sees the changes to another one and that every block is given back when
+ * the clones are truncated. */
+
+#define FILE_BLOCKS 200
+#define CLONES 10
+#define WRITES 20
+
+static char input[FILE_BLOCKS * BLOCK_SIZE];
+static char output[FILE_BLOCKS * BLOCK_SIZE + 1];
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+void check_file(char const *path, char const *expected, size_t size) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, sizeof(output)) == size);
+    assert(memcmp(output, expected, size) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+/* Writes a few bytes in the middle of some blocks of a clone, and checks
+ * the whole clone. */
+void *write_clone(void *arg) {
+    int id = *((int *)arg);
+    char path[MAX_FILE_NAME];
+    sprintf(path, "/c%d", id);
+
+    static char expected[CLONES][FILE_BLOCKS * BLOCK_SIZE];
+    memcpy(expected[id], input, sizeof(input));
+    char mark[4];
+    memset(mark, '0' + id, sizeof(mark));
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    for (int i = 0; i < WRITES; i++) {
+        off_t offset = (off_t)((id + i * CLONES) % FILE_BLOCKS) * BLOCK_SIZE +
+                       BLOCK_SIZE / 2;
+        assert(tfs_lseek(f, offset, SEEK_SET) == offset);
+        assert(tfs_write(f, mark, sizeof(mark)) == sizeof(mark));
+        memcpy(expected[id] + offset, mark, sizeof(mark));
+    }
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    static char read_back[CLONES][FILE_BLOCKS * BLOCK_SIZE];
+    assert(tfs_read(f, read_back[id], sizeof(read_back[id])) ==
+           sizeof(read_back[id]));
+    assert(memcmp(read_back[id], expected[id], sizeof(input)) == 0);
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    int f = tfs_open("/original", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, input, sizeof(input)) == sizeof(input));
+    assert(tfs_close(f) != -1);
+    /* the data blocks and the indirect block */
+    int original_blocks = free_blocks - count_free_blocks();
+    assert(original_blocks == FILE_BLOCKS + 1);
+
+    /* each clone only takes an indirect block */
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < CLONES; i++) {
+        sprintf(path, "/c%d", i);
+        assert(tfs_clone("/original", path) == 0);
+        check_file(path, input, sizeof(input));
+    }
+    assert(free_blocks - count_free_blocks() == original_blocks + CLONES);
+
+    /* each written block is copied once */
+    pthread_t tid[CLONES];
+    int ids[CLONES];
+    for (int i = 0; i < CLONES; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, write_clone, &ids[i]) == 0);
+    }
+    for (int i = 0; i < CLONES; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    check_file("/original", input, sizeof(input));
+    assert(free_blocks - count_free_blocks() ==
+           original_blocks + CLONES + CLONES * WRITES);
+
+    /* shrinking a clone into a shared block leaves the original whole */
+    assert(tfs_clone("/original", "/shrunk") == 0);
+    f = tfs_open("/shrunk", 0);
+    assert(f != -1);
+    assert(tfs_ftruncate(f, BLOCK_SIZE + 10) == 0);
+    assert(tfs_ftruncate(f, 2 * BLOCK_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+    char expected[2 * BLOCK_SIZE];
+    memcpy(expected, input, sizeof(expected));
+    memset(expected + BLOCK_SIZE + 10, 0, BLOCK_SIZE - 10);
+    check_file("/shrunk", expected, sizeof(expected));
+    check_file("/original", input, sizeof(input));
+
+    /* replacing the original leaves a clone whole */
+    assert(tfs_copy("/shrunk", "/original", 0) == 0);
+    check_file("/original", expected, sizeof(expected));
+    assert(tfs_clone("/c1", "/c2") == 0);
+    sprintf(path, "/c%d", CLONES - 1);
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(memcmp(output, input, BLOCK_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    /* preallocating a range of a clone copies the blocks it shares, so that
+     * the range can then be written with no free block left */
+    assert(tfs_clone("/original", "/preallocated") == 0);
+    f = tfs_open("/preallocated", 0);
+    assert(f != -1);
+    int before_fallocate = count_free_blocks();
+    assert(tfs_fallocate(f, 0, sizeof(expected)) == 0);
+    assert(before_fallocate - count_free_blocks() == 2);
+
+    int filler[DATA_BLOCKS];
+    int filler_count = 0;
+    while ((filler[filler_count] = data_block_alloc()) != -1) {
+        ++filler_count;
+    }
+    char fill[2 * BLOCK_SIZE];
+    memset(fill, 'F', sizeof(fill));
+    assert(tfs_write(f, fill, sizeof(fill)) == sizeof(fill));
+    assert(tfs_close(f) != -1);
+    for (int i = 0; i < filler_count; i++) {
+        assert(data_block_free(filler[i]) == 0);
+    }
+    check_file("/preallocated", fill, sizeof(fill));
+    check_file("/original", expected, sizeof(expected));
+
+    /* every block is given back once no file takes it */
+    char const *others[] = {"/original", "/shrunk", "/preallocated"};
+    for (int i = 0; i < 3; i++) {
+        f = tfs_open(others[i], TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    for (int i = 0; i < CLONES; i++) {
+        sprintf(path, "/c%d", i);
+        f = tfs_open(path, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Take snapshots of files of every size (stored inline, in fragments and in
+ * blocks), checking that taking one takes no blocks, then change, truncate
+ * and create files and check that the snapshots still read them as they
+ * were, including while a large file is rewritten concurrently. Preallocate
+ * a range of a file saved into a snapshot and fill it with the disk full.
+ * Finally delete the snapshots and check that every block is given back. */
+
+#define LARGE_BLOCKS 200
+#define MEDIUM_BLOCKS 4
+#define ROUNDS 20
+
+static char input[LARGE_BLOCKS * BLOCK_SIZE];
+static char changed[LARGE_BLOCKS * BLOCK_SIZE];
+static char output[LARGE_BLOCKS * BLOCK_SIZE + 1];
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+void write_file(char const *path, char const *contents, size_t size) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, size) == size);
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(char const *path, char const *expected, size_t size) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, output, sizeof(output)) == size);
+    assert(memcmp(output, expected, size) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void check_snapshot_file(int snapshot, char const *path, char const *expected,
+                         size_t size) {
+    static char buffer[LARGE_BLOCKS * BLOCK_SIZE + 1];
+    int f = tfs_snapshot_open(snapshot, path);
+    assert(f != -1);
+    assert(tfs_snapshot_read(f, buffer, sizeof(buffer)) == size);
+    assert(memcmp(buffer, expected, size) == 0);
+    assert(tfs_snapshot_close(f) == 0);
+}
+
+void *rewrite_large(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        write_file("/large", i % 2 == 0 ? changed : input, sizeof(input));
+    }
+    return NULL;
+}
+
+void *read_large_snapshot(void *arg) {
+    int snapshot = *((int *)arg);
+    for (int i = 0; i < ROUNDS; i++) {
+        check_snapshot_file(snapshot, "/large", input, sizeof(input));
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (char)('A' + i % 26);
+        changed[i] = (char)('a' + i % 26);
+    }
+    size_t sizes[] = {10, MAX_FRAGMENTED_FILE_SIZE, sizeof(input)};
+    char const *paths[] = {"/small", "/fragment", "/large"};
+
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    for (int i = 0; i < 3; i++) {
+        write_file(paths[i], input, sizes[i]);
+    }
+
+    /* taking a snapshot takes no blocks */
+    int files_free_blocks = count_free_blocks();
+    int snapshot = tfs_snapshot_create();
+    assert(snapshot != -1);
+    assert(count_free_blocks() == files_free_blocks);
+    for (int i = 0; i < 3; i++) {
+        check_snapshot_file(snapshot, paths[i], input, sizes[i]);
+    }
+
+    /* change every file (in a single block of the large one), and create a
+     * new one */
+    for (int i = 0; i < 2; i++) {
+        write_file(paths[i], changed, sizes[i]);
+    }
+    int f = tfs_open("/large", 0);
+    assert(f != -1);
+    assert(tfs_lseek(f, 100 * BLOCK_SIZE, SEEK_SET) == 100 * BLOCK_SIZE);
+    assert(tfs_write(f, "changed", 7) == 7);
+    assert(tfs_close(f) != -1);
+    write_file("/new", changed, 10);
+
+    char expected[sizeof(input)];
+    memcpy(expected, input, sizeof(input));
+    memcpy(expected + 100 * BLOCK_SIZE, "changed", 7);
+    check_file("/large", expected, sizeof(input));
+    for (int i = 0; i < 3; i++) {
+        check_snapshot_file(snapshot, paths[i], input, sizes[i]);
+    }
+    assert(tfs_snapshot_open(snapshot, "/new") == -1);
+
+    /* a second snapshot sees the changes */
+    int second = tfs_snapshot_create();
+    assert(second != -1 && second != snapshot);
+    check_snapshot_file(second, "/large", expected, sizeof(input));
+    check_snapshot_file(second, "/new", changed, 10);
+
+    /* truncating a file leaves the snapshots whole */
+    f = tfs_open("/small", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    check_snapshot_file(snapshot, "/small", input, sizes[0]);
+    check_snapshot_file(second, "/small", changed, sizes[0]);
+
+    /* only MAX_SNAPSHOTS can exist at a time */
+    int others[MAX_SNAPSHOTS];
+    for (int i = 2; i < MAX_SNAPSHOTS; i++) {
+        others[i] = tfs_snapshot_create();
+        assert(others[i] != -1);
+    }
+    assert(tfs_snapshot_create() == -1);
+    for (int i = 2; i < MAX_SNAPSHOTS; i++) {
+        assert(tfs_snapshot_delete(others[i]) == 0);
+    }
+
+    /* the snapshot is read while the file is rewritten */
+    pthread_t tid[2];
+    assert(pthread_create(&tid[0], NULL, rewrite_large, NULL) == 0);
+    assert(pthread_create(&tid[1], NULL, read_large_snapshot, &snapshot) ==
+           0);
+    assert(pthread_join(tid[0], NULL) == 0);
+    assert(pthread_join(tid[1], NULL) == 0);
+    check_file("/large", input, sizeof(input));
+
+    /* snapshots with open files can't be deleted, and their handles are
+     * their own */
+    f = tfs_snapshot_open(snapshot, "/fragment");
+    assert(f != -1);
+    assert(tfs_snapshot_delete(snapshot) == -1);
+    assert(tfs_snapshot_close(f) == 0);
+    assert(tfs_snapshot_close(f) == -1);
+    assert(tfs_snapshot_read(f, output, sizeof(output)) == -1);
+    assert(tfs_snapshot_delete(snapshot) == 0);
+    assert(tfs_snapshot_delete(snapshot) == -1);
+    assert(tfs_snapshot_open(snapshot, "/large") == -1);
+    assert(tfs_snapshot_delete(second) == 0);
+
+    /* preallocating a range of a file copies the blocks it shares with a
+     * snapshot, so that the range can then be written with no free block
+     * left */
+    write_file("/medium", input, MEDIUM_BLOCKS * BLOCK_SIZE);
+    snapshot = tfs_snapshot_create();
+    assert(snapshot != -1);
+    f = tfs_open("/medium", 0);
+    assert(f != -1);
+    int before_fallocate = count_free_blocks();
+    assert(tfs_fallocate(f, 0, MEDIUM_BLOCKS * BLOCK_SIZE) == 0);
+    assert(before_fallocate - count_free_blocks() == MEDIUM_BLOCKS);
+
+    int filler[DATA_BLOCKS];
+    int filler_count = 0;
+    while ((filler[filler_count] = data_block_alloc()) != -1) {
+        ++filler_count;
+    }
+    assert(tfs_write(f, changed, MEDIUM_BLOCKS * BLOCK_SIZE) ==
+           MEDIUM_BLOCKS * BLOCK_SIZE);
+    assert(tfs_close(f) != -1);
+    for (int i = 0; i < filler_count; i++) {
+        assert(data_block_free(filler[i]) == 0);
+    }
+    check_file("/medium", changed, MEDIUM_BLOCKS * BLOCK_SIZE);
+    check_snapshot_file(snapshot, "/medium", input,
+                        MEDIUM_BLOCKS * BLOCK_SIZE);
+    assert(tfs_snapshot_delete(snapshot) == 0);
+
+    /* every block is given back once the files are truncated */
+    char const *all[] = {"/small", "/fragment", "/large", "/new", "/medium"};
+    for (int i = 0; i < 5; i++) {
+        f = tfs_open(all[i], TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
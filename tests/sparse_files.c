@@ -0,0 +1,79 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HOLE_SIZE (5 * BLOCK_SIZE + 100)
+
+/* Seek past the end of a file and write there, checking that the gap reads
+ * back as zeros. Then fill the directory with files that have a single byte
+ * written at the very end, which would need far more than DATA_BLOCKS blocks
+ * if holes took up space. */
+int main() {
+    char *str = "AAA!";
+    char buffer[HOLE_SIZE + 8];
+    char zeros[HOLE_SIZE];
+    memset(zeros, 0, HOLE_SIZE);
+
+    assert(tfs_init() != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+
+    /* reading past the end of the file returns nothing */
+    assert(tfs_lseek(f, HOLE_SIZE, SEEK_SET) == HOLE_SIZE);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 0);
+
+    assert(tfs_write(f, str, strlen(str)) == strlen(str));
+    assert(tfs_lseek(f, 0, SEEK_END) == HOLE_SIZE + strlen(str));
+    assert(tfs_lseek(f, -1, SEEK_SET) == -1);
+    assert(tfs_lseek(f, MAX_FILE_SIZE + 1, SEEK_SET) == -1);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == HOLE_SIZE + strlen(str));
+    assert(memcmp(buffer, zeros, HOLE_SIZE) == 0);
+    assert(memcmp(buffer + HOLE_SIZE, str, strlen(str)) == 0);
+
+    /* filling part of the hole keeps the rest of it zeroed */
+    assert(tfs_lseek(f, BLOCK_SIZE + 10, SEEK_SET) == BLOCK_SIZE + 10);
+    assert(tfs_write(f, str, strlen(str)) == strlen(str));
+    assert(tfs_lseek(f, -(off_t)strlen(str) - 10, SEEK_CUR) == BLOCK_SIZE);
+    assert(tfs_read(f, buffer, 20) == 20);
+    assert(memcmp(buffer, zeros, 10) == 0);
+    assert(memcmp(buffer + 10, str, strlen(str)) == 0);
+    assert(memcmp(buffer + 10 + strlen(str), zeros, 10 - strlen(str)) == 0);
+    assert(tfs_close(f) != -1);
+
+    /* truncating a sparse file frees its blocks */
+    f = tfs_open("/f1", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    char path[MAX_FILE_NAME];
+    for (int i = 1; i < MAX_DIR_ENTRIES; i++) {
+        sprintf(path, "/s%d", i);
+        f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_lseek(f, MAX_FILE_SIZE - 1, SEEK_SET) == MAX_FILE_SIZE - 1);
+        assert(tfs_write(f, "B", 1) == 1);
+        assert(tfs_write(f, "B", 1) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    f = tfs_open("/s1", 0);
+    assert(f != -1);
+    assert(tfs_lseek(f, -BLOCK_SIZE, SEEK_END) == MAX_FILE_SIZE - BLOCK_SIZE);
+    assert(tfs_read(f, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(memcmp(buffer, zeros, BLOCK_SIZE - 1) == 0);
+    assert(buffer[BLOCK_SIZE - 1] == 'B');
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
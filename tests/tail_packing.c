@@ -0,0 +1,118 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 20
+#define FILE_SIZE 300
+#define THREAD_COUNT 8
+#define APPEND_SIZE 50
+
+/*
+ * Counts the free data blocks by allocating all of them (and then freeing
+ * them again).
+ */
+int count_free_blocks() {
+    int blocks[DATA_BLOCKS];
+    int count = 0;
+    while ((blocks[count] = data_block_alloc()) != -1) {
+        ++count;
+    }
+    for (int i = 0; i < count; i++) {
+        assert(data_block_free(blocks[i]) == 0);
+    }
+    return count;
+}
+
+char input[BLOCK_SIZE];
+
+void *append_small_file(void *arg);
+
+/* Write files smaller than a block, checking that they share blocks, and then
+ * append to small files concurrently, so their runs of fragments have to grow
+ * or move, until they no longer fit in a run of fragments. */
+int main() {
+    char output[BLOCK_SIZE];
+    char path[MAX_FILE_NAME];
+
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+
+    assert(tfs_init() != -1);
+    int free_blocks = count_free_blocks();
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, input + i, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    /* two 300 byte files fit in each block */
+    assert(free_blocks - count_free_blocks() == FILE_COUNT / 2);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, output, BLOCK_SIZE) == FILE_SIZE);
+        assert(memcmp(output, input + i, FILE_SIZE) == 0);
+        assert(tfs_close(f) != -1);
+
+        /* deleting the contents of every file frees every shared block */
+        f = tfs_open(path, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    pthread_t tid[THREAD_COUNT];
+    int file_id[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        file_id[i] = i;
+        assert(pthread_create(&tid[i], NULL, append_small_file,
+                              &file_id[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        sprintf(path, "/f%d", i);
+        int f = tfs_open(path, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    assert(tfs_destroy() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void *append_small_file(void *arg) {
+    char path[MAX_FILE_NAME];
+    char output[BLOCK_SIZE];
+    int id = *((int *)arg);
+    sprintf(path, "/f%d", id);
+
+    int f = tfs_open(path, TFS_O_APPEND);
+    assert(f != -1);
+    for (int size = 0; size + APPEND_SIZE <= BLOCK_SIZE; size += APPEND_SIZE) {
+        assert(tfs_write(f, input + size, APPEND_SIZE) == APPEND_SIZE);
+    }
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    size_t size = BLOCK_SIZE - BLOCK_SIZE % APPEND_SIZE;
+    assert(tfs_read(f, output, BLOCK_SIZE) == size);
+    assert(memcmp(output, input, size) == 0);
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}